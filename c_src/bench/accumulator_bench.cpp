@@ -0,0 +1,237 @@
+// Micro-benchmark for fit::Accumulator on an hr-message-heavy workload.
+//
+// Build and run with `make bench`. Three accumulator variants are timed on the
+// same call mix, then a synthetic hr-heavy FIT file is decoded end to end:
+//
+//   legacy   - the SDK's original std::vector scan that copied every entry
+//   keyed    - fit::Accumulator looked up by (mesgNum, destFieldNum)
+//   slot     - fit::Accumulator with the slot resolved once up front
+//
+// Each iteration accumulates the 8 hr event_timestamp values of one hr message
+// plus the record distance, speed and accumulated_power components, which is
+// the mix fit::Decode sees on a watch file with optical HR logging.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fit_accumulated_field.hpp"
+#include "fit_accumulator.hpp"
+#include "fit_crc.hpp"
+#include "fit_decode.hpp"
+#include "fit_mesg_listener.hpp"
+
+static const FIT_UINT16 HR_MESG = 132;
+static const FIT_UINT8 HR_EVENT_TIMESTAMP = 9;
+static const FIT_UINT16 RECORD_MESG = 20;
+static const FIT_UINT8 RECORD_DISTANCE = 5;
+static const FIT_UINT8 RECORD_SPEED = 6;
+static const FIT_UINT8 RECORD_ACCUMULATED_POWER = 29;
+
+// The pre-change fit::Accumulator, kept verbatim as the baseline.
+class LegacyAccumulator {
+public:
+    FIT_UINT32 Accumulate(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum, const FIT_UINT32 value,
+                          const FIT_UINT8 bits) {
+        int i;
+        fit::AccumulatedField accumField;
+
+        for (i = 0; i < (int)fields.size(); i++) {
+            accumField = fields.at(i);
+            if ((accumField.mesgNum == mesgNum) && (accumField.destFieldNum == destFieldNum)) {
+                break;
+            }
+        }
+
+        if (i == (int)fields.size()) {
+            fields.push_back(fit::AccumulatedField(mesgNum, destFieldNum));
+        }
+
+        return fields[i].Accumulate(value, bits);
+    }
+
+private:
+    std::vector<fit::AccumulatedField> fields;
+};
+
+struct Timer {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    double ns() const {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+static const int CALLS_PER_ITERATION = 11;
+
+static void report(const char* name, double ns, long long calls, unsigned long long checksum) {
+    std::printf("%-8s %8.2f ns/call  (checksum %llu)\n", name, ns / calls, checksum);
+}
+
+static void bench_legacy(long long iterations) {
+    LegacyAccumulator accumulator;
+    unsigned long long checksum = 0;
+    Timer timer;
+
+    for (long long i = 0; i < iterations; i++) {
+        FIT_UINT32 tick = (FIT_UINT32)(i * 8);
+        for (FIT_UINT32 k = 0; k < 8; k++) {
+            checksum += accumulator.Accumulate(HR_MESG, HR_EVENT_TIMESTAMP, (tick + k) & 0xFFF, 12);
+        }
+        checksum += accumulator.Accumulate(RECORD_MESG, RECORD_DISTANCE, (FIT_UINT32)i & 0xFFF, 12);
+        checksum += accumulator.Accumulate(RECORD_MESG, RECORD_SPEED, (FIT_UINT32)i & 0xFFF, 12);
+        checksum += accumulator.Accumulate(RECORD_MESG, RECORD_ACCUMULATED_POWER, (FIT_UINT32)i & 0xFFFF, 16);
+    }
+
+    report("legacy", timer.ns(), iterations * CALLS_PER_ITERATION, checksum);
+}
+
+static void bench_keyed(long long iterations) {
+    fit::Accumulator accumulator;
+    unsigned long long checksum = 0;
+    Timer timer;
+
+    for (long long i = 0; i < iterations; i++) {
+        FIT_UINT32 tick = (FIT_UINT32)(i * 8);
+        for (FIT_UINT32 k = 0; k < 8; k++) {
+            checksum += accumulator.Accumulate(HR_MESG, HR_EVENT_TIMESTAMP, (tick + k) & 0xFFF, 12);
+        }
+        checksum += accumulator.Accumulate(RECORD_MESG, RECORD_DISTANCE, (FIT_UINT32)i & 0xFFF, 12);
+        checksum += accumulator.Accumulate(RECORD_MESG, RECORD_SPEED, (FIT_UINT32)i & 0xFFF, 12);
+        checksum += accumulator.Accumulate(RECORD_MESG, RECORD_ACCUMULATED_POWER, (FIT_UINT32)i & 0xFFFF, 16);
+    }
+
+    report("keyed", timer.ns(), iterations * CALLS_PER_ITERATION, checksum);
+}
+
+static void bench_slot(long long iterations) {
+    fit::Accumulator accumulator;
+    unsigned long long checksum = 0;
+    const FIT_UINT16 hr = accumulator.GetSlot(HR_MESG, HR_EVENT_TIMESTAMP);
+    const FIT_UINT16 distance = accumulator.GetSlot(RECORD_MESG, RECORD_DISTANCE);
+    const FIT_UINT16 speed = accumulator.GetSlot(RECORD_MESG, RECORD_SPEED);
+    const FIT_UINT16 power = accumulator.GetSlot(RECORD_MESG, RECORD_ACCUMULATED_POWER);
+    Timer timer;
+
+    for (long long i = 0; i < iterations; i++) {
+        FIT_UINT32 tick = (FIT_UINT32)(i * 8);
+        for (FIT_UINT32 k = 0; k < 8; k++) {
+            checksum += accumulator.Accumulate(hr, (tick + k) & 0xFFF, 12);
+        }
+        checksum += accumulator.Accumulate(distance, (FIT_UINT32)i & 0xFFF, 12);
+        checksum += accumulator.Accumulate(speed, (FIT_UINT32)i & 0xFFF, 12);
+        checksum += accumulator.Accumulate(power, (FIT_UINT32)i & 0xFFFF, 16);
+    }
+
+    report("slot", timer.ns(), iterations * CALLS_PER_ITERATION, checksum);
+}
+
+static void put16(std::string* out, FIT_UINT16 value) {
+    out->push_back((char)(value & 0xFF));
+    out->push_back((char)(value >> 8));
+}
+
+static void put32(std::string* out, FIT_UINT32 value) {
+    put16(out, (FIT_UINT16)(value & 0xFFFF));
+    put16(out, (FIT_UINT16)(value >> 16));
+}
+
+// Builds a FIT file of `count` hr messages, each carrying 8 packed 12-bit
+// event timestamps and 8 filtered_bpm values.
+static std::string hr_fit_file(int count) {
+    std::string data;
+    data += (char)0x40;  // definition, local message 0
+    data += (char)0;
+    data += (char)0;  // little endian
+    put16(&data, HR_MESG);
+    data += (char)2;
+    data += (char)10;  // event_timestamp_12
+    data += (char)12;
+    data += (char)0x0D;
+    data += (char)6;  // filtered_bpm
+    data += (char)8;
+    data += (char)0x02;
+
+    FIT_UINT32 tick = 0;
+    for (int i = 0; i < count; i++) {
+        unsigned char packed[12] = {0};
+        for (int k = 0; k < 8; k++) {
+            tick += 700 + (FIT_UINT32)((i * 8 + k) % 200);
+            FIT_UINT32 value = tick & 0xFFF;
+            int bit = k * 12;
+            for (int b = 0; b < 12; b++, bit++) {
+                if (value & (1u << b)) {
+                    packed[bit / 8] |= (unsigned char)(1u << (bit % 8));
+                }
+            }
+        }
+        data += (char)0x00;
+        data.append((const char*)packed, sizeof(packed));
+        for (int k = 0; k < 8; k++) {
+            data += (char)(110 + (i + k) % 60);
+        }
+    }
+
+    std::string file;
+    file += (char)14;
+    file += (char)0x20;
+    put16(&file, 2171);
+    put32(&file, (FIT_UINT32)data.size());
+    file += ".FIT";
+    put16(&file, fit::CRC::Calc16(file.data(), (FIT_UINT32)file.size()));
+    file += data;
+    put16(&file, fit::CRC::Calc16(file.data(), (FIT_UINT32)file.size()));
+    return file;
+}
+
+class HrListener : public fit::MesgListener {
+public:
+    unsigned long long messages = 0;
+    double checksum = 0;
+
+    void OnMesg(fit::Mesg& mesg) override {
+        messages++;
+        const fit::Field* field = mesg.GetField(HR_EVENT_TIMESTAMP);
+        if (field != NULL) {
+            checksum += field->GetFLOAT64Value(field->GetNumValues() - 1);
+        }
+    }
+};
+
+static void bench_decode(int count, int rounds) {
+    const std::string file = hr_fit_file(count);
+    double best = 0;
+    HrListener listener;
+
+    for (int round = 0; round < rounds; round++) {
+        std::istringstream stream(file);
+        fit::Decode decode;
+        listener = HrListener();
+        Timer timer;
+        if (!decode.Read(stream, listener)) {
+            std::fprintf(stderr, "decode failed\n");
+            std::exit(1);
+        }
+        double ns = timer.ns();
+        if (round == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    std::printf("decode   %8.1f ns/hr message, %zu bytes, %llu messages (checksum %.0f)\n", best / count,
+                file.size(), listener.messages, listener.checksum);
+}
+
+int main(int argc, char** argv) {
+    long long iterations = argc > 1 ? std::atoll(argv[1]) : 20000000;
+    int messages = argc > 2 ? std::atoi(argv[2]) : 200000;
+
+    bench_legacy(iterations);
+    bench_keyed(iterations);
+    bench_slot(iterations);
+    bench_decode(messages, 5);
+    return 0;
+}
@@ -1,56 +1,75 @@
-/////////////////////////////////////////////////////////////////////////////////////////////
-// Copyright 2025 Garmin International, Inc.
-// Licensed under the Flexible and Interoperable Data Transfer (FIT) Protocol License; you
-// may not use this file except in compliance with the Flexible and Interoperable Data
-// Transfer (FIT) Protocol License.
-/////////////////////////////////////////////////////////////////////////////////////////////
-// ****WARNING****  This file is auto-generated!  Do NOT edit this file.
-// Profile Version = 21.171.0Release
-// Tag = production/release/21.171.0-0-g57fed75
-/////////////////////////////////////////////////////////////////////////////////////////////
-
-
-#include "fit_accumulator.hpp"
-
-namespace fit
-{
-
-FIT_UINT32 Accumulator::Accumulate(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum, const FIT_UINT32 value, const FIT_UINT8 bits)
-{
-   int i;
-   AccumulatedField accumField;
-
-   for (i = 0; i < (int)fields.size(); i++)
-   {
-       accumField = fields.at(i);
-       if ( ( accumField.mesgNum == mesgNum ) && ( accumField.destFieldNum == destFieldNum ) )
-         break;
-   }
-
-   if (i == (int)fields.size()) {
-      fields.push_back(AccumulatedField(mesgNum, destFieldNum));
-   }
-
-   return fields[i].Accumulate(value, bits);
-}
-
-void Accumulator::Set(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum, const FIT_UINT32 value)
-{
-    int i;
-    AccumulatedField accumField;
-
-    for (i = 0; i < (int)fields.size(); i++)
-    {
-        accumField = fields.at(i);
-        if ( ( accumField.mesgNum == mesgNum ) && ( accumField.destFieldNum == destFieldNum ) )
-            break;
-    }
-
-    if (i == (int)fields.size()) {
-        accumField = AccumulatedField(mesgNum, destFieldNum);
-        fields.push_back(accumField);
-    }
-    fields[i].Set(value);
-}
-
-} // namespace fit
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2025 Garmin International, Inc.
+// Licensed under the Flexible and Interoperable Data Transfer (FIT) Protocol License; you
+// may not use this file except in compliance with the Flexible and Interoperable Data
+// Transfer (FIT) Protocol License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+// ****WARNING****  This file is auto-generated!  Do NOT edit this file.
+// Profile Version = 21.171.0Release
+// Tag = production/release/21.171.0-0-g57fed75
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "fit_accumulator.hpp"
+
+namespace fit
+{
+
+Accumulator::Accumulator()
+{
+   for (FIT_UINT16 i = 0; i < NumSlots; i++)
+      keys[i] = EmptyKey;
+}
+
+FIT_UINT16 Accumulator::GetSlot(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum)
+{
+   FIT_UINT32 key = ((FIT_UINT32)mesgNum << 8) | destFieldNum;
+   FIT_UINT16 slot = (FIT_UINT16)((key * 2654435761u) >> 26); // Top 6 bits select one of 64 slots.
+
+   for (FIT_UINT16 probes = 0; probes < NumSlots; probes++)
+   {
+      if (keys[slot] == key)
+         return slot;
+
+      if (keys[slot] == EmptyKey)
+      {
+         keys[slot] = key;
+         fields[slot] = AccumulatedField(mesgNum, destFieldNum);
+         return slot;
+      }
+
+      slot = (slot + 1) & (NumSlots - 1);
+   }
+
+   return InvalidSlot;
+}
+
+FIT_UINT32 Accumulator::Accumulate(const FIT_UINT16 slot, const FIT_UINT32 value, const FIT_UINT8 bits)
+{
+   return fields[slot].Accumulate(value, bits);
+}
+
+void Accumulator::Set(const FIT_UINT16 slot, const FIT_UINT32 value)
+{
+   fields[slot].Set(value);
+}
+
+FIT_UINT32 Accumulator::Accumulate(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum, const FIT_UINT32 value, const FIT_UINT8 bits)
+{
+   const FIT_UINT16 slot = GetSlot(mesgNum, destFieldNum);
+
+   if (slot == InvalidSlot)
+      return value;
+
+   return Accumulate(slot, value, bits);
+}
+
+void Accumulator::Set(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum, const FIT_UINT32 value)
+{
+   const FIT_UINT16 slot = GetSlot(mesgNum, destFieldNum);
+
+   if (slot != InvalidSlot)
+      Set(slot, value);
+}
+
+} // namespace fit
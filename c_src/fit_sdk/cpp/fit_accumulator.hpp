@@ -1,35 +1,55 @@
-/////////////////////////////////////////////////////////////////////////////////////////////
-// Copyright 2025 Garmin International, Inc.
-// Licensed under the Flexible and Interoperable Data Transfer (FIT) Protocol License; you
-// may not use this file except in compliance with the Flexible and Interoperable Data
-// Transfer (FIT) Protocol License.
-/////////////////////////////////////////////////////////////////////////////////////////////
-// ****WARNING****  This file is auto-generated!  Do NOT edit this file.
-// Profile Version = 21.171.0Release
-// Tag = production/release/21.171.0-0-g57fed75
-/////////////////////////////////////////////////////////////////////////////////////////////
-
-
-#if !defined(FIT_ACCUMULATOR_HPP)
-#define FIT_ACCUMULATOR_HPP
-
-#include <vector>
-#include "fit_accumulated_field.hpp"
-
-namespace fit
-{
-
-class Accumulator
-{
-   public:
-      FIT_UINT32 Accumulate(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum, const FIT_UINT32 value, const FIT_UINT8 bits);
-      void Set(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum, const FIT_UINT32 value );
-
-   private:
-      std::vector<AccumulatedField> fields;
-};
-
-} // namespace fit
-
-#endif // defined(FIT_ACCUMULATOR_HPP)
-
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2025 Garmin International, Inc.
+// Licensed under the Flexible and Interoperable Data Transfer (FIT) Protocol License; you
+// may not use this file except in compliance with the Flexible and Interoperable Data
+// Transfer (FIT) Protocol License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+// ****WARNING****  This file is auto-generated!  Do NOT edit this file.
+// Profile Version = 21.171.0Release
+// Tag = production/release/21.171.0-0-g57fed75
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+
+#if !defined(FIT_ACCUMULATOR_HPP)
+#define FIT_ACCUMULATOR_HPP
+
+#include "fit_accumulated_field.hpp"
+
+namespace fit
+{
+
+class Accumulator
+{
+   public:
+      static const FIT_UINT16 InvalidSlot = 0xFFFF;
+
+      Accumulator();
+
+      FIT_UINT16 GetSlot(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum);
+      ///////////////////////////////////////////////////////////////////////
+      // Returns the slot holding the accumulated value of a field, creating it
+      // on first use. Slots stay valid for the lifetime of the accumulator so
+      // callers may resolve them once and reuse them for every message.
+      // Returns InvalidSlot, rather than throwing, once every slot is taken.
+      // The (mesgNum, destFieldNum) overloads then pass values through.
+      ///////////////////////////////////////////////////////////////////////
+
+      FIT_UINT32 Accumulate(const FIT_UINT16 slot, const FIT_UINT32 value, const FIT_UINT8 bits);
+      void Set(const FIT_UINT16 slot, const FIT_UINT32 value);
+      FIT_UINT32 Accumulate(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum, const FIT_UINT32 value, const FIT_UINT8 bits);
+      void Set(const FIT_UINT16 mesgNum, const FIT_UINT8 destFieldNum, const FIT_UINT32 value );
+
+   private:
+      // Open addressed table keyed by (mesgNum << 8) | destFieldNum. The profile
+      // only defines a handful of accumulated fields so it never comes close to full.
+      static const FIT_UINT16 NumSlots = 64;
+      static const FIT_UINT32 EmptyKey = 0xFFFFFFFF;
+
+      FIT_UINT32 keys[NumSlots];
+      AccumulatedField fields[NumSlots];
+};
+
+} // namespace fit
+
+#endif // defined(FIT_ACCUMULATOR_HPP)
+
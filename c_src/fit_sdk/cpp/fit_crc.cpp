@@ -39,12 +39,48 @@ FIT_UINT16 CRC::Get16(FIT_UINT16 crc, FIT_UINT8 byte)
 
 FIT_UINT16 CRC::Calc16(const volatile void *data, FIT_UINT32 size)
 {
-   FIT_UINT16 crc = 0;
-   FIT_BYTE *data_ptr = (FIT_BYTE *)data;
+   return CRC::Update16(0, data, size);
+}
+
+// Byte-wise lookup tables for slicing-by-8. table[0] is the classic 256 entry
+// table for the reflected 0xA001 polynomial; table[k] advances a byte that is
+// followed by k more bytes.
+struct CRC16Tables
+{
+   FIT_UINT16 table[8][256];
+
+   CRC16Tables()
+   {
+      for (int byte = 0; byte < 256; byte++)
+         table[0][byte] = CRC::Get16(0, (FIT_UINT8)byte);
+
+      for (int k = 1; k < 8; k++)
+         for (int byte = 0; byte < 256; byte++)
+            table[k][byte] = (table[k - 1][byte] >> 8) ^ table[0][table[k - 1][byte] & 0xFF];
+   }
+};
+
+FIT_UINT16 CRC::Update16(FIT_UINT16 crc, const volatile void *data, FIT_UINT32 size)
+{
+   static const CRC16Tables tables;
+   const FIT_UINT16 (*t)[256] = tables.table;
+   const FIT_BYTE *data_ptr = (const FIT_BYTE *)data;
+
+   while (size >= 8)
+   {
+      FIT_UINT16 x = crc ^ (FIT_UINT16)(data_ptr[0] | (data_ptr[1] << 8));
+
+      crc = t[7][x & 0xFF] ^ t[6][x >> 8] ^
+            t[5][data_ptr[2]] ^ t[4][data_ptr[3]] ^
+            t[3][data_ptr[4]] ^ t[2][data_ptr[5]] ^
+            t[1][data_ptr[6]] ^ t[0][data_ptr[7]];
+      data_ptr += 8;
+      size -= 8;
+   }
 
    while (size)
    {
-      crc = CRC::Get16(crc, *data_ptr);
+      crc = (crc >> 8) ^ t[0][(crc ^ *data_ptr) & 0xFF];
       data_ptr++;
       size--;
    }
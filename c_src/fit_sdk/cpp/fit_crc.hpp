@@ -23,6 +23,7 @@ class CRC
    public:
       static FIT_UINT16 Get16(FIT_UINT16 crc, FIT_UINT8 byte);
       static FIT_UINT16 Calc16(const volatile void *data, FIT_UINT32 size);
+      static FIT_UINT16 Update16(FIT_UINT16 crc, const volatile void *data, FIT_UINT32 size);
 };
 
 
@@ -1,225 +1,354 @@
-/////////////////////////////////////////////////////////////////////////////////////////////
-// Copyright 2025 Garmin International, Inc.
-// Licensed under the Flexible and Interoperable Data Transfer (FIT) Protocol License; you
-// may not use this file except in compliance with the Flexible and Interoperable Data
-// Transfer (FIT) Protocol License.
-/////////////////////////////////////////////////////////////////////////////////////////////
-// ****WARNING****  This file is auto-generated!  Do NOT edit this file.
-// Profile Version = 21.171.0Release
-// Tag = production/release/21.171.0-0-g57fed75
-/////////////////////////////////////////////////////////////////////////////////////////////
-
-
-#if !defined(FIT_DECODE_HPP)
-#define FIT_DECODE_HPP
-
-#include <iosfwd>
-#include <string>
-#include <unordered_map>
-#include "fit.hpp"
-#include "fit_accumulator.hpp"
-#include "fit_field.hpp"
-#include "fit_mesg.hpp"
-#include "fit_mesg_definition.hpp"
-#include "fit_mesg_definition_listener.hpp"
-#include "fit_developer_field_description_listener.hpp"
-#include "fit_mesg_listener.hpp"
-#include "fit_runtime_exception.hpp"
-#include "fit_developer_data_id_mesg.hpp"
-
-namespace fit
-{
-class Decode
-{
-public:
-    Decode();
-
-    FIT_BOOL IsFIT(std::istream &file);
-    ///////////////////////////////////////////////////////////////////////
-    // Reads the file header to check if the file is FIT.
-    // Does not check CRC.
-    // Parameters:
-    //    file     Pointer to file to read.
-    // Returns true if file is FIT.
-    ///////////////////////////////////////////////////////////////////////
-
-    FIT_BOOL CheckIntegrity(std::istream &file);
-    ///////////////////////////////////////////////////////////////////////
-    // Reads the FIT binary file header and crc to check compatibility and integrity.
-    // Parameters:
-    //    file     Pointer to file to read.
-    // Returns true if file is ok (not corrupt).
-    ///////////////////////////////////////////////////////////////////////
-
-    void SkipHeader();
-    ///////////////////////////////////////////////////////////////////////
-    // Overrides the default read behaviour by skipping header decode.
-    // CRC checking is not possible since the datasize is unknown.
-    // Decode continues until EOF is encountered or a decode error occurs.
-    // May only be called prior to calling Read.
-    ///////////////////////////////////////////////////////////////////////
-
-    void IncompleteStream();
-    ///////////////////////////////////////////////////////////////////////
-    // Override the default read behaviour allowing decode of partial streams.
-    // If EOF is encountered no exception is raised. Caller may choose to call
-    // resume possibly after more bytes have arrived in the stream. May only be set
-    // prior to first calling Read.
-    ///////////////////////////////////////////////////////////////////////
-
-    void SuppressComponentExpansion(void);
-    ///////////////////////////////////////////////////////////////////////
-    // Override the default read behaviour by suppressing the component expansion
-    // If your application does not care about component expansion this can speed
-    // up processing significantly.
-    ///////////////////////////////////////////////////////////////////////
-
-    FIT_BOOL Read(std::istream &file, MesgListener& mesgListener);
-    ///////////////////////////////////////////////////////////////////////
-    // Reads a FIT binary file.
-    // Parameters:
-    //    file                    Pointer to file to read.
-    //    mesgListener            Message listener
-    // Returns true if finished read file, otherwise false if decoding is paused.
-    ///////////////////////////////////////////////////////////////////////
-
-    FIT_BOOL Read(std::istream &file, MesgListener& mesgListener, MesgDefinitionListener& mesgDefinitionListener);
-    ///////////////////////////////////////////////////////////////////////
-    // Reads a FIT binary file.
-    // Parameters:
-    //    file                    Pointer to file to read.
-    //    mesgListener            Message listener
-    //    mesgDefinitionListener  Message definition listener
-    // Returns true if finished read file, otherwise false if decoding is paused.
-    ///////////////////////////////////////////////////////////////////////
-
-    FIT_BOOL Read
-        (
-        std::istream* file,
-        MesgListener* mesgListener,
-        MesgDefinitionListener* definitionListener,
-        DeveloperFieldDescriptionListener* descriptionListener
-        );
-    ///////////////////////////////////////////////////////////////////////
-    // Reads a FIT binary file.
-    // Parameters:
-    //    file                    Pointer to file to read.
-    //    mesgListener            Message listener
-    //    definitionListener      Message definition listener
-    //    descriptionListener     Developer field description listener
-    // Returns true if finished read file, otherwise false if decoding is paused.
-    ///////////////////////////////////////////////////////////////////////
-
-
-    void Pause(void);
-    ///////////////////////////////////////////////////////////////////////
-    // Pauses the decoding of a FIT binary file.  Call Resume() to resume decoding.
-    ///////////////////////////////////////////////////////////////////////
-
-    FIT_BOOL Resume(void);
-    ///////////////////////////////////////////////////////////////////////
-    // Resumes the decoding of a FIT binary file (see Pause()).
-    // Returns true if finished reading file.
-    ///////////////////////////////////////////////////////////////////////
-
-    FIT_BOOL getInvalidDataSize(void);
-    ///////////////////////////////////////////////////////////////////////
-    // Returns the invalid data size flag.
-    // This flag is set when the file size in the header is 0.
-    ///////////////////////////////////////////////////////////////////////
-
-    void setInvalidDataSize(FIT_BOOL value);
-    ///////////////////////////////////////////////////////////////////////
-    // Set the invalid data size flag.
-    // Parameters:
-    //    value             The value to set the flag to.
-    ///////////////////////////////////////////////////////////////////////
-
-private:
-    typedef enum
-    {
-        STATE_FILE_HDR,
-        STATE_RECORD,
-        STATE_RESERVED1,
-        STATE_ARCH,
-        STATE_MESG_NUM_0,
-        STATE_MESG_NUM_1,
-        STATE_NUM_FIELDS,
-        STATE_FIELD_NUM,
-        STATE_FIELD_SIZE,
-        STATE_FIELD_TYPE,
-        STATE_NUM_DEV_FIELDS,
-        STATE_DEV_FIELD_NUM,
-        STATE_DEV_FIELD_SIZE,
-        STATE_DEV_FIELD_INDEX,
-        STATE_FIELD_DATA,
-        STATE_DEV_FIELD_DATA,
-        STATE_FILE_CRC_HIGH,
-        STATES
-    } STATE;
-
-    typedef enum
-    {
-        RETURN_CONTINUE,
-        RETURN_MESG,
-        RETURN_MESG_DEF,
-        RETURN_END_OF_FILE,
-        RETURN_ERROR,
-        RETURNS
-    } RETURN;
-
-    static const FIT_UINT8 DevFieldNumOffset;
-    static const FIT_UINT8 DevFieldSizeOffset;
-    static const FIT_UINT8 DevFieldIndexOffset;
-    static const FIT_UINT16 BufferSize = 512;
-
-    STATE state;
-    FIT_BOOL hasDevData;
-    FIT_UINT8 fileHdrOffset;
-    FIT_UINT8 fileHdrSize;
-    FIT_UINT32 fileDataSize;
-    FIT_UINT32 fileBytesLeft;
-    FIT_UINT16 crc;
-    Mesg mesg;
-    FIT_UINT8 localMesgIndex;
-    MesgDefinition localMesgDefs[FIT_MAX_LOCAL_MESGS];
-    FIT_UINT8 archs[FIT_MAX_LOCAL_MESGS];
-    FIT_UINT8 numFields;
-    FIT_UINT8 fieldIndex;
-    FIT_UINT8 fieldDataIndex;
-    FIT_UINT8 fieldBytesLeft;
-    FIT_UINT8 fieldData[FIT_MAX_FIELD_SIZE];
-    FIT_UINT8 lastTimeOffset;
-    FIT_UINT32 timestamp;
-    Accumulator accumulator;
-    std::istream* file;
-    MesgListener* mesgListener;
-    MesgDefinitionListener* mesgDefinitionListener;
-    DeveloperFieldDescriptionListener* descriptionListener;
-    FIT_BOOL pause;
-    std::string headerException;
-    FIT_BOOL skipHeader;
-    FIT_BOOL streamIsComplete;
-    FIT_BOOL invalidDataSize;
-    FIT_BOOL suppressComponentExpansion;
-    FIT_UINT32 currentByteOffset;
-    std::unordered_map<FIT_UINT8, DeveloperDataIdMesg> developers;
-    std::unordered_map<FIT_UINT8, std::unordered_map<FIT_UINT8, FieldDescriptionMesg>> descriptions;
-    FIT_UINT32 currentByteIndex;
-    FIT_UINT32 bytesRead;
-    char buffer[BufferSize];
-    
-
-    void InitRead(std::istream &file);
-    void InitRead(std::istream &file, FIT_BOOL startOfFile);
-    void UpdateEndianness(FIT_UINT8 type, FIT_UINT8 size);
-    RETURN ReadByte(FIT_UINT8 data);
-    void ExpandComponents(Field* containingField, const Profile::FIELD_COMPONENT* components, FIT_UINT16 numComponents);
-    FIT_BOOL Read(std::istream* file);
-};
-
-} // namespace fit
-
-#endif // defined(DECODE_HPP)
-
-
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright 2025 Garmin International, Inc.
+// Licensed under the Flexible and Interoperable Data Transfer (FIT) Protocol License; you
+// may not use this file except in compliance with the Flexible and Interoperable Data
+// Transfer (FIT) Protocol License.
+/////////////////////////////////////////////////////////////////////////////////////////////
+// ****WARNING****  This file is auto-generated!  Do NOT edit this file.
+// Profile Version = 21.171.0Release
+// Tag = production/release/21.171.0-0-g57fed75
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+
+#if !defined(FIT_DECODE_HPP)
+#define FIT_DECODE_HPP
+
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "fit.hpp"
+#include "fit_accumulator.hpp"
+#include "fit_field.hpp"
+#include "fit_mesg.hpp"
+#include "fit_mesg_definition.hpp"
+#include "fit_mesg_definition_listener.hpp"
+#include "fit_developer_field_description_listener.hpp"
+#include "fit_mesg_listener.hpp"
+#include "fit_runtime_exception.hpp"
+#include "fit_developer_data_id_mesg.hpp"
+
+namespace fit
+{
+class Decode
+{
+public:
+    typedef enum
+    {
+        STATUS_OK,
+        STATUS_INVALID_HEADER,             // Not a FIT file
+        STATUS_INVALID_DATA_SIZE,          // The header gives a data size of 0
+        STATUS_UNSUPPORTED_PROTOCOL,
+        STATUS_UNSUPPORTED_ARCHITECTURE,
+        STATUS_INVALID_FIELD_SIZE,
+        STATUS_MISSING_DEFINITION,         // Data message for an undefined local message
+        STATUS_INVALID_DEVELOPER_DATA,
+        STATUS_INCOMPLETE_MESSAGE,         // The data size ends partway through a message
+        STATUS_UNEXPECTED_END,             // The input ends before the data size does
+        STATUS_CRC_FAILED,
+        STATUS_TOO_MANY_ACCUMULATED_FIELDS, // The accumulator has no slot left for a field
+        STATUSES
+    } STATUS;
+
+    Decode();
+
+    FIT_BOOL IsFIT(std::istream &file);
+    ///////////////////////////////////////////////////////////////////////
+    // Reads the file header to check if the file is FIT.
+    // Does not check CRC.
+    // Parameters:
+    //    file     Pointer to file to read.
+    // Returns true if file is FIT.
+    ///////////////////////////////////////////////////////////////////////
+
+    FIT_BOOL CheckIntegrity(std::istream &file);
+    ///////////////////////////////////////////////////////////////////////
+    // Reads the FIT binary file header and crc to check compatibility and integrity.
+    // Parameters:
+    //    file     Pointer to file to read.
+    // Returns true if file is ok (not corrupt).
+    ///////////////////////////////////////////////////////////////////////
+
+    void SkipHeader();
+    ///////////////////////////////////////////////////////////////////////
+    // Overrides the default read behaviour by skipping header decode.
+    // CRC checking is not possible since the datasize is unknown.
+    // Decode continues until EOF is encountered or a decode error occurs.
+    // May only be called prior to calling Read.
+    ///////////////////////////////////////////////////////////////////////
+
+    void IncompleteStream();
+    ///////////////////////////////////////////////////////////////////////
+    // Override the default read behaviour allowing decode of partial streams.
+    // If EOF is encountered no exception is raised. Caller may choose to call
+    // resume possibly after more bytes have arrived in the stream. May only be set
+    // prior to first calling Read.
+    ///////////////////////////////////////////////////////////////////////
+
+    void NoThrow(void);
+    ///////////////////////////////////////////////////////////////////////
+    // Override the default read behaviour by reporting decode errors through
+    // GetStatus() instead of throwing RuntimeException. Read stops at the first
+    // error and returns false; messages decoded before it have been delivered.
+    // No error message is formatted unless GetErrorMessage() is called.
+    ///////////////////////////////////////////////////////////////////////
+
+    STATUS GetStatus(void) const;
+    ///////////////////////////////////////////////////////////////////////
+    // Returns the error that stopped the last IsFIT, CheckIntegrity or Read,
+    // or STATUS_OK.
+    ///////////////////////////////////////////////////////////////////////
+
+    FIT_UINT32 GetErrorOffset(void) const;
+    ///////////////////////////////////////////////////////////////////////
+    // Returns the byte offset in the input at which the error was found.
+    ///////////////////////////////////////////////////////////////////////
+
+    std::string GetErrorMessage(void) const;
+    ///////////////////////////////////////////////////////////////////////
+    // Returns the message a RuntimeException would carry for the error.
+    ///////////////////////////////////////////////////////////////////////
+
+    FIT_BOOL Resync(std::istream &file, const FIT_UINT32 offset);
+    ///////////////////////////////////////////////////////////////////////
+    // Continues a Read that stopped at an error by decoding the messages of
+    // file from byte offset on, as with SkipHeader, until the stream ends or
+    // another error occurs. Local message definitions, the last full
+    // timestamp, accumulated values and developer data read before the error
+    // are kept, so messages of a type defined before it still decode. A
+    // definition the error cut short is dropped. Error offsets stay relative
+    // to the start of file.
+    // Parameters:
+    //    file     Stream holding the file, ending where the messages end.
+    //    offset   Byte offset of the message to resume at.
+    // Returns true if the rest of the stream decoded cleanly.
+    ///////////////////////////////////////////////////////////////////////
+
+    const MesgDefinition* GetMesgDefinition(const FIT_UINT8 localMesgNum) const;
+    ///////////////////////////////////////////////////////////////////////
+    // Returns the current definition of a local message number, or FIT_NULL
+    // if it has none.
+    ///////////////////////////////////////////////////////////////////////
+
+    void SuppressComponentExpansion(void);
+    ///////////////////////////////////////////////////////////////////////
+    // Override the default read behaviour by suppressing the component expansion
+    // If your application does not care about component expansion this can speed
+    // up processing significantly.
+    ///////////////////////////////////////////////////////////////////////
+
+    FIT_BOOL Read(std::istream &file, MesgListener& mesgListener);
+    ///////////////////////////////////////////////////////////////////////
+    // Reads a FIT binary file.
+    // Parameters:
+    //    file                    Pointer to file to read.
+    //    mesgListener            Message listener
+    // Returns true if finished read file, otherwise false if decoding is paused.
+    ///////////////////////////////////////////////////////////////////////
+
+    FIT_BOOL Read(std::istream &file, MesgListener& mesgListener, MesgDefinitionListener& mesgDefinitionListener);
+    ///////////////////////////////////////////////////////////////////////
+    // Reads a FIT binary file.
+    // Parameters:
+    //    file                    Pointer to file to read.
+    //    mesgListener            Message listener
+    //    mesgDefinitionListener  Message definition listener
+    // Returns true if finished read file, otherwise false if decoding is paused.
+    ///////////////////////////////////////////////////////////////////////
+
+    FIT_BOOL Read
+        (
+        std::istream* file,
+        MesgListener* mesgListener,
+        MesgDefinitionListener* definitionListener,
+        DeveloperFieldDescriptionListener* descriptionListener
+        );
+    ///////////////////////////////////////////////////////////////////////
+    // Reads a FIT binary file.
+    // Parameters:
+    //    file                    Pointer to file to read.
+    //    mesgListener            Message listener
+    //    definitionListener      Message definition listener
+    //    descriptionListener     Developer field description listener
+    // Returns true if finished read file, otherwise false if decoding is paused.
+    ///////////////////////////////////////////////////////////////////////
+
+
+    void Pause(void);
+    ///////////////////////////////////////////////////////////////////////
+    // Pauses the decoding of a FIT binary file.  Call Resume() to resume decoding.
+    ///////////////////////////////////////////////////////////////////////
+
+    FIT_BOOL Resume(void);
+    ///////////////////////////////////////////////////////////////////////
+    // Resumes the decoding of a FIT binary file (see Pause()).
+    // Returns true if finished reading file.
+    ///////////////////////////////////////////////////////////////////////
+
+    FIT_BOOL getInvalidDataSize(void);
+    ///////////////////////////////////////////////////////////////////////
+    // Returns the invalid data size flag.
+    // This flag is set when the file size in the header is 0.
+    ///////////////////////////////////////////////////////////////////////
+
+    void setInvalidDataSize(FIT_BOOL value);
+    ///////////////////////////////////////////////////////////////////////
+    // Set the invalid data size flag.
+    // Parameters:
+    //    value             The value to set the flag to.
+    ///////////////////////////////////////////////////////////////////////
+
+private:
+    typedef enum
+    {
+        STATE_FILE_HDR,
+        STATE_RECORD,
+        STATE_RESERVED1,
+        STATE_ARCH,
+        STATE_MESG_NUM_0,
+        STATE_MESG_NUM_1,
+        STATE_NUM_FIELDS,
+        STATE_FIELD_NUM,
+        STATE_FIELD_SIZE,
+        STATE_FIELD_TYPE,
+        STATE_NUM_DEV_FIELDS,
+        STATE_DEV_FIELD_NUM,
+        STATE_DEV_FIELD_SIZE,
+        STATE_DEV_FIELD_INDEX,
+        STATE_FIELD_DATA,
+        STATE_DEV_FIELD_DATA,
+        STATE_FILE_CRC_HIGH,
+        STATES
+    } STATE;
+
+    typedef enum
+    {
+        RETURN_CONTINUE,
+        RETURN_MESG,
+        RETURN_MESG_DEF,
+        RETURN_END_OF_FILE,
+        RETURN_ERROR,
+        RETURNS
+    } RETURN;
+
+    typedef enum
+    {
+        EXPANSION_SKIP,      // Padding component without a destination field
+        EXPANSION_SCALED,    // Scale/offset folded into a single multiply-add
+        EXPANSION_SUBFIELD,  // Destination has subfields, scale/offset resolved per message
+        EXPANSION_COMPOSITE, // Destination is itself composite, bits are split into raw values
+        EXPANSIONS
+    } EXPANSION;
+
+    // One component of a field, resolved against the profile once per decoder
+    struct ExpansionStep
+    {
+        Field field;                  // Destination field prototype, already marked expanded
+        EXPANSION kind;
+        FIT_BOOL isSigned;
+        FIT_BOOL accumulate;
+        FIT_UINT16 accumulatorSlot;
+        FIT_FLOAT64 scale;
+        FIT_FLOAT64 offset;
+    };
+
+    // Expansion of every component of one (mesg, field, subfield)
+    struct ExpansionProgram
+    {
+        const Profile::FIELD_COMPONENT* components;
+        FIT_UINT16 numComponents;
+        FIT_BOOL valid;               // False if a component got no accumulator slot
+        std::vector<ExpansionStep> steps;
+    };
+
+    // Fields of one local message definition that can carry subfields, including fields
+    // produced by component expansion, and the reference fields selecting them
+    struct SubFieldPlan
+    {
+        FIT_BOOL valid;
+        FIT_BOOL refsExpandable;  // A reference field may itself be added by expansion
+        FIT_UINT32 fieldMask[8];
+        std::vector<FIT_UINT8> refFieldNums;
+    };
+
+    static const FIT_UINT8 DevFieldNumOffset;
+    static const FIT_UINT8 DevFieldSizeOffset;
+    static const FIT_UINT8 DevFieldIndexOffset;
+    static const FIT_UINT16 BufferSize = 512;
+
+    STATE state;
+    FIT_BOOL hasDevData;
+    FIT_UINT8 fileHdrOffset;
+    FIT_UINT8 fileHdrSize;
+    FIT_UINT32 fileDataSize;
+    FIT_UINT32 fileBytesLeft;
+    FIT_UINT16 crc;
+    Mesg mesg;
+    FIT_UINT8 localMesgIndex;
+    MesgDefinition localMesgDefs[FIT_MAX_LOCAL_MESGS];
+    FIT_UINT8 archs[FIT_MAX_LOCAL_MESGS];
+    FIT_UINT8 numFields;
+    FIT_UINT8 fieldIndex;
+    FIT_UINT8 fieldDataIndex;
+    FIT_UINT8 fieldBytesLeft;
+    FIT_UINT8 fieldData[FIT_MAX_FIELD_SIZE];
+    FIT_UINT8 lastTimeOffset;
+    FIT_UINT32 timestamp;
+    Accumulator accumulator;
+    std::vector<FIT_UINT32> componentBitsValues;
+    std::unordered_map<FIT_UINT64, ExpansionProgram> expansionPrograms;
+    SubFieldPlan subFieldPlans[FIT_MAX_LOCAL_MESGS];
+    FIT_SINT32 refFieldValues[256];
+    FIT_BOOL refFieldPresent[256];
+    std::istream* file;
+    MesgListener* mesgListener;
+    MesgDefinitionListener* mesgDefinitionListener;
+    DeveloperFieldDescriptionListener* descriptionListener;
+    FIT_BOOL pause;
+    STATUS headerStatus;  // First problem found in the file header, reported once it is read
+    FIT_UINT32 headerDetail;
+    FIT_UINT32 headerOffset;
+    STATUS status;
+    FIT_UINT32 errorDetail;  // Local message number, architecture, ... for the error message
+    FIT_UINT32 errorOffset;
+    FIT_BOOL throwErrors;
+    FIT_BOOL skipHeader;
+    FIT_BOOL streamIsComplete;
+    FIT_BOOL invalidDataSize;
+    FIT_BOOL suppressComponentExpansion;
+    FIT_UINT32 currentByteOffset;
+    // Developer data ids and field descriptions, found through flat slot tables indexed by
+    // developer data index (and field number) so resolving a field never throws
+    std::vector<DeveloperDataIdMesg> developers;
+    std::vector<FieldDescriptionMesg> descriptions;
+    FIT_UINT16 developerSlots[256];
+    std::vector<FIT_UINT16> descriptionSlots;  // 256 x 256, allocated with the first developer
+    FIT_UINT32 currentByteIndex;
+    FIT_UINT32 bytesRead;
+    char buffer[BufferSize];
+    
+
+    void InitRead(std::istream &file);
+    void InitRead(std::istream &file, FIT_BOOL startOfFile);
+    void UpdateEndianness(FIT_UINT8 type, FIT_UINT8 size);
+    RETURN ReadByte(FIT_UINT8 data);
+    RETURN Fail(const STATUS error, const FIT_UINT32 detail, const FIT_UINT32 offset);
+    void SetHeaderError(const STATUS error, const FIT_UINT32 detail);
+    void BuildSubFieldPlan(SubFieldPlan& plan, const MesgDefinition& definition);
+    void LoadRefFieldValues(const SubFieldPlan& plan);
+    FIT_UINT16 GetActiveSubFieldIndex(const Field* field) const;
+    const ExpansionProgram& GetExpansionProgram(const Field* containingField, const FIT_UINT16 subFieldIndex);
+    FIT_BOOL ExpandComponents(Field* containingField, const FIT_UINT16 subFieldIndex);
+    void ClearDeveloperData(void);
+    void AddDeveloper(const DeveloperDataIdMesg& developer);
+    const DeveloperDataIdMesg* AddDescription(const FieldDescriptionMesg& description);
+    const DeveloperDataIdMesg* FindDeveloper(const FIT_UINT8 developerDataIndex) const;
+    const FieldDescriptionMesg* FindDescription(const FIT_UINT8 developerDataIndex, const FIT_UINT8 fieldNum) const;
+    FIT_BOOL Read(std::istream* file);
+};
+
+} // namespace fit
+
+#endif // defined(DECODE_HPP)
+
+
@@ -52,6 +52,28 @@ DeveloperField::~DeveloperField()
     }
 }
 
+DeveloperField& DeveloperField::operator=(const DeveloperField& other)
+{
+    // The default assignment would share, and later double free, the definition
+    if (this != &other)
+    {
+        FieldBase::operator=(other);
+
+        if (nullptr != mDefinition)
+        {
+            delete mDefinition;
+            mDefinition = nullptr;
+        }
+
+        if (nullptr != other.mDefinition)
+        {
+            mDefinition = new DeveloperFieldDefinition(*other.mDefinition);
+        }
+    }
+
+    return *this;
+}
+
 FIT_BOOL DeveloperField::GetIsAccumulated() const
 {
     return FIT_FALSE;
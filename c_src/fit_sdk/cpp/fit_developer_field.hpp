@@ -30,6 +30,7 @@ public:
     DeveloperField(const FieldDescriptionMesg& definition, const DeveloperDataIdMesg& developer);
     explicit DeveloperField(const DeveloperFieldDefinition& definition);
     virtual ~DeveloperField();
+    DeveloperField& operator=(const DeveloperField& other);
 
     virtual FIT_BOOL GetIsAccumulated() const override;
     virtual FIT_BOOL IsValid(void) const override;
@@ -112,64 +112,78 @@ FIT_UINT8 FieldBase::GetNumValues(void) const
 
 FIT_UINT32 FieldBase::GetBitsValue(const FIT_UINT16 offset, const FIT_UINT8 bits) const
 {
-    FIT_UINT32 value = 0;
-    FIT_UINT8 numValueBits = 0;
-    FIT_UINT8 numDataBitsUsed;
-    FIT_UINT8 index = 0;
-    FIT_UINT8 data;
-    FIT_UINT8 mask;
-    FIT_UINT16 newOffset = offset;
+    FIT_UINT64 word = 0;
+    FIT_UINT32 firstByte;
+    FIT_UINT32 lastByte;
+    FIT_UINT32 index;
 
     if (values.size() == 0)
         return FIT_UINT32_INVALID;
 
-    while (numValueBits < bits)
-    {
-        if (index >= GetSize())
-            return FIT_UINT32_INVALID;
+    if (bits == 0)
+        return 0;
 
-        if (newOffset >= 8)
-        {
-            newOffset -= 8;
-        }
-        else
-        {
-            // Get Nth byte from the jagged array considering elements may be multibyte
-            data = GetValuesUINT8(index);
-            // Shift out the bits we do not want to use
-            data >>= newOffset;
-            // Record how many bits we are using
-            numDataBitsUsed = 8 - (FIT_UINT8)newOffset;
-            // Use every byte after this until we have enough bits
-            newOffset = 0;
-
-            // If the number of data bits will overflow the number of bits we want in the
-            // final value, only use as many as will fit
-            if (numDataBitsUsed > (bits - numValueBits))
-                numDataBitsUsed = bits - numValueBits;
-
-            mask = (1 << numDataBitsUsed) - 1;
-            // OR the data from this byte into our final value, then update number of bits
-            // in our final value
-            value |= (FIT_UINT32)(data & mask) << numValueBits;
-            numValueBits += numDataBitsUsed;
-        }
-        index++;
-    }
+    // Bytes holding the first and last requested bit; anything past the end is no data
+    firstByte = offset >> 3;
+    lastByte = ((FIT_UINT32)offset + bits - 1) >> 3;
+
+    if (lastByte >= GetSize())
+        return FIT_UINT32_INVALID;
+
+    // Gather the (at most 5) little-endian bytes into one word, then shift and mask once
+    for (index = firstByte; index <= lastByte; index++)
+        word |= (FIT_UINT64)values[index] << ((index - firstByte) * 8);
 
-    return value;
+    return (FIT_UINT32)((word >> (offset & 7)) & (((FIT_UINT64)1 << bits) - 1));
 }
 
 FIT_SINT32 FieldBase::GetBitsSignedValue(const FIT_UINT16 offset, const FIT_UINT8 bits) const
 {
     FIT_UINT32 value;
-    FIT_SINT32 signedValue;
 
     value = GetBitsValue(offset, bits);
 
     if (value == FIT_UINT32_INVALID)
         return FIT_SINT32_INVALID;
 
+    return SignExtendBits(value, bits);
+}
+
+FIT_UINT16 FieldBase::GetBitsValues(const Profile::FIELD_COMPONENT* components, const FIT_UINT16 numComponents, FIT_UINT32* bitsValues) const
+{
+    const FIT_UINT8 size = GetSize();
+    FIT_UINT64 window = 0;
+    FIT_UINT8 windowBits = 0;
+    FIT_UINT8 index = 0;
+    FIT_UINT16 i;
+
+    // Components are packed back to back, so stream the field bytes through a single
+    // 64-bit window instead of re-walking the field from bit 0 for every component
+    for (i = 0; i < numComponents; i++)
+    {
+        const FIT_UINT8 bits = components[i].bits;
+
+        while ((windowBits < bits) && (index < size))
+        {
+            window |= (FIT_UINT64)values[index++] << windowBits;
+            windowBits += 8;
+        }
+
+        if (windowBits < bits)
+            return i; // No more data for components.
+
+        bitsValues[i] = (FIT_UINT32)(window & (((FIT_UINT64)1 << bits) - 1));
+        window >>= bits;
+        windowBits -= bits;
+    }
+
+    return numComponents;
+}
+
+FIT_SINT32 FieldBase::SignExtendBits(const FIT_UINT32 value, const FIT_UINT8 bits)
+{
+    FIT_SINT32 signedValue;
+
     signedValue = (1 << (bits - 1));
 
     if ((value & signedValue) != 0) // sign bit set
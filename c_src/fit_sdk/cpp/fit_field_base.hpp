@@ -55,6 +55,8 @@ public:
 
     FIT_UINT32 GetBitsValue(const FIT_UINT16 offset, const FIT_UINT8 bits) const;
     FIT_SINT32 GetBitsSignedValue(const FIT_UINT16 offset, const FIT_UINT8 bits) const;
+    FIT_UINT16 GetBitsValues(const Profile::FIELD_COMPONENT* components, const FIT_UINT16 numComponents, FIT_UINT32* bitsValues) const;
+    static FIT_SINT32 SignExtendBits(const FIT_UINT32 value, const FIT_UINT8 bits);
     FIT_BYTE GetValuesBYTE(const FIT_UINT8 index) const;
     FIT_SINT8 GetValuesSINT8(const FIT_UINT8 index) const;
     FIT_UINT8 GetValuesUINT8(const FIT_UINT8 index) const;
@@ -0,0 +1,96 @@
+#include "fit_verify.hpp"
+#include "fit_crc.hpp"
+
+namespace fit
+{
+
+Verify::Verify()
+    : numFiles(0)
+    , errorOffset(0)
+{
+}
+
+Verify::STATUS Verify::CheckBuffer(const void *data, FIT_UINT32 size)
+{
+    const FIT_UINT8 *bytes = (const FIT_UINT8 *)data;
+    FIT_UINT32 offset = 0;
+
+    numFiles = 0;
+    errorOffset = 0;
+
+    do
+    {
+        FIT_UINT32 fileSize = 0;
+        STATUS status = CheckFile(bytes + offset, size - offset, &fileSize);
+
+        if (status != STATUS_OK)
+        {
+            errorOffset = offset;
+            return status;
+        }
+
+        numFiles++;
+        offset += fileSize;
+    } while (offset < size);
+
+    errorOffset = size;
+    return STATUS_OK;
+}
+
+FIT_UINT32 Verify::GetNumFiles(void) const
+{
+    return numFiles;
+}
+
+FIT_UINT32 Verify::GetErrorOffset(void) const
+{
+    return errorOffset;
+}
+
+Verify::STATUS Verify::CheckFile(const FIT_UINT8 *file, FIT_UINT32 size, FIT_UINT32 *fileSize)
+{
+    if (size < FIT_HEADER_SIZE_NO_CRC)
+        return STATUS_TRUNCATED;
+
+    FIT_UINT8 headerSize = file[0];
+
+    if ((headerSize < FIT_HEADER_SIZE_NO_CRC) ||
+        (file[8] != '.') || (file[9] != 'F') || (file[10] != 'I') || (file[11] != 'T'))
+    {
+        return STATUS_HEADER_INVALID;
+    }
+
+    if ((file[1] & FIT_PROTOCOL_VERSION_MAJOR_MASK) > (FIT_PROTOCOL_VERSION_MAJOR << FIT_PROTOCOL_VERSION_MAJOR_SHIFT))
+        return STATUS_HEADER_INVALID;
+
+    if (size < headerSize)
+        return STATUS_TRUNCATED;
+
+    // A header CRC of zero means the encoder did not compute one.
+    if (headerSize >= FIT_HEADER_SIZE_WITH_CRC)
+    {
+        FIT_UINT16 headerCrc = (FIT_UINT16)(file[12] | (file[13] << 8));
+
+        if ((headerCrc != 0) && (CRC::Calc16(file, FIT_HEADER_SIZE_NO_CRC) != headerCrc))
+            return STATUS_HEADER_CRC_FAILED;
+    }
+
+    FIT_UINT32 dataSize = (FIT_UINT32)file[4] | ((FIT_UINT32)file[5] << 8) |
+                          ((FIT_UINT32)file[6] << 16) | ((FIT_UINT32)file[7] << 24);
+
+    if (dataSize == 0)
+        return STATUS_DATA_SIZE_INVALID;
+
+    if ((dataSize > size) || (size - dataSize < (FIT_UINT32)headerSize + 2))
+        return STATUS_TRUNCATED;
+
+    *fileSize = headerSize + dataSize + 2;
+
+    // Running the CRC over the trailing CRC bytes yields zero for an intact file.
+    if (CRC::Calc16(file, *fileSize) != 0)
+        return STATUS_FILE_CRC_FAILED;
+
+    return STATUS_OK;
+}
+
+} // namespace fit
@@ -0,0 +1,57 @@
+#if !defined(FIT_VERIFY_HPP)
+#define FIT_VERIFY_HPP
+
+#include "fit.hpp"
+
+namespace fit
+{
+
+class Verify
+{
+public:
+    typedef enum
+    {
+        STATUS_OK,
+        STATUS_HEADER_INVALID,
+        STATUS_HEADER_CRC_FAILED,
+        STATUS_DATA_SIZE_INVALID,
+        STATUS_TRUNCATED,
+        STATUS_FILE_CRC_FAILED,
+        STATUSES
+    } STATUS;
+
+    Verify();
+
+    STATUS CheckBuffer(const void *data, FIT_UINT32 size);
+    ///////////////////////////////////////////////////////////////////////
+    // Checks the integrity of one or more chained FIT files held in memory
+    // without decoding any messages. Each file header is validated (and
+    // its CRC checked when present) and a bulk CRC is run over the header,
+    // data records and trailing file CRC.
+    // Parameters:
+    //    data     Pointer to the start of the first file.
+    //    size     Number of bytes available.
+    // Returns STATUS_OK if every chained file is intact.
+    ///////////////////////////////////////////////////////////////////////
+
+    FIT_UINT32 GetNumFiles(void) const;
+    ///////////////////////////////////////////////////////////////////////
+    // Returns the number of chained files that passed the last check.
+    ///////////////////////////////////////////////////////////////////////
+
+    FIT_UINT32 GetErrorOffset(void) const;
+    ///////////////////////////////////////////////////////////////////////
+    // Returns the byte offset of the file header at which the last check
+    // failed, or the size of the buffer if the check passed.
+    ///////////////////////////////////////////////////////////////////////
+
+private:
+    FIT_UINT32 numFiles;
+    FIT_UINT32 errorOffset;
+
+    static STATUS CheckFile(const FIT_UINT8 *file, FIT_UINT32 size, FIT_UINT32 *fileSize);
+};
+
+} // namespace fit
+
+#endif // !defined(FIT_VERIFY_HPP)
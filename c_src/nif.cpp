@@ -1,1083 +1,4433 @@
 #include <iostream>
 #include <vector>
-#include <sstream>
+#include <map>
+#include <atomic>
+#include <queue>
+#include <algorithm>
+#include <iterator>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <cerrno>
+#include <cstdint>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "erl_nif.h"
+#include "fit_crc.hpp"
 #include "fit_decode.hpp"
 #include "fit_record_mesg.hpp"
+#include "fit_session_mesg.hpp"
+#include "fit_climb_pro_mesg.hpp"
+#include "fit_event_mesg.hpp"
+#include "fit_time_in_zone_mesg.hpp"
 #include "fit_mesg_listener.hpp"
+#include "fit_mesg_definition_listener.hpp"
 #include "fit_profile.hpp"
+#include "fit_unicode.hpp"
+#include "fit_verify.hpp"
+
+// FIT type a record field is read as, matching the RecordMesg getter. Unsigned types
+// are stored as unsigned int, signed ones as int and FLOAT32 as float.
+enum RecordValueType {
+    RECORD_VALUE_ENUM,
+    RECORD_VALUE_UINT8,
+    RECORD_VALUE_UINT16,
+    RECORD_VALUE_UINT32,
+    RECORD_VALUE_SINT8,
+    RECORD_VALUE_SINT32,
+    RECORD_VALUE_FLOAT32
+};
+
+// FIT field number, map key and type of every record field we decode, in map key order.
+struct RecordField {
+    FIT_UINT8 num;
+    const char* name;
+    RecordValueType type;
+};
 
-// A struct to hold the data from a single Record message.
-struct RecordData {
+static const RecordField record_fields[] = {
     // Basic fields
-    unsigned int timestamp;
-    float altitude;
-    float distance;
-    unsigned int heart_rate;
+    {fit::RecordMesg::FieldDefNum::Timestamp, "timestamp", RECORD_VALUE_UINT32},
+    {fit::RecordMesg::FieldDefNum::Altitude, "altitude", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::Distance, "distance", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::HeartRate, "heart_rate", RECORD_VALUE_UINT8},
 
     // Position & Navigation
-    int position_lat;
-    int position_long;
-    float enhanced_altitude;
-    float speed;
-    float enhanced_speed;
-    float grade;
-    float vertical_speed;
-    unsigned int gps_accuracy;
+    {fit::RecordMesg::FieldDefNum::PositionLat, "position_lat", RECORD_VALUE_SINT32},
+    {fit::RecordMesg::FieldDefNum::PositionLong, "position_long", RECORD_VALUE_SINT32},
+    {fit::RecordMesg::FieldDefNum::EnhancedAltitude, "enhanced_altitude", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::Speed, "speed", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::EnhancedSpeed, "enhanced_speed", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::Grade, "grade", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::VerticalSpeed, "vertical_speed", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::GpsAccuracy, "gps_accuracy", RECORD_VALUE_UINT8},
 
     // Power & Performance
-    unsigned int power;
-    unsigned int accumulated_power;
-    unsigned int motor_power;
-    float left_torque_effectiveness;
-    float right_torque_effectiveness;
-    float left_pedal_smoothness;
-    float right_pedal_smoothness;
-    float combined_pedal_smoothness;
+    {fit::RecordMesg::FieldDefNum::Power, "power", RECORD_VALUE_UINT16},
+    {fit::RecordMesg::FieldDefNum::AccumulatedPower, "accumulated_power", RECORD_VALUE_UINT32},
+    {fit::RecordMesg::FieldDefNum::MotorPower, "motor_power", RECORD_VALUE_UINT16},
+    {fit::RecordMesg::FieldDefNum::LeftTorqueEffectiveness, "left_torque_effectiveness", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::RightTorqueEffectiveness, "right_torque_effectiveness", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::LeftPedalSmoothness, "left_pedal_smoothness", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::RightPedalSmoothness, "right_pedal_smoothness", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::CombinedPedalSmoothness, "combined_pedal_smoothness", RECORD_VALUE_FLOAT32},
 
     // Cadence & Cycling
-    unsigned int cadence;
-    float cadence256;
-    float fractional_cadence;
-    unsigned int left_right_balance;
-    float cycle_length;
-    float cycle_length16;
-    unsigned int cycles;
-    unsigned int total_cycles;
+    {fit::RecordMesg::FieldDefNum::Cadence, "cadence", RECORD_VALUE_UINT8},
+    {fit::RecordMesg::FieldDefNum::Cadence256, "cadence256", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::FractionalCadence, "fractional_cadence", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::LeftRightBalance, "left_right_balance", RECORD_VALUE_UINT8},
+    {fit::RecordMesg::FieldDefNum::CycleLength, "cycle_length", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::CycleLength16, "cycle_length16", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::Cycles, "cycles", RECORD_VALUE_UINT8},
+    {fit::RecordMesg::FieldDefNum::TotalCycles, "total_cycles", RECORD_VALUE_UINT32},
 
     // Running Dynamics
-    float vertical_oscillation;
-    float stance_time;
-    float stance_time_percent;
-    float stance_time_balance;
-    float step_length;
-    float vertical_ratio;
+    {fit::RecordMesg::FieldDefNum::VerticalOscillation, "vertical_oscillation", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::StanceTime, "stance_time", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::StanceTimePercent, "stance_time_percent", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::StanceTimeBalance, "stance_time_balance", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::StepLength, "step_length", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::VerticalRatio, "vertical_ratio", RECORD_VALUE_FLOAT32},
 
     // Physiological Data
-    unsigned int calories;
-    int temperature;
-    float core_temperature;
-    unsigned int respiration_rate;
-    float enhanced_respiration_rate;
-    float current_stress;
+    {fit::RecordMesg::FieldDefNum::Calories, "calories", RECORD_VALUE_UINT16},
+    {fit::RecordMesg::FieldDefNum::Temperature, "temperature", RECORD_VALUE_SINT8},
+    {fit::RecordMesg::FieldDefNum::CoreTemperature, "core_temperature", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::RespirationRate, "respiration_rate", RECORD_VALUE_UINT8},
+    {fit::RecordMesg::FieldDefNum::EnhancedRespirationRate, "enhanced_respiration_rate", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::CurrentStress, "current_stress", RECORD_VALUE_FLOAT32},
 
     // Blood/Oxygen Data
-    float total_hemoglobin_conc;
-    float total_hemoglobin_conc_min;
-    float total_hemoglobin_conc_max;
-    float saturated_hemoglobin_percent;
-    float saturated_hemoglobin_percent_min;
-    float saturated_hemoglobin_percent_max;
+    {fit::RecordMesg::FieldDefNum::TotalHemoglobinConc, "total_hemoglobin_conc", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::TotalHemoglobinConcMin, "total_hemoglobin_conc_min", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::TotalHemoglobinConcMax, "total_hemoglobin_conc_max", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::SaturatedHemoglobinPercent, "saturated_hemoglobin_percent", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::SaturatedHemoglobinPercentMin, "saturated_hemoglobin_percent_min", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::SaturatedHemoglobinPercentMax, "saturated_hemoglobin_percent_max", RECORD_VALUE_FLOAT32},
 
     // E-bike Specific
-    float battery_soc;
-    unsigned int ebike_travel_range;
-    unsigned int ebike_battery_level;
-    unsigned int ebike_assist_mode;
-    unsigned int ebike_assist_level_percent;
+    {fit::RecordMesg::FieldDefNum::BatterySoc, "battery_soc", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::EbikeTravelRange, "ebike_travel_range", RECORD_VALUE_UINT16},
+    {fit::RecordMesg::FieldDefNum::EbikeBatteryLevel, "ebike_battery_level", RECORD_VALUE_UINT8},
+    {fit::RecordMesg::FieldDefNum::EbikeAssistMode, "ebike_assist_mode", RECORD_VALUE_UINT8},
+    {fit::RecordMesg::FieldDefNum::EbikeAssistLevelPercent, "ebike_assist_level_percent", RECORD_VALUE_UINT8},
 
     // Swimming/Water Sports
-    unsigned int stroke_type;
-    unsigned int resistance;
-    float ball_speed;
+    {fit::RecordMesg::FieldDefNum::StrokeType, "stroke_type", RECORD_VALUE_ENUM},
+    {fit::RecordMesg::FieldDefNum::Resistance, "resistance", RECORD_VALUE_UINT8},
+    {fit::RecordMesg::FieldDefNum::BallSpeed, "ball_speed", RECORD_VALUE_FLOAT32},
 
     // Diving
-    float depth;
-    unsigned int absolute_pressure;
-    float next_stop_depth;
-    unsigned int next_stop_time;
-    unsigned int time_to_surface;
-    unsigned int ndl_time;
-    unsigned int cns_load;
-    unsigned int n2_load;
-    unsigned int air_time_remaining;
-    float ascent_rate;
-    float po2;
+    {fit::RecordMesg::FieldDefNum::Depth, "depth", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::AbsolutePressure, "absolute_pressure", RECORD_VALUE_UINT32},
+    {fit::RecordMesg::FieldDefNum::NextStopDepth, "next_stop_depth", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::NextStopTime, "next_stop_time", RECORD_VALUE_UINT32},
+    {fit::RecordMesg::FieldDefNum::TimeToSurface, "time_to_surface", RECORD_VALUE_UINT32},
+    {fit::RecordMesg::FieldDefNum::NdlTime, "ndl_time", RECORD_VALUE_UINT32},
+    {fit::RecordMesg::FieldDefNum::CnsLoad, "cns_load", RECORD_VALUE_UINT8},
+    {fit::RecordMesg::FieldDefNum::N2Load, "n2_load", RECORD_VALUE_UINT16},
+    {fit::RecordMesg::FieldDefNum::AirTimeRemaining, "air_time_remaining", RECORD_VALUE_UINT32},
+    {fit::RecordMesg::FieldDefNum::AscentRate, "ascent_rate", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::Po2, "po2", RECORD_VALUE_FLOAT32},
 
     // Other Fields
-    unsigned int activity_type;
-    unsigned int device_index;
-    unsigned int zone;
-    float time128;
-    float grit;
-    float flow;
-    float time_from_course;
-    int left_pco;
-    int right_pco;
-    float pressure_sac;
-    float volume_sac;
-    float rmv;
+    {fit::RecordMesg::FieldDefNum::ActivityType, "activity_type", RECORD_VALUE_ENUM},
+    {fit::RecordMesg::FieldDefNum::DeviceIndex, "device_index", RECORD_VALUE_UINT8},
+    {fit::RecordMesg::FieldDefNum::Zone, "zone", RECORD_VALUE_UINT8},
+    {fit::RecordMesg::FieldDefNum::Time128, "time128", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::Grit, "grit", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::Flow, "flow", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::TimeFromCourse, "time_from_course", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::LeftPco, "left_pco", RECORD_VALUE_SINT8},
+    {fit::RecordMesg::FieldDefNum::RightPco, "right_pco", RECORD_VALUE_SINT8},
+    {fit::RecordMesg::FieldDefNum::PressureSac, "pressure_sac", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::VolumeSac, "volume_sac", RECORD_VALUE_FLOAT32},
+    {fit::RecordMesg::FieldDefNum::Rmv, "rmv", RECORD_VALUE_FLOAT32},
 };
 
-// The listener class that processes messages from the FIT file.
-class Listener : public fit::MesgListener {
-public:
-    std::vector<RecordData> records;
+static const size_t RECORD_FIELD_COUNT = sizeof(record_fields) / sizeof(record_fields[0]);
+static const FIT_UINT8 RECORD_FIELD_NONE = 0xFF;
 
-    // This method is called for every message in the file.
-    void OnMesg(fit::Mesg& mesg) override {
-        // Check if this is a Record message (message number 20)
-        if (mesg.GetNum() == FIT_MESG_NUM_RECORD) {
-            fit::RecordMesg recordMesg(mesg);
-            ProcessRecordMessage(recordMesg);
-        }
+// record_fields index for each FIT field number, or RECORD_FIELD_NONE. Filled at load.
+static FIT_UINT8 record_field_index[256];
+
+// Every record field's invalid sentinel, as stored in RecordColumns. Filled at load.
+static uint32_t invalid_values[RECORD_FIELD_COUNT];
+
+static uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bits_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint32_t invalid_value(const RecordField& field) {
+    switch (field.type) {
+        case RECORD_VALUE_ENUM: return FIT_ENUM_INVALID;
+        case RECORD_VALUE_UINT8: return FIT_UINT8_INVALID;
+        case RECORD_VALUE_UINT16: return FIT_UINT16_INVALID;
+        case RECORD_VALUE_UINT32: return FIT_UINT32_INVALID;
+        case RECORD_VALUE_SINT8: return (uint32_t)(int)FIT_SINT8_INVALID;
+        case RECORD_VALUE_SINT32: return (uint32_t)(int)FIT_SINT32_INVALID;
+        case RECORD_VALUE_FLOAT32: return float_bits(FIT_FLOAT32_INVALID);
     }
+    return 0;
+}
 
-private:
-    void ProcessRecordMessage(fit::RecordMesg& mesg) {
-        RecordData data = {};
+// Encodes a decoded field exactly as the matching RecordMesg getter would return it.
+static uint32_t encode_value(const RecordField& field, const fit::Field& value) {
+    switch (field.type) {
+        case RECORD_VALUE_ENUM: return value.GetENUMValue(0);
+        case RECORD_VALUE_UINT8: return value.GetUINT8Value(0);
+        case RECORD_VALUE_UINT16: return value.GetUINT16Value(0);
+        case RECORD_VALUE_UINT32: return value.GetUINT32Value(0);
+        case RECORD_VALUE_SINT8: return (uint32_t)(int)value.GetSINT8Value(0);
+        case RECORD_VALUE_SINT32: return (uint32_t)(int)value.GetSINT32Value(0);
+        case RECORD_VALUE_FLOAT32: return float_bits(value.GetFLOAT32Value(0, FIT_SUBFIELD_INDEX_MAIN_FIELD));
+    }
+    return 0;
+}
 
-        // Basic fields
-        if (mesg.IsTimestampValid()) {
-            data.timestamp = mesg.GetTimestamp() + 631065600; // Convert to Unix timestamp
-        } else {
-            data.timestamp = FIT_DATE_TIME_INVALID;
+// Decodes a stored value as a double. Returns false if it is the field's invalid sentinel.
+static bool decode_value(const RecordField& field, uint32_t bits, double* value) {
+    switch (field.type) {
+        case RECORD_VALUE_ENUM:
+        case RECORD_VALUE_UINT8:
+        case RECORD_VALUE_UINT16:
+        case RECORD_VALUE_UINT32:
+            *value = bits;
+            break;
+        case RECORD_VALUE_SINT8:
+        case RECORD_VALUE_SINT32:
+            *value = (int)bits;
+            break;
+        case RECORD_VALUE_FLOAT32: {
+            float f = bits_float(bits);
+            *value = f;
+            return f != FIT_FLOAT32_INVALID && !std::isnan(f);
         }
+    }
 
-        if (mesg.IsAltitudeValid()) {
-            data.altitude = mesg.GetAltitude();
-        } else {
-            data.altitude = FIT_FLOAT32_INVALID;
-        }
+    return bits != invalid_value(field);
+}
 
-        if (mesg.IsDistanceValid()) {
-            data.distance = mesg.GetDistance();
-        } else {
-            data.distance = FIT_FLOAT32_INVALID;
-        }
+// Builds record_field_index and invalid_values from the record_fields table.
+static void init_record_fields() {
+    memset(record_field_index, RECORD_FIELD_NONE, sizeof(record_field_index));
+    for (size_t i = 0; i < RECORD_FIELD_COUNT; i++) {
+        record_field_index[record_fields[i].num] = (FIT_UINT8)i;
+        invalid_values[i] = invalid_value(record_fields[i]);
+    }
+}
 
-        if (mesg.IsHeartRateValid()) {
-            data.heart_rate = mesg.GetHeartRate();
-        } else {
-            data.heart_rate = FIT_UINT8_INVALID;
-        }
+// Decoded records stored column by column. Only fields a file can produce get a column,
+// each value kept as the 4 bytes of its unsigned int, int or float, with the field's
+// invalid sentinel where a record lacks it.
+class RecordColumns {
+public:
+    RecordColumns() : count(0), reserved(0) {
+        memset(column_of, RECORD_FIELD_NONE, sizeof(column_of));
+        AddColumn(0);  // Every record has a timestamp
+    }
 
-        // Position & Navigation
-        if (mesg.IsPositionLatValid()) {
-            data.position_lat = mesg.GetPositionLat();
-        } else {
-            data.position_lat = FIT_SINT32_INVALID;
-        }
+    size_t size() const { return count; }
 
-        if (mesg.IsPositionLongValid()) {
-            data.position_long = mesg.GetPositionLong();
-        } else {
-            data.position_long = FIT_SINT32_INVALID;
-        }
+    // record_fields indices that have a column, in record_fields order.
+    const std::vector<FIT_UINT8>& fields() const { return column_fields; }
 
-        if (mesg.IsEnhancedAltitudeValid()) {
-            data.enhanced_altitude = mesg.GetEnhancedAltitude();
-        } else {
-            data.enhanced_altitude = FIT_FLOAT32_INVALID;
-        }
+    bool HasColumn(FIT_UINT8 index) const { return column_of[index] != RECORD_FIELD_NONE; }
 
-        if (mesg.IsSpeedValid()) {
-            data.speed = mesg.GetSpeed();
-        } else {
-            data.speed = FIT_FLOAT32_INVALID;
+    // Adds a column for record_fields[index], invalid for the records already stored.
+    void AddColumn(FIT_UINT8 index) {
+        if (HasColumn(index)) {
+            return;
         }
 
-        if (mesg.IsEnhancedSpeedValid()) {
-            data.enhanced_speed = mesg.GetEnhancedSpeed();
-        } else {
-            data.enhanced_speed = FIT_FLOAT32_INVALID;
-        }
+        auto position = std::lower_bound(column_fields.begin(), column_fields.end(), index);
+        column_fields.insert(position, index);
+        columns.emplace_back();
+        columns.back().reserve(reserved);
+        columns.back().assign(count, invalid_values[index]);
+        column_of[index] = (FIT_UINT8)(columns.size() - 1);
+    }
 
-        if (mesg.IsGradeValid()) {
-            data.grade = mesg.GetGrade();
-        } else {
-            data.grade = FIT_FLOAT32_INVALID;
+    void Reserve(size_t records) {
+        reserved = records;
+        for (std::vector<uint32_t>& column : columns) {
+            column.reserve(records);
         }
+    }
 
-        if (mesg.IsVerticalSpeedValid()) {
-            data.vertical_speed = mesg.GetVerticalSpeed();
-        } else {
-            data.vertical_speed = FIT_FLOAT32_INVALID;
+    // Frees capacity left over when the reservation overestimated the record count.
+    void ShrinkToFit() {
+        for (std::vector<uint32_t>& column : columns) {
+            column.shrink_to_fit();
         }
+    }
 
-        if (mesg.IsGpsAccuracyValid()) {
-            data.gps_accuracy = mesg.GetGpsAccuracy();
-        } else {
-            data.gps_accuracy = FIT_UINT8_INVALID;
+    // Appends a record given as one value per record_fields index.
+    void Append(const uint32_t* values) {
+        for (FIT_UINT8 index : column_fields) {
+            columns[column_of[index]].push_back(values[index]);
         }
+        count++;
+    }
 
-        // Power & Performance
-        if (mesg.IsPowerValid()) {
-            data.power = mesg.GetPower();
-        } else {
-            data.power = FIT_UINT16_INVALID;
-        }
+    uint32_t Raw(FIT_UINT8 index, size_t record) const {
+        return columns[column_of[index]][record];
+    }
 
-        if (mesg.IsAccumulatedPowerValid()) {
-            data.accumulated_power = mesg.GetAccumulatedPower();
-        } else {
-            data.accumulated_power = FIT_UINT32_INVALID;
-        }
+    unsigned int Timestamp(size_t record) const { return Raw(0, record); }
 
-        if (mesg.IsMotorPowerValid()) {
-            data.motor_power = mesg.GetMotorPower();
-        } else {
-            data.motor_power = FIT_UINT16_INVALID;
+    // Reads record_fields[index] of a record as a double. False if the record lacks it.
+    bool GetValue(FIT_UINT8 index, size_t record, double* value) const {
+        if (!HasColumn(index)) {
+            return false;
         }
+        return decode_value(record_fields[index], Raw(index, record), value);
+    }
 
-        if (mesg.IsLeftTorqueEffectivenessValid()) {
-            data.left_torque_effectiveness = mesg.GetLeftTorqueEffectiveness();
-        } else {
-            data.left_torque_effectiveness = FIT_FLOAT32_INVALID;
-        }
+private:
+    std::vector<std::vector<uint32_t>> columns;
+    std::vector<FIT_UINT8> column_fields;
+    FIT_UINT8 column_of[RECORD_FIELD_COUNT];  // Index into columns, or RECORD_FIELD_NONE
+    size_t count;
+    size_t reserved;
+};
 
-        if (mesg.IsRightTorqueEffectivenessValid()) {
-            data.right_torque_effectiveness = mesg.GetRightTorqueEffectiveness();
-        } else {
-            data.right_torque_effectiveness = FIT_FLOAT32_INVALID;
-        }
+// The record fields a file can produce: every field its record definitions declare, plus
+// the fields those expand into through profile components. Known before any record is read.
+struct RecordSchema {
+    uint64_t fields[4];  // Bit per FIT field number
 
-        if (mesg.IsLeftPedalSmoothnessValid()) {
-            data.left_pedal_smoothness = mesg.GetLeftPedalSmoothness();
-        } else {
-            data.left_pedal_smoothness = FIT_FLOAT32_INVALID;
-        }
+    bool Has(FIT_UINT8 num) const {
+        return (fields[num >> 6] >> (num & 63)) & 1;
+    }
 
-        if (mesg.IsRightPedalSmoothnessValid()) {
-            data.right_pedal_smoothness = mesg.GetRightPedalSmoothness();
-        } else {
-            data.right_pedal_smoothness = FIT_FLOAT32_INVALID;
+    void Add(FIT_UINT8 num) {
+        if (Has(num)) {
+            return;
         }
+        fields[num >> 6] |= (uint64_t)1 << (num & 63);
 
-        if (mesg.IsCombinedPedalSmoothnessValid()) {
-            data.combined_pedal_smoothness = mesg.GetCombinedPedalSmoothness();
-        } else {
-            data.combined_pedal_smoothness = FIT_FLOAT32_INVALID;
+        const fit::Profile::FIELD* field = fit::Profile::GetField(FIT_MESG_NUM_RECORD, num);
+        if (field == FIT_NULL) {
+            return;
         }
 
-        // Cadence & Cycling
-        if (mesg.IsCadenceValid()) {
-            data.cadence = mesg.GetCadence();
-        } else {
-            data.cadence = FIT_UINT8_INVALID;
+        for (FIT_UINT16 i = 0; i < field->numComponents; i++) {
+            Add(field->components[i].num);
         }
-
-        if (mesg.IsCadence256Valid()) {
-            data.cadence256 = mesg.GetCadence256();
-        } else {
-            data.cadence256 = FIT_FLOAT32_INVALID;
+        for (FIT_UINT16 i = 0; i < field->numSubFields; i++) {
+            for (FIT_UINT16 j = 0; j < field->subFields[i].numComponents; j++) {
+                Add(field->subFields[i].components[j].num);
+            }
         }
+    }
+};
 
-        if (mesg.IsFractionalCadenceValid()) {
-            data.fractional_cadence = mesg.GetFractionalCadence();
-        } else {
-            data.fractional_cadence = FIT_FLOAT32_INVALID;
-        }
+// Running min/max/mean of one record field.
+struct FieldStats {
+    unsigned long count;
+    double min;
+    double max;
+    double sum;
 
-        if (mesg.IsLeftRightBalanceValid()) {
-            data.left_right_balance = mesg.GetLeftRightBalance();
-        } else {
-            data.left_right_balance = FIT_UINT8_INVALID;
+    void add(double value) {
+        if (count == 0 || value < min) {
+            min = value;
         }
-
-        if (mesg.IsCycleLengthValid()) {
-            data.cycle_length = mesg.GetCycleLength();
-        } else {
-            data.cycle_length = FIT_FLOAT32_INVALID;
+        if (count == 0 || value > max) {
+            max = value;
         }
+        sum += value;
+        count++;
+    }
+};
 
-        if (mesg.IsCycleLength16Valid()) {
-            data.cycle_length16 = mesg.GetCycleLength16();
-        } else {
-            data.cycle_length16 = FIT_FLOAT32_INVALID;
-        }
+// Activity-level aggregates collected in the same pass that decodes the records.
+struct ActivitySummary {
+    unsigned long record_count;
+    unsigned int start_time;
+    unsigned int end_time;
+    double total_distance;  // Negative until a record carries a distance
+    FieldStats heart_rate;
+    FieldStats power;
+    FieldStats cadence;
+    FieldStats speed;
+    uint64_t fields_present[4];  // Bit per FIT field number seen in any record
+};
 
-        if (mesg.IsCyclesValid()) {
-            data.cycles = mesg.GetCycles();
-        } else {
-            data.cycles = FIT_UINT8_INVALID;
-        }
+// A continuous stretch of records with no gap between timestamps longer than the threshold.
+struct Session {
+    unsigned int start_time;
+    unsigned int end_time;
+    unsigned long record_count;
+};
 
-        if (mesg.IsTotalCyclesValid()) {
-            data.total_cycles = mesg.GetTotalCycles();
-        } else {
-            data.total_cycles = FIT_UINT32_INVALID;
+// Splits record timestamps into sessions as they stream in. The result is the same as
+// sorting every timestamp and cutting at each gap, but timestamps are only ever merged
+// into a small ordered set of sessions, so in-order files never pay for the sort.
+class SessionTracker {
+public:
+    std::map<unsigned int, Session> sessions;  // Keyed by start_time
+
+    explicit SessionTracker(unsigned int gap) : gap(gap) {}
+
+    void Add(unsigned int timestamp) {
+        // Fast path: the timestamp falls inside or just after the latest session
+        if (!sessions.empty()) {
+            Session& last = sessions.rbegin()->second;
+            if (timestamp >= last.start_time && (timestamp <= last.end_time || timestamp - last.end_time <= gap)) {
+                if (timestamp > last.end_time) {
+                    last.end_time = timestamp;
+                }
+                last.record_count++;
+                return;
+            }
+        }
+
+        auto next = sessions.upper_bound(timestamp);
+        auto current = sessions.end();
+
+        if (next != sessions.begin()) {
+            auto prev = std::prev(next);
+            if (timestamp <= prev->second.end_time || timestamp - prev->second.end_time <= gap) {
+                current = prev;
+                if (timestamp > current->second.end_time) {
+                    current->second.end_time = timestamp;
+                }
+            }
+        }
+
+        if (current == sessions.end()) {
+            Session session = {timestamp, timestamp, 0};
+            if (next != sessions.end() && next->first - timestamp <= gap) {
+                // Extends the following session backwards, which changes its key
+                session.end_time = next->second.end_time;
+                session.record_count = next->second.record_count;
+                sessions.erase(next);
+            }
+            current = sessions.emplace(timestamp, session).first;
+        }
+
+        current->second.record_count++;
+
+        // Growing a session can close the gap to the ones after it
+        next = std::next(current);
+        while (next != sessions.end() && next->second.start_time - current->second.end_time <= gap) {
+            if (next->second.end_time > current->second.end_time) {
+                current->second.end_time = next->second.end_time;
+            }
+            current->second.record_count += next->second.record_count;
+            next = sessions.erase(next);
         }
+    }
 
-        // Running Dynamics
-        if (mesg.IsVerticalOscillationValid()) {
-            data.vertical_oscillation = mesg.GetVerticalOscillation();
-        } else {
-            data.vertical_oscillation = FIT_FLOAT32_INVALID;
+    // The session spanning the most time; the earliest one wins a tie.
+    const Session* Longest() const {
+        const Session* longest = nullptr;
+        for (const auto& entry : sessions) {
+            const Session& session = entry.second;
+            if (longest == nullptr || session.end_time - session.start_time > longest->end_time - longest->start_time) {
+                longest = &session;
+            }
         }
+        return longest;
+    }
 
-        if (mesg.IsStanceTimeValid()) {
-            data.stance_time = mesg.GetStanceTime();
-        } else {
-            data.stance_time = FIT_FLOAT32_INVALID;
-        }
+private:
+    unsigned int gap;
+};
 
-        if (mesg.IsStanceTimePercentValid()) {
-            data.stance_time_percent = mesg.GetStanceTimePercent();
-        } else {
-            data.stance_time_percent = FIT_FLOAT32_INVALID;
-        }
+// A pause: the timer stopped at start_time and started again at end_time.
+struct Pause {
+    unsigned int start_time;
+    unsigned int end_time;
+};
 
-        if (mesg.IsStanceTimeBalanceValid()) {
-            data.stance_time_balance = mesg.GetStanceTimeBalance();
-        } else {
-            data.stance_time_balance = FIT_FLOAT32_INVALID;
+// Elapsed, timer and moving time of an activity, fed timer events and records as they
+// stream in, in file order.
+//
+// Timer start and stop events are paired the way fit::MesgWithEventBroadcaster does,
+// with the deprecated begin/end types mapped onto start and stop. Until the first timer
+// event it isn't known whether the timer ran, so that time is held back: a first start
+// drops it, a first stop counts it. Between two records, the time counts as moving when
+// the timer ran throughout and the speed over the interval reaches the threshold. That
+// speed comes from the distance covered when both records carry a distance, so a long
+// dropout standing still never counts, and from the later record's speed otherwise.
+class MotionTracker {
+public:
+    std::vector<Pause> pauses;
+
+    explicit MotionTracker(double speed_threshold)
+        : speed_threshold(speed_threshold), have_timestamp(false), first_time(0), last_time(0),
+          timer(TIMER_UNKNOWN), timer_since(0), pause_start(0), timer_time(0),
+          moving_time(0), pending_moving_time(0), have_speed(false), have_record(false),
+          record_time(0), record_distance(NAN), interval_broken(false) {}
+
+    void AddTimerEvent(unsigned int timestamp, FIT_EVENT_TYPE type) {
+        bool start;
+        switch (type) {
+            case FIT_EVENT_TYPE_START:
+            case FIT_EVENT_TYPE_BEGIN_DEPRECIATED:
+                start = true;
+                break;
+            case FIT_EVENT_TYPE_STOP:
+            case FIT_EVENT_TYPE_STOP_ALL:
+            case FIT_EVENT_TYPE_STOP_DISABLE:
+            case FIT_EVENT_TYPE_STOP_DISABLE_ALL:
+            case FIT_EVENT_TYPE_CONSECUTIVE_DEPRECIATED:
+            case FIT_EVENT_TYPE_END_DEPRECIATED:
+            case FIT_EVENT_TYPE_END_ALL_DEPRECIATED:
+                start = false;
+                break;
+            default:
+                return;  // Markers and invalid types don't move the timer
+        }
+
+        AddTimestamp(timestamp);
+        if (timer == TIMER_UNKNOWN) {
+            if (!start) {
+                // It ran from the start of the file
+                timer_time = Since(timer_since, timestamp);
+                moving_time = pending_moving_time;
+                pause_start = timestamp;
+            }
+            timer = start ? TIMER_RUNNING : TIMER_STOPPED;
+            timer_since = timestamp;
+            interval_broken = true;
+        } else if (start && timer == TIMER_STOPPED) {
+            pauses.push_back({pause_start, std::max(pause_start, timestamp)});
+            timer = TIMER_RUNNING;
+            timer_since = timestamp;
+            interval_broken = true;
+        } else if (!start && timer == TIMER_RUNNING) {
+            timer_time += Since(timer_since, timestamp);
+            timer = TIMER_STOPPED;
+            pause_start = timestamp;
+            interval_broken = true;
         }
+    }
 
-        if (mesg.IsStepLengthValid()) {
-            data.step_length = mesg.GetStepLength();
-        } else {
-            data.step_length = FIT_FLOAT32_INVALID;
-        }
+    // speed and distance are NaN when the record lacks them.
+    void AddRecord(unsigned int timestamp, double speed, double distance) {
+        AddTimestamp(timestamp);
+        if (!std::isnan(speed) || !std::isnan(distance)) {
+            have_speed = true;
+        }
+
+        if (have_record && !interval_broken && timer != TIMER_STOPPED && timestamp > record_time) {
+            unsigned int elapsed = timestamp - record_time;
+            if (!std::isnan(distance) && !std::isnan(record_distance) && distance >= record_distance) {
+                speed = (distance - record_distance) / elapsed;
+            }
+            if (speed >= speed_threshold && timer == TIMER_RUNNING) {
+                moving_time += elapsed;
+            } else if (speed >= speed_threshold) {
+                pending_moving_time += elapsed;
+            }
+        }
+
+        have_record = true;
+        record_time = timestamp;
+        record_distance = distance;
+        interval_broken = false;
+    }
 
-        if (mesg.IsVerticalRatioValid()) {
-            data.vertical_ratio = mesg.GetVerticalRatio();
-        } else {
-            data.vertical_ratio = FIT_FLOAT32_INVALID;
-        }
+    bool HasRecords() const { return have_record; }
 
-        // Physiological Data
-        if (mesg.IsCaloriesValid()) {
-            data.calories = mesg.GetCalories();
-        } else {
-            data.calories = FIT_UINT16_INVALID;
-        }
+    unsigned int ElapsedTime() const { return last_time - first_time; }
 
-        if (mesg.IsTemperatureValid()) {
-            data.temperature = mesg.GetTemperature();
-        } else {
-            data.temperature = FIT_SINT8_INVALID;
+    // False without any timer event, when only elapsed time is known.
+    bool GetTimerTime(unsigned int* seconds) const {
+        if (timer == TIMER_UNKNOWN) {
+            return false;
         }
+        *seconds = timer_time + (timer == TIMER_RUNNING ? Since(timer_since, last_time) : 0);
+        return true;
+    }
 
-        if (mesg.IsCoreTemperatureValid()) {
-            data.core_temperature = mesg.GetCoreTemperature();
-        } else {
-            data.core_temperature = FIT_FLOAT32_INVALID;
+    // False when no record carries a speed or distance. Without timer events the timer
+    // is taken to run throughout.
+    bool GetMovingTime(unsigned int* seconds) const {
+        if (!have_speed) {
+            return false;
         }
+        *seconds = timer == TIMER_UNKNOWN ? pending_moving_time : moving_time;
+        return true;
+    }
 
-        if (mesg.IsRespirationRateValid()) {
-            data.respiration_rate = mesg.GetRespirationRate();
-        } else {
-            data.respiration_rate = FIT_UINT8_INVALID;
-        }
+private:
+    enum TimerState { TIMER_UNKNOWN, TIMER_RUNNING, TIMER_STOPPED };
+
+    double speed_threshold;
+    bool have_timestamp;
+    unsigned int first_time;
+    unsigned int last_time;
+    TimerState timer;
+    unsigned int timer_since;   // When the timer last started, or the first timestamp
+    unsigned int pause_start;   // When the timer last stopped
+    unsigned int timer_time;    // Counted up to the last stop
+    unsigned int moving_time;
+    unsigned int pending_moving_time;  // Before the first timer event
+    bool have_speed;
+    bool have_record;
+    unsigned int record_time;  // Of the previous record
+    double record_distance;
+    bool interval_broken;  // The timer stopped or started since the previous record
+
+    static unsigned int Since(unsigned int from, unsigned int to) { return to > from ? to - from : 0; }
+
+    void AddTimestamp(unsigned int timestamp) {
+        if (!have_timestamp) {
+            first_time = last_time = timer_since = timestamp;
+            have_timestamp = true;
+        }
+        first_time = std::min(first_time, timestamp);
+        last_time = std::max(last_time, timestamp);
+    }
+};
 
-        if (mesg.IsEnhancedRespirationRateValid()) {
-            data.enhanced_respiration_rate = mesg.GetEnhancedRespirationRate();
-        } else {
-            data.enhanced_respiration_rate = FIT_FLOAT32_INVALID;
-        }
+// Samples further apart than this many seconds don't hold their value across the gap.
+static const unsigned int SERIES_MAX_GAP = 10;
 
-        if (mesg.IsCurrentStressValid()) {
-            data.current_stress = mesg.GetCurrentStress();
-        } else {
-            data.current_stress = FIT_FLOAT32_INVALID;
-        }
+// A stretch of a SecondSeries with a value for every second.
+struct SeriesSegment {
+    size_t offset;  // Into SecondSeries::values
+    size_t length;
+    unsigned int start_time;
+};
 
-        // Blood/Oxygen Data
-        if (mesg.IsTotalHemoglobinConcValid()) {
-            data.total_hemoglobin_conc = mesg.GetTotalHemoglobinConc();
-        } else {
-            data.total_hemoglobin_conc = FIT_FLOAT32_INVALID;
+// A record field resampled to one value per second. Each record carrying the field holds
+// its value until the next one; where the next is more than SERIES_MAX_GAP seconds later,
+// or the records go back in time, the series breaks into a new segment.
+struct SecondSeries {
+    std::vector<double> values;  // The segments back to back
+    std::vector<SeriesSegment> segments;
+
+    SecondSeries(const RecordColumns& records, FIT_UINT8 index) {
+        bool have_sample = false;
+        unsigned int last_time = 0;
+        double last_value = 0.0;
+        double value;
+        for (size_t record = 0; record < records.size(); record++) {
+            if (!records.GetValue(index, record, &value)) {
+                continue;
+            }
+
+            unsigned int timestamp = records.Timestamp(record);
+            if (have_sample && timestamp > last_time && timestamp - last_time <= SERIES_MAX_GAP) {
+                values.insert(values.end(), timestamp - last_time - 1, last_value);
+            } else if (!have_sample || timestamp != last_time) {
+                if (have_sample) {
+                    segments.back().length = values.size() - segments.back().offset;
+                }
+                segments.push_back({values.size(), 0, timestamp});
+            } else {
+                continue;  // A second sample for the same second; the first one stands
+            }
+
+            values.push_back(value);
+            have_sample = true;
+            last_time = timestamp;
+            last_value = value;
+        }
+        if (have_sample) {
+            segments.back().length = values.size() - segments.back().offset;
         }
+    }
 
-        if (mesg.IsTotalHemoglobinConcMinValid()) {
-            data.total_hemoglobin_conc_min = mesg.GetTotalHemoglobinConcMin();
-        } else {
-            data.total_hemoglobin_conc_min = FIT_FLOAT32_INVALID;
+    size_t LongestSegment() const {
+        size_t longest = 0;
+        for (const SeriesSegment& segment : segments) {
+            longest = std::max(longest, segment.length);
         }
+        return longest;
+    }
+};
 
-        if (mesg.IsTotalHemoglobinConcMaxValid()) {
-            data.total_hemoglobin_conc_max = mesg.GetTotalHemoglobinConcMax();
-        } else {
-            data.total_hemoglobin_conc_max = FIT_FLOAT32_INVALID;
+// The highest mean of a field over each duration, from prefix sums of its SecondSeries.
+// A window never spans a break in the series.
+class MeanMax {
+public:
+    explicit MeanMax(const SecondSeries& series)
+        : series(series), sums(series.values.size() + series.segments.size()) {
+        // A leading 0 per segment, so segment i's sums start at offset + i
+        for (size_t i = 0; i < series.segments.size(); i++) {
+            const SeriesSegment& segment = series.segments[i];
+            double* sum = &sums[segment.offset + i];
+            const double* value = &series.values[segment.offset];
+            sum[0] = 0.0;
+            for (size_t j = 0; j < segment.length; j++) {
+                sum[j + 1] = sum[j] + value[j];
+            }
         }
+    }
 
-        if (mesg.IsSaturatedHemoglobinPercentValid()) {
-            data.saturated_hemoglobin_percent = mesg.GetSaturatedHemoglobinPercent();
-        } else {
-            data.saturated_hemoglobin_percent = FIT_FLOAT32_INVALID;
-        }
+    // The best mean over duration seconds and when its window starts. False if no segment
+    // is that long.
+    bool Best(size_t duration, double* mean, unsigned int* start_time) const {
+        double best = 0.0;
+        const SeriesSegment* best_segment = nullptr;
+        size_t best_start = 0;
+
+        for (size_t i = 0; i < series.segments.size(); i++) {
+            const SeriesSegment& segment = series.segments[i];
+            if (segment.length < duration) {
+                continue;
+            }
+
+            // Branch-free over contiguous doubles so the compiler can vectorize the maximum,
+            // then a second pass finds where it is
+            const double* sum = &sums[segment.offset + i];
+            size_t windows = segment.length - duration + 1;
+            double segment_best = sum[duration] - sum[0];
+            for (size_t j = 1; j < windows; j++) {
+                double window = sum[j + duration] - sum[j];
+                segment_best = window > segment_best ? window : segment_best;
+            }
+
+            if (best_segment == nullptr || segment_best > best) {
+                size_t j = 0;
+                while (j + 1 < windows && sum[j + duration] - sum[j] != segment_best) {
+                    j++;
+                }
+                best = segment_best;
+                best_segment = &segment;
+                best_start = j;
+            }
+        }
+
+        if (best_segment == nullptr) {
+            return false;
+        }
+        *mean = best / duration;
+        *start_time = best_segment->start_time + (unsigned int)best_start;
+        return true;
+    }
 
-        if (mesg.IsSaturatedHemoglobinPercentMinValid()) {
-            data.saturated_hemoglobin_percent_min = mesg.GetSaturatedHemoglobinPercentMin();
-        } else {
-            data.saturated_hemoglobin_percent_min = FIT_FLOAT32_INVALID;
-        }
+private:
+    const SecondSeries& series;
+    std::vector<double> sums;
+};
 
-        if (mesg.IsSaturatedHemoglobinPercentMaxValid()) {
-            data.saturated_hemoglobin_percent_max = mesg.GetSaturatedHemoglobinPercentMax();
-        } else {
-            data.saturated_hemoglobin_percent_max = FIT_FLOAT32_INVALID;
-        }
+// Roughly log-spaced durations for a mean-max curve, in seconds.
+static const unsigned int mean_max_durations[] = {
+    1, 2, 3, 5, 10, 15, 20, 30, 45, 60, 90, 120, 180, 240, 300, 420, 600, 900, 1200,
+    1800, 2700, 3600, 5400, 7200, 10800, 14400, 21600, 28800, 43200, 86400};
+
+// Athlete settings for training load metrics. Values not given are 0.
+struct LoadSettings {
+    double ftp;
+    double max_hr;
+    double resting_hr;
+    std::vector<double> hr_zones;  // Lower bounds of the Edwards zones, ascending
+    bool female;
+};
 
-        // E-bike Specific
-        if (mesg.IsBatterySocValid()) {
-            data.battery_soc = mesg.GetBatterySoc();
-        } else {
-            data.battery_soc = FIT_FLOAT32_INVALID;
-        }
+// Training load from the power and heart rate series of an activity. A metric is NaN
+// when the settings or the records don't support it.
+struct TrainingLoad {
+    double normalized_power;
+    double intensity_factor;
+    double training_stress_score;
+    double variability_index;
+    double trimp;  // Banister
+    double edwards_trimp;
+
+    TrainingLoad(const RecordColumns& records, const LoadSettings& settings)
+        : normalized_power(NAN), intensity_factor(NAN), training_stress_score(NAN), variability_index(NAN),
+          trimp(NAN), edwards_trimp(NAN) {
+        AddPower(SecondSeries(records, record_field_index[fit::RecordMesg::FieldDefNum::Power]), settings);
+        AddHeartRate(SecondSeries(records, record_field_index[fit::RecordMesg::FieldDefNum::HeartRate]), settings);
+    }
 
-        if (mesg.IsEbikeTravelRangeValid()) {
-            data.ebike_travel_range = mesg.GetEbikeTravelRange();
-        } else {
-            data.ebike_travel_range = FIT_UINT16_INVALID;
+private:
+    // Normalized power is the fourth root of the mean fourth power of the 30 s rolling
+    // average, which only starts once a segment has 30 s of data.
+    void AddPower(const SecondSeries& power, const LoadSettings& settings) {
+        double total = 0.0;
+        double fourth_powers = 0.0;
+        size_t rolling_count = 0;
+        for (const SeriesSegment& segment : power.segments) {
+            const double* value = &power.values[segment.offset];
+            double window = 0.0;
+            for (size_t i = 0; i < segment.length; i++) {
+                total += value[i];
+                window += value[i];
+                if (i >= 30) {
+                    window -= value[i - 30];
+                }
+                if (i >= 29) {
+                    double average = window / 30.0;
+                    fourth_powers += average * average * average * average;
+                    rolling_count++;
+                }
+            }
+        }
+
+        if (rolling_count == 0) {
+            return;
+        }
+        normalized_power = std::pow(fourth_powers / rolling_count, 0.25);
+        double average_power = total / power.values.size();
+        if (average_power > 0.0) {
+            variability_index = normalized_power / average_power;
+        }
+        if (settings.ftp > 0.0) {
+            intensity_factor = normalized_power / settings.ftp;
+            double seconds = (double)power.values.size();
+            training_stress_score = seconds * normalized_power * intensity_factor / (settings.ftp * 3600.0) * 100.0;
         }
+    }
 
-        if (mesg.IsEbikeBatteryLevelValid()) {
-            data.ebike_battery_level = mesg.GetEbikeBatteryLevel();
-        } else {
-            data.ebike_battery_level = FIT_UINT8_INVALID;
+    // Banister TRIMP weights each minute by the heart rate reserve fraction, Edwards TRIMP
+    // by the number of the zone the heart rate is in.
+    void AddHeartRate(const SecondSeries& heart_rate, const LoadSettings& settings) {
+        if (heart_rate.values.empty()) {
+            return;
         }
 
-        if (mesg.IsEbikeAssistModeValid()) {
-            data.ebike_assist_mode = mesg.GetEbikeAssistMode();
-        } else {
-            data.ebike_assist_mode = FIT_UINT8_INVALID;
+        std::vector<double> zones = settings.hr_zones;
+        if (zones.empty() && settings.max_hr > 0.0) {
+            for (double fraction : {0.5, 0.6, 0.7, 0.8, 0.9}) {
+                zones.push_back(fraction * settings.max_hr);
+            }
         }
+        bool banister = settings.max_hr > settings.resting_hr && settings.resting_hr > 0.0;
+        double a = settings.female ? 0.86 : 0.64;
+        double b = settings.female ? 1.67 : 1.92;
 
-        if (mesg.IsEbikeAssistLevelPercentValid()) {
-            data.ebike_assist_level_percent = mesg.GetEbikeAssistLevelPercent();
-        } else {
-            data.ebike_assist_level_percent = FIT_UINT8_INVALID;
+        double banister_sum = 0.0;
+        double edwards_sum = 0.0;
+        for (double value : heart_rate.values) {
+            if (banister) {
+                double reserve = (value - settings.resting_hr) / (settings.max_hr - settings.resting_hr);
+                reserve = std::min(std::max(reserve, 0.0), 1.0);
+                banister_sum += reserve * a * std::exp(b * reserve);
+            }
+            edwards_sum += (double)(std::upper_bound(zones.begin(), zones.end(), value) - zones.begin());
         }
 
-        // Swimming/Water Sports
-        if (mesg.IsStrokeTypeValid()) {
-            data.stroke_type = mesg.GetStrokeType();
-        } else {
-            data.stroke_type = FIT_UINT8_INVALID;
+        if (banister) {
+            trimp = banister_sum / 60.0;
         }
-
-        if (mesg.IsResistanceValid()) {
-            data.resistance = mesg.GetResistance();
-        } else {
-            data.resistance = FIT_UINT8_INVALID;
+        if (!zones.empty()) {
+            edwards_trimp = edwards_sum / 60.0;
         }
+    }
+};
 
-        if (mesg.IsBallSpeedValid()) {
-            data.ball_speed = mesg.GetBallSpeed();
-        } else {
-            data.ball_speed = FIT_FLOAT32_INVALID;
-        }
+// Calls hold(value, seconds) for each sample of a record field with the seconds it holds:
+// until the next sample carrying the field, as in SecondSeries, or one second before a
+// break and at the end. Of two samples for the same second, the first one stands.
+template <typename Hold>
+static void for_each_held_sample(const RecordColumns& records, FIT_UINT8 index, Hold hold) {
+    bool have_sample = false;
+    unsigned int last_time = 0;
+    double last_value = 0.0;
+    double value;
+    for (size_t record = 0; record < records.size(); record++) {
+        if (!records.GetValue(index, record, &value)) {
+            continue;
+        }
+
+        unsigned int timestamp = records.Timestamp(record);
+        if (have_sample) {
+            if (timestamp == last_time) {
+                continue;
+            }
+            bool held = timestamp > last_time && timestamp - last_time <= SERIES_MAX_GAP;
+            hold(last_value, held ? timestamp - last_time : 1);
+        }
+
+        have_sample = true;
+        last_time = timestamp;
+        last_value = value;
+    }
+    if (have_sample) {
+        hold(last_value, 1);
+    }
+}
 
-        // Diving
-        if (mesg.IsDepthValid()) {
-            data.depth = mesg.GetDepth();
-        } else {
-            data.depth = FIT_FLOAT32_INVALID;
-        }
+// Seconds spent in each zone of a record field, each sample holding as in
+// for_each_held_sample. Zone i holds the values up to bounds[i] and above bounds[i - 1],
+// and one last zone the values above every bound, as with the high boundaries of a
+// time_in_zone message.
+static std::vector<uint64_t> time_in_zones(const RecordColumns& records, FIT_UINT8 index,
+                                           const std::vector<double>& bounds) {
+    std::vector<uint64_t> seconds(bounds.size() + 1, 0);
+    for_each_held_sample(records, index, [&](double value, unsigned int held) {
+        seconds[std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin()] += held;
+    });
+    return seconds;
+}
 
-        if (mesg.IsAbsolutePressureValid()) {
-            data.absolute_pressure = mesg.GetAbsolutePressure();
-        } else {
-            data.absolute_pressure = FIT_UINT32_INVALID;
-        }
+// The record fields a time_in_zone message has zones for, and its fields holding their
+// zone times and high boundaries.
+struct ZoneFields {
+    FIT_UINT8 record_field;
+    FIT_UINT8 seconds;
+    FIT_UINT8 high_boundaries;
+};
 
-        if (mesg.IsNextStopDepthValid()) {
-            data.next_stop_depth = mesg.GetNextStopDepth();
-        } else {
-            data.next_stop_depth = FIT_FLOAT32_INVALID;
-        }
+static const ZoneFields time_in_zone_fields[] = {
+    {fit::RecordMesg::FieldDefNum::HeartRate, fit::TimeInZoneMesg::FieldDefNum::TimeInHrZone,
+     fit::TimeInZoneMesg::FieldDefNum::HrZoneHighBoundary},
+    {fit::RecordMesg::FieldDefNum::Speed, fit::TimeInZoneMesg::FieldDefNum::TimeInSpeedZone,
+     fit::TimeInZoneMesg::FieldDefNum::SpeedZoneHighBoundary},
+    {fit::RecordMesg::FieldDefNum::Cadence, fit::TimeInZoneMesg::FieldDefNum::TimeInCadenceZone,
+     fit::TimeInZoneMesg::FieldDefNum::CadenceZoneHighBondary},
+    {fit::RecordMesg::FieldDefNum::Power, fit::TimeInZoneMesg::FieldDefNum::TimeInPowerZone,
+     fit::TimeInZoneMesg::FieldDefNum::PowerZoneHighBoundary},
+};
 
-        if (mesg.IsNextStopTimeValid()) {
-            data.next_stop_time = mesg.GetNextStopTime();
-        } else {
-            data.next_stop_time = FIT_UINT32_INVALID;
-        }
+static const size_t TIME_IN_ZONE_FIELD_COUNT = sizeof(time_in_zone_fields) / sizeof(time_in_zone_fields[0]);
 
-        if (mesg.IsTimeToSurfaceValid()) {
-            data.time_to_surface = mesg.GetTimeToSurface();
-        } else {
-            data.time_to_surface = FIT_UINT32_INVALID;
-        }
+// One field's zones in a time_in_zone message. Invalid entries are NaN.
+struct DeviceZones {
+    std::vector<double> high_boundaries;
+    std::vector<double> seconds;
+};
 
-        if (mesg.IsNdlTimeValid()) {
-            data.ndl_time = mesg.GetNdlTime();
-        } else {
-            data.ndl_time = FIT_UINT32_INVALID;
-        }
+// A time_in_zone message, the device's own zone times for a session or lap.
+struct DeviceTimeInZone {
+    unsigned int timestamp;  // Unix, 0 if absent
+    FIT_UINT16 reference_mesg;  // FIT_UINT16_INVALID if absent
+    FIT_UINT16 reference_index;
+    DeviceZones zones[TIME_IN_ZONE_FIELD_COUNT];  // By time_in_zone_fields
 
-        if (mesg.IsCnsLoadValid()) {
-            data.cns_load = mesg.GetCnsLoad();
-        } else {
-            data.cns_load = FIT_UINT8_INVALID;
+    explicit DeviceTimeInZone(const fit::Mesg& mesg)
+        : timestamp(0), reference_mesg(FIT_UINT16_INVALID), reference_index(FIT_UINT16_INVALID) {
+        const fit::Field* field = mesg.GetField(fit::TimeInZoneMesg::FieldDefNum::Timestamp);
+        if (field != FIT_NULL && field->IsValueValid()) {
+            timestamp = field->GetUINT32Value() + 631065600; // Convert to Unix timestamp
         }
-
-        if (mesg.IsN2LoadValid()) {
-            data.n2_load = mesg.GetN2Load();
-        } else {
-            data.n2_load = FIT_UINT16_INVALID;
+        field = mesg.GetField(fit::TimeInZoneMesg::FieldDefNum::ReferenceMesg);
+        if (field != FIT_NULL && field->IsValueValid()) {
+            reference_mesg = field->GetUINT16Value();
         }
-
-        if (mesg.IsAirTimeRemainingValid()) {
-            data.air_time_remaining = mesg.GetAirTimeRemaining();
-        } else {
-            data.air_time_remaining = FIT_UINT32_INVALID;
+        field = mesg.GetField(fit::TimeInZoneMesg::FieldDefNum::ReferenceIndex);
+        if (field != FIT_NULL && field->IsValueValid()) {
+            reference_index = field->GetUINT16Value();
         }
 
-        if (mesg.IsAscentRateValid()) {
-            data.ascent_rate = mesg.GetAscentRate();
-        } else {
-            data.ascent_rate = FIT_FLOAT32_INVALID;
+        for (size_t i = 0; i < TIME_IN_ZONE_FIELD_COUNT; i++) {
+            GetValues(mesg, time_in_zone_fields[i].high_boundaries, &zones[i].high_boundaries);
+            GetValues(mesg, time_in_zone_fields[i].seconds, &zones[i].seconds);
         }
+    }
 
-        if (mesg.IsPo2Valid()) {
-            data.po2 = mesg.GetPo2();
-        } else {
-            data.po2 = FIT_FLOAT32_INVALID;
+private:
+    static void GetValues(const fit::Mesg& mesg, FIT_UINT8 num, std::vector<double>* values) {
+        const fit::Field* field = mesg.GetField(num);
+        if (field == FIT_NULL) {
+            return;
         }
-
-        // Other Fields
-        if (mesg.IsActivityTypeValid()) {
-            data.activity_type = mesg.GetActivityType();
-        } else {
-            data.activity_type = FIT_UINT8_INVALID;
+        for (FIT_UINT8 i = 0; i < field->GetNumValues(); i++) {
+            values->push_back(field->IsValueValid(i) ? field->GetFLOAT64Value(i) : NAN);
         }
+    }
+};
 
-        if (mesg.IsDeviceIndexValid()) {
-            data.device_index = mesg.GetDeviceIndex();
-        } else {
-            data.device_index = FIT_UINT8_INVALID;
-        }
+// How resample_field fills grid points that fall between two samples.
+enum ResamplePolicy {
+    RESAMPLE_LINEAR,    // Interpolate between them
+    RESAMPLE_PREVIOUS,  // Hold the earlier one
+    RESAMPLE_NONE       // Leave them missing
+};
 
-        if (mesg.IsZoneValid()) {
-            data.zone = mesg.GetZone();
-        } else {
-            data.zone = FIT_UINT8_INVALID;
-        }
+// Grids are capped at 2^24 points, over six months at 1 s.
+static const uint64_t RESAMPLE_MAX_POINTS = (uint64_t)1 << 24;
 
-        if (mesg.IsTime128Valid()) {
-            data.time128 = mesg.GetTime128();
-        } else {
-            data.time128 = FIT_FLOAT32_INVALID;
-        }
+struct TimedValue {
+    unsigned int time;
+    double value;
+};
 
-        if (mesg.IsGritValid()) {
-            data.grit = mesg.GetGrit();
-        } else {
-            data.grit = FIT_FLOAT32_INVALID;
+// The samples of a record field in time order. Of two samples for the same second, the
+// earlier record stands.
+static std::vector<TimedValue> time_ordered_samples(const RecordColumns& records, FIT_UINT8 index) {
+    std::vector<TimedValue> samples;
+    double value;
+    for (size_t record = 0; record < records.size(); record++) {
+        if (records.GetValue(index, record, &value)) {
+            samples.push_back({records.Timestamp(record), value});
         }
+    }
 
-        if (mesg.IsFlowValid()) {
-            data.flow = mesg.GetFlow();
-        } else {
-            data.flow = FIT_FLOAT32_INVALID;
-        }
+    auto earlier = [](const TimedValue& a, const TimedValue& b) { return a.time < b.time; };
+    auto same_time = [](const TimedValue& a, const TimedValue& b) { return a.time == b.time; };
+    if (!std::is_sorted(samples.begin(), samples.end(), earlier)) {
+        std::stable_sort(samples.begin(), samples.end(), earlier);
+    }
+    samples.erase(std::unique(samples.begin(), samples.end(), same_time), samples.end());
+    return samples;
+}
 
-        if (mesg.IsTimeFromCourseValid()) {
-            data.time_from_course = mesg.GetTimeFromCourse();
-        } else {
-            data.time_from_course = FIT_FLOAT32_INVALID;
+// Writes count grid values, interval seconds apart from start_time, to out. A grid point
+// on a sample takes its value. One between two samples more than max_gap seconds apart,
+// or outside the samples, is NaN, and the policy decides the others.
+static void resample_field(const std::vector<TimedValue>& samples, ResamplePolicy policy, unsigned int start_time,
+                           unsigned int interval, unsigned int max_gap, size_t count, double* out) {
+    size_t next = 0;  // The first sample at or after the grid point
+    for (size_t point = 0; point < count; point++) {
+        uint64_t time = start_time + (uint64_t)point * interval;
+        while (next < samples.size() && samples[next].time < time) {
+            next++;
         }
 
-        if (mesg.IsLeftPcoValid()) {
-            data.left_pco = mesg.GetLeftPco();
-        } else {
-            data.left_pco = FIT_SINT8_INVALID;
+        out[point] = NAN;
+        if (next < samples.size() && samples[next].time == time) {
+            out[point] = samples[next].value;
+            continue;
         }
-
-        if (mesg.IsRightPcoValid()) {
-            data.right_pco = mesg.GetRightPco();
-        } else {
-            data.right_pco = FIT_SINT8_INVALID;
+        if (policy == RESAMPLE_NONE || next == 0 || next == samples.size()) {
+            continue;
         }
 
-        if (mesg.IsPressureSacValid()) {
-            data.pressure_sac = mesg.GetPressureSac();
-        } else {
-            data.pressure_sac = FIT_FLOAT32_INVALID;
+        const TimedValue& before = samples[next - 1];
+        const TimedValue& after = samples[next];
+        if (after.time - before.time > max_gap) {
+            continue;
         }
-
-        if (mesg.IsVolumeSacValid()) {
-            data.volume_sac = mesg.GetVolumeSac();
+        if (policy == RESAMPLE_PREVIOUS) {
+            out[point] = before.value;
         } else {
-            data.volume_sac = FIT_FLOAT32_INVALID;
+            double fraction = (double)(time - before.time) / (after.time - before.time);
+            out[point] = before.value + (after.value - before.value) * fraction;
         }
+    }
+}
 
-        if (mesg.IsRmvValid()) {
-            data.rmv = mesg.GetRmv();
-        } else {
-            data.rmv = FIT_FLOAT32_INVALID;
-        }
+static const double DEGREES_PER_SEMICIRCLE = 180.0 / 2147483648.0;
+static const double EARTH_RADIUS = 6371008.8;  // Mean radius in meters
 
-        // Only add record if we have valid timestamp and at least one other valid field
-        if (data.timestamp != FIT_DATE_TIME_INVALID) {
-            records.push_back(data);
-        }
-    }
+// A track point in degrees, and projected to meters on a plane tangent near the track.
+struct TrackPoint {
+    double lat;
+    double lon;
+    double x;
+    double y;
 };
 
-// This is the main NIF function that Elixir will call.
-static ERL_NIF_TERM decode_fit_file_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
-    if (argc != 1) {
-        return enif_make_badarg(env);
+// The record positions in record order, skipping records without both coordinates.
+static std::vector<TrackPoint> track_points(const RecordColumns& records) {
+    FIT_UINT8 lat_index = record_field_index[fit::RecordMesg::FieldDefNum::PositionLat];
+    FIT_UINT8 lon_index = record_field_index[fit::RecordMesg::FieldDefNum::PositionLong];
+    std::vector<TrackPoint> points;
+    double lat, lon;
+    for (size_t record = 0; record < records.size(); record++) {
+        if (records.GetValue(lat_index, record, &lat) && records.GetValue(lon_index, record, &lon)) {
+            points.push_back({lat * DEGREES_PER_SEMICIRCLE, lon * DEGREES_PER_SEMICIRCLE, 0.0, 0.0});
+        }
     }
 
-    ErlNifBinary fit_binary;
-    if (!enif_inspect_binary(env, argv[0], &fit_binary)) {
-        return enif_make_badarg(env);
+    // An equirectangular projection about the first point is accurate to well under a
+    // percent over the span of an activity
+    if (!points.empty()) {
+        double scale = EARTH_RADIUS * M_PI / 180.0;
+        double lon_scale = scale * std::cos(points[0].lat * M_PI / 180.0);
+        for (TrackPoint& point : points) {
+            point.x = point.lon * lon_scale;
+            point.y = point.lat * scale;
+        }
     }
+    return points;
+}
 
-    // Create a string stream from the binary data from Elixir.
-    std::stringstream fit_stream;
-    fit_stream.write(reinterpret_cast<const char*>(fit_binary.data), fit_binary.size);
-
-    fit::Decode decode;
-    Listener listener;
+// Distance from p to the segment from a to b, in meters.
+static double segment_distance(const TrackPoint& p, const TrackPoint& a, const TrackPoint& b) {
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    double length2 = dx * dx + dy * dy;
+    double t = length2 > 0.0 ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / length2 : 0.0;
+    t = std::min(std::max(t, 0.0), 1.0);
+    return std::hypot(p.x - (a.x + t * dx), p.y - (a.y + t * dy));
+}
 
-    // Check if the FIT file is valid.
-    if (!decode.CheckIntegrity(fit_stream)) {
-        return enif_make_atom(env, "error_integrity_check_failed");
+// Marks the points Douglas-Peucker keeps: the ends, and recursively the point furthest from
+// the segment between two kept points while it is more than tolerance meters away.
+static void douglas_peucker(const std::vector<TrackPoint>& points, double tolerance, std::vector<bool>* keep) {
+    std::vector<std::pair<size_t, size_t>> ranges = {{0, points.size() - 1}};
+    while (!ranges.empty()) {
+        size_t first = ranges.back().first;
+        size_t last = ranges.back().second;
+        ranges.pop_back();
+
+        double furthest = 0.0;
+        size_t index = first;
+        for (size_t i = first + 1; i < last; i++) {
+            double distance = segment_distance(points[i], points[first], points[last]);
+            if (distance > furthest) {
+                furthest = distance;
+                index = i;
+            }
+        }
+        if (furthest > tolerance) {
+            (*keep)[index] = true;
+            ranges.push_back({first, index});
+            ranges.push_back({index, last});
+        }
     }
+}
 
-    // Reset stream position after integrity check
-    fit_stream.clear();
-    fit_stream.seekg(0, std::ios::beg);
-
-    // Read the file from the stream with our listener.
-    try {
-        decode.Read(fit_stream, listener);
-    } catch (const fit::RuntimeException& e) {
-        return enif_make_atom(env, "error_sdk_exception");
-    }
-
-    // --- Convert C++ data to Elixir terms ---
-
-    // Create atoms for all the map keys
-    ERL_NIF_TERM atom_timestamp = enif_make_atom(env, "timestamp");
-    ERL_NIF_TERM atom_altitude = enif_make_atom(env, "altitude");
-    ERL_NIF_TERM atom_distance = enif_make_atom(env, "distance");
-    ERL_NIF_TERM atom_heart_rate = enif_make_atom(env, "heart_rate");
-
-    // Position & Navigation atoms
-    ERL_NIF_TERM atom_position_lat = enif_make_atom(env, "position_lat");
-    ERL_NIF_TERM atom_position_long = enif_make_atom(env, "position_long");
-    ERL_NIF_TERM atom_enhanced_altitude = enif_make_atom(env, "enhanced_altitude");
-    ERL_NIF_TERM atom_speed = enif_make_atom(env, "speed");
-    ERL_NIF_TERM atom_enhanced_speed = enif_make_atom(env, "enhanced_speed");
-    ERL_NIF_TERM atom_grade = enif_make_atom(env, "grade");
-    ERL_NIF_TERM atom_vertical_speed = enif_make_atom(env, "vertical_speed");
-    ERL_NIF_TERM atom_gps_accuracy = enif_make_atom(env, "gps_accuracy");
-
-    // Power & Performance atoms
-    ERL_NIF_TERM atom_power = enif_make_atom(env, "power");
-    ERL_NIF_TERM atom_accumulated_power = enif_make_atom(env, "accumulated_power");
-    ERL_NIF_TERM atom_motor_power = enif_make_atom(env, "motor_power");
-    ERL_NIF_TERM atom_left_torque_effectiveness = enif_make_atom(env, "left_torque_effectiveness");
-    ERL_NIF_TERM atom_right_torque_effectiveness = enif_make_atom(env, "right_torque_effectiveness");
-    ERL_NIF_TERM atom_left_pedal_smoothness = enif_make_atom(env, "left_pedal_smoothness");
-    ERL_NIF_TERM atom_right_pedal_smoothness = enif_make_atom(env, "right_pedal_smoothness");
-    ERL_NIF_TERM atom_combined_pedal_smoothness = enif_make_atom(env, "combined_pedal_smoothness");
-
-    // Cadence & Cycling atoms
-    ERL_NIF_TERM atom_cadence = enif_make_atom(env, "cadence");
-    ERL_NIF_TERM atom_cadence256 = enif_make_atom(env, "cadence256");
-    ERL_NIF_TERM atom_fractional_cadence = enif_make_atom(env, "fractional_cadence");
-    ERL_NIF_TERM atom_left_right_balance = enif_make_atom(env, "left_right_balance");
-    ERL_NIF_TERM atom_cycle_length = enif_make_atom(env, "cycle_length");
-    ERL_NIF_TERM atom_cycle_length16 = enif_make_atom(env, "cycle_length16");
-    ERL_NIF_TERM atom_cycles = enif_make_atom(env, "cycles");
-    ERL_NIF_TERM atom_total_cycles = enif_make_atom(env, "total_cycles");
-
-    // Running Dynamics atoms
-    ERL_NIF_TERM atom_vertical_oscillation = enif_make_atom(env, "vertical_oscillation");
-    ERL_NIF_TERM atom_stance_time = enif_make_atom(env, "stance_time");
-    ERL_NIF_TERM atom_stance_time_percent = enif_make_atom(env, "stance_time_percent");
-    ERL_NIF_TERM atom_stance_time_balance = enif_make_atom(env, "stance_time_balance");
-    ERL_NIF_TERM atom_step_length = enif_make_atom(env, "step_length");
-    ERL_NIF_TERM atom_vertical_ratio = enif_make_atom(env, "vertical_ratio");
-
-    // Physiological Data atoms
-    ERL_NIF_TERM atom_calories = enif_make_atom(env, "calories");
-    ERL_NIF_TERM atom_temperature = enif_make_atom(env, "temperature");
-    ERL_NIF_TERM atom_core_temperature = enif_make_atom(env, "core_temperature");
-    ERL_NIF_TERM atom_respiration_rate = enif_make_atom(env, "respiration_rate");
-    ERL_NIF_TERM atom_enhanced_respiration_rate = enif_make_atom(env, "enhanced_respiration_rate");
-    ERL_NIF_TERM atom_current_stress = enif_make_atom(env, "current_stress");
-
-    // Blood/Oxygen Data atoms
-    ERL_NIF_TERM atom_total_hemoglobin_conc = enif_make_atom(env, "total_hemoglobin_conc");
-    ERL_NIF_TERM atom_total_hemoglobin_conc_min = enif_make_atom(env, "total_hemoglobin_conc_min");
-    ERL_NIF_TERM atom_total_hemoglobin_conc_max = enif_make_atom(env, "total_hemoglobin_conc_max");
-    ERL_NIF_TERM atom_saturated_hemoglobin_percent = enif_make_atom(env, "saturated_hemoglobin_percent");
-    ERL_NIF_TERM atom_saturated_hemoglobin_percent_min = enif_make_atom(env, "saturated_hemoglobin_percent_min");
-    ERL_NIF_TERM atom_saturated_hemoglobin_percent_max = enif_make_atom(env, "saturated_hemoglobin_percent_max");
-
-    // E-bike Specific atoms
-    ERL_NIF_TERM atom_battery_soc = enif_make_atom(env, "battery_soc");
-    ERL_NIF_TERM atom_ebike_travel_range = enif_make_atom(env, "ebike_travel_range");
-    ERL_NIF_TERM atom_ebike_battery_level = enif_make_atom(env, "ebike_battery_level");
-    ERL_NIF_TERM atom_ebike_assist_mode = enif_make_atom(env, "ebike_assist_mode");
-    ERL_NIF_TERM atom_ebike_assist_level_percent = enif_make_atom(env, "ebike_assist_level_percent");
-
-    // Swimming/Water Sports atoms
-    ERL_NIF_TERM atom_stroke_type = enif_make_atom(env, "stroke_type");
-    ERL_NIF_TERM atom_resistance = enif_make_atom(env, "resistance");
-    ERL_NIF_TERM atom_ball_speed = enif_make_atom(env, "ball_speed");
-
-    // Diving atoms
-    ERL_NIF_TERM atom_depth = enif_make_atom(env, "depth");
-    ERL_NIF_TERM atom_absolute_pressure = enif_make_atom(env, "absolute_pressure");
-    ERL_NIF_TERM atom_next_stop_depth = enif_make_atom(env, "next_stop_depth");
-    ERL_NIF_TERM atom_next_stop_time = enif_make_atom(env, "next_stop_time");
-    ERL_NIF_TERM atom_time_to_surface = enif_make_atom(env, "time_to_surface");
-    ERL_NIF_TERM atom_ndl_time = enif_make_atom(env, "ndl_time");
-    ERL_NIF_TERM atom_cns_load = enif_make_atom(env, "cns_load");
-    ERL_NIF_TERM atom_n2_load = enif_make_atom(env, "n2_load");
-    ERL_NIF_TERM atom_air_time_remaining = enif_make_atom(env, "air_time_remaining");
-    ERL_NIF_TERM atom_ascent_rate = enif_make_atom(env, "ascent_rate");
-    ERL_NIF_TERM atom_po2 = enif_make_atom(env, "po2");
-
-    // Other Fields atoms
-    ERL_NIF_TERM atom_activity_type = enif_make_atom(env, "activity_type");
-    ERL_NIF_TERM atom_device_index = enif_make_atom(env, "device_index");
-    ERL_NIF_TERM atom_zone = enif_make_atom(env, "zone");
-    ERL_NIF_TERM atom_time128 = enif_make_atom(env, "time128");
-    ERL_NIF_TERM atom_grit = enif_make_atom(env, "grit");
-    ERL_NIF_TERM atom_flow = enif_make_atom(env, "flow");
-    ERL_NIF_TERM atom_time_from_course = enif_make_atom(env, "time_from_course");
-    ERL_NIF_TERM atom_left_pco = enif_make_atom(env, "left_pco");
-    ERL_NIF_TERM atom_right_pco = enif_make_atom(env, "right_pco");
-    ERL_NIF_TERM atom_pressure_sac = enif_make_atom(env, "pressure_sac");
-    ERL_NIF_TERM atom_volume_sac = enif_make_atom(env, "volume_sac");
-    ERL_NIF_TERM atom_rmv = enif_make_atom(env, "rmv");
-
-    ERL_NIF_TERM result_list = enif_make_list(env, 0);
-
-    // Iterate through the collected records in reverse to build the Elixir list correctly.
-    for (auto it = listener.records.rbegin(); it != listener.records.rend(); ++it) {
-        ERL_NIF_TERM map = enif_make_new_map(env);
-
-        // Add timestamp (always present due to our filtering)
-        enif_make_map_put(env, map, atom_timestamp, enif_make_uint(env, it->timestamp), &map);
+static double triangle_area(const TrackPoint& a, const TrackPoint& b, const TrackPoint& c) {
+    return std::fabs((b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y)) / 2.0;
+}
 
-        // Basic fields
-        if (it->altitude != FIT_FLOAT32_INVALID && !std::isnan(it->altitude)) {
-            enif_make_map_put(env, map, atom_altitude, enif_make_double(env, it->altitude), &map);
+// Marks the points Visvalingam-Whyatt keeps: it removes the point forming the smallest
+// triangle with its neighbours until none is under min_area square meters. A point's
+// area never drops below that of a point removed before it.
+static void visvalingam(const std::vector<TrackPoint>& points, double min_area, std::vector<bool>* keep) {
+    size_t count = points.size();
+    std::vector<size_t> previous(count), next(count);
+    std::vector<double> area(count, INFINITY);
+    typedef std::pair<double, size_t> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+    for (size_t i = 0; i < count; i++) {
+        previous[i] = i - 1;
+        next[i] = i + 1;
+        if (i > 0 && i + 1 < count) {
+            area[i] = triangle_area(points[i - 1], points[i], points[i + 1]);
+            queue.push({area[i], i});
         }
-
-        if (it->distance != FIT_FLOAT32_INVALID && !std::isnan(it->distance)) {
-            enif_make_map_put(env, map, atom_distance, enif_make_double(env, it->distance), &map);
+    }
+    std::fill(keep->begin(), keep->end(), true);
+
+    while (!queue.empty() && queue.top().first < min_area) {
+        Entry entry = queue.top();
+        queue.pop();
+        size_t i = entry.second;
+        if (!(*keep)[i] || entry.first != area[i]) {
+            continue;  // Removed already, or queued again with a newer area
+        }
+
+        (*keep)[i] = false;
+        next[previous[i]] = next[i];
+        previous[next[i]] = previous[i];
+        for (size_t neighbour : {previous[i], next[i]}) {
+            if (neighbour == 0 || neighbour + 1 == count) {
+                continue;
+            }
+            area[neighbour] = std::max(entry.first, triangle_area(points[previous[neighbour]], points[neighbour],
+                                                                  points[next[neighbour]]));
+            queue.push({area[neighbour], neighbour});
         }
+    }
+}
 
-        if (it->heart_rate != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_heart_rate, enif_make_int(env, it->heart_rate), &map);
-        }
+// Appends a value to a Google encoded polyline.
+static void append_polyline_value(int64_t value, std::string* polyline) {
+    uint64_t bits = value < 0 ? ~((uint64_t)value << 1) : (uint64_t)value << 1;
+    while (bits >= 0x20) {
+        polyline->push_back((char)((0x20 | (bits & 0x1F)) + 63));
+        bits >>= 5;
+    }
+    polyline->push_back((char)(bits + 63));
+}
 
-        // Position & Navigation
-        if (it->position_lat != FIT_SINT32_INVALID) {
-            enif_make_map_put(env, map, atom_position_lat, enif_make_int(env, it->position_lat), &map);
-        }
+// How downsample_records picks the records to keep.
+enum DownsampleMethod {
+    DOWNSAMPLE_LTTB,    // Largest-Triangle-Three-Buckets
+    DOWNSAMPLE_MINMAX   // The minimum and maximum of each field per bucket
+};
 
-        if (it->position_long != FIT_SINT32_INVALID) {
-            enif_make_map_put(env, map, atom_position_long, enif_make_int(env, it->position_long), &map);
+// Picks at most max_points of the records carrying any of fields, to chart the fields
+// against time on a shared axis. Returns their indices in time order, all of them if
+// there are no more than max_points.
+static std::vector<size_t> downsample_records(const RecordColumns& records, const std::vector<FIT_UINT8>& fields,
+                                              size_t max_points, DownsampleMethod method) {
+    std::vector<size_t> candidates;
+    double value;
+    for (size_t record = 0; record < records.size(); record++) {
+        for (FIT_UINT8 index : fields) {
+            if (records.GetValue(index, record, &value)) {
+                candidates.push_back(record);
+                break;
+            }
         }
+    }
+    auto earlier = [&records](size_t a, size_t b) { return records.Timestamp(a) < records.Timestamp(b); };
+    if (!std::is_sorted(candidates.begin(), candidates.end(), earlier)) {
+        std::stable_sort(candidates.begin(), candidates.end(), earlier);
+    }
 
-        if (it->enhanced_altitude != FIT_FLOAT32_INVALID && !std::isnan(it->enhanced_altitude)) {
-            enif_make_map_put(env, map, atom_enhanced_altitude, enif_make_double(env, it->enhanced_altitude), &map);
-        }
+    size_t count = candidates.size();
+    if (count <= max_points) {
+        return candidates;
+    }
 
-        if (it->speed != FIT_FLOAT32_INVALID && !std::isnan(it->speed)) {
-            enif_make_map_put(env, map, atom_speed, enif_make_double(env, it->speed), &map);
+    // Each field's values, NaN where a record lacks it
+    std::vector<std::vector<double>> series(fields.size(), std::vector<double>(count));
+    for (size_t f = 0; f < fields.size(); f++) {
+        for (size_t k = 0; k < count; k++) {
+            series[f][k] = records.GetValue(fields[f], candidates[k], &value) ? value : NAN;
         }
+    }
 
-        if (it->enhanced_speed != FIT_FLOAT32_INVALID && !std::isnan(it->enhanced_speed)) {
-            enif_make_map_put(env, map, atom_enhanced_speed, enif_make_double(env, it->enhanced_speed), &map);
-        }
+    std::vector<size_t> picked;
+    if (method == DOWNSAMPLE_MINMAX) {
+        // Every bucket keeps up to two records per field. With fewer than two points per
+        // field there is a single bucket, and the earliest listed fields' extremes win.
+        size_t buckets = std::max<size_t>(max_points / (2 * fields.size()), 1);
+        std::vector<size_t> bucket_picks;
+        for (size_t bucket = 0; bucket < buckets; bucket++) {
+            size_t start = bucket * count / buckets;
+            size_t end = (bucket + 1) * count / buckets;
+            bucket_picks.clear();
+            for (const std::vector<double>& values : series) {
+                size_t low = end;
+                size_t high = end;
+                for (size_t k = start; k < end; k++) {
+                    if (std::isnan(values[k])) {
+                        continue;
+                    }
+                    if (low == end || values[k] < values[low]) {
+                        low = k;
+                    }
+                    if (high == end || values[k] > values[high]) {
+                        high = k;
+                    }
+                }
+                for (size_t k : {low, high}) {
+                    if (k != end && std::find(bucket_picks.begin(), bucket_picks.end(), k) == bucket_picks.end()) {
+                        bucket_picks.push_back(k);
+                    }
+                }
+            }
+            if (bucket_picks.size() > max_points - picked.size()) {
+                bucket_picks.resize(max_points - picked.size());
+            }
+            std::sort(bucket_picks.begin(), bucket_picks.end());
+            picked.insert(picked.end(), bucket_picks.begin(), bucket_picks.end());
+        }
+    } else if (max_points < 3) {
+        picked.push_back(0);
+        if (max_points == 2) {
+            picked.push_back(count - 1);
+        }
+    } else {
+        // A field holds its last value where a record lacks it, or its first value before
+        // that, and its triangle areas are weighed by its range
+        std::vector<double> weights(fields.size(), 0.0);
+        for (size_t f = 0; f < fields.size(); f++) {
+            std::vector<double>& values = series[f];
+            auto first = std::find_if(values.begin(), values.end(), [](double v) { return !std::isnan(v); });
+            double held = first != values.end() ? *first : 0.0;
+            double low = held;
+            double high = held;
+            for (double& v : values) {
+                if (std::isnan(v)) {
+                    v = held;
+                } else {
+                    held = v;
+                    low = std::min(low, v);
+                    high = std::max(high, v);
+                }
+            }
+            weights[f] = high > low ? 1.0 / (high - low) : 0.0;
+        }
+
+        // The first and last records stay, and the others split into max_points - 2 buckets.
+        // Each bucket keeps the record forming the largest triangle with the record kept
+        // before it and the average of the next bucket.
+        double bucket_size = (double)(count - 2) / (max_points - 2);
+        std::vector<double> next_y(fields.size());
+        size_t kept = 0;
+        picked.push_back(0);
+        for (size_t bucket = 0; bucket < max_points - 2; bucket++) {
+            size_t start = (size_t)(bucket * bucket_size) + 1;
+            size_t end = (size_t)((bucket + 1) * bucket_size) + 1;
+            size_t next_end = std::min((size_t)((bucket + 2) * bucket_size) + 1, count);
+            if (bucket + 1 == max_points - 2) {
+                end = count - 1;
+                next_end = count;
+            }
+
+            double next_x = 0.0;
+            std::fill(next_y.begin(), next_y.end(), 0.0);
+            for (size_t k = end; k < next_end; k++) {
+                next_x += records.Timestamp(candidates[k]);
+                for (size_t f = 0; f < fields.size(); f++) {
+                    next_y[f] += series[f][k];
+                }
+            }
+            next_x /= (double)(next_end - end);
+            for (double& y : next_y) {
+                y /= (double)(next_end - end);
+            }
+
+            double kept_x = records.Timestamp(candidates[kept]);
+            double largest = -1.0;
+            size_t best = start;
+            for (size_t k = start; k < end; k++) {
+                double x = records.Timestamp(candidates[k]);
+                double area = 0.0;
+                for (size_t f = 0; f < fields.size(); f++) {
+                    const std::vector<double>& values = series[f];
+                    area += weights[f] * std::fabs((kept_x - next_x) * (values[k] - values[kept]) -
+                                                   (kept_x - x) * (next_y[f] - values[kept]));
+                }
+                if (area > largest) {
+                    largest = area;
+                    best = k;
+                }
+            }
+            picked.push_back(best);
+            kept = best;
+        }
+        picked.push_back(count - 1);
+    }
 
-        if (it->grade != FIT_FLOAT32_INVALID && !std::isnan(it->grade)) {
-            enif_make_map_put(env, map, atom_grade, enif_make_double(env, it->grade), &map);
-        }
+    for (size_t& k : picked) {
+        k = candidates[k];
+    }
+    return picked;
+}
 
-        if (it->vertical_speed != FIT_FLOAT32_INVALID && !std::isnan(it->vertical_speed)) {
-            enif_make_map_put(env, map, atom_vertical_speed, enif_make_double(env, it->vertical_speed), &map);
-        }
+// How elevation_profile smooths altitude before measuring it.
+struct ElevationSettings {
+    enum { SMOOTH_NONE, SMOOTH_MEDIAN, SMOOTH_EXPONENTIAL } smoothing;
+    size_t window;         // Samples in the median window, odd
+    double time_constant;  // Of the exponential smoothing, in seconds
+    double threshold;      // Meters the altitude must move to count as a change of direction
+    double min_climb;      // Meters a climb must gain to be listed
+};
 
-        if (it->gps_accuracy != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_gps_accuracy, enif_make_int(env, it->gps_accuracy), &map);
-        }
+// A climb, from the low point before it to the high point it reaches.
+struct Climb {
+    unsigned int start_time;
+    unsigned int end_time;
+    double gain;
+    double distance;  // NaN without distances at both ends, or if distance was reset
+};
 
-        // Power & Performance
-        if (it->power != FIT_UINT16_INVALID) {
-            enif_make_map_put(env, map, atom_power, enif_make_int(env, it->power), &map);
-        }
+// Elevation totals of an activity in meters, NaN without altitude.
+struct ElevationProfile {
+    double gain;
+    double loss;
+    double max;
+    double min;
+    std::vector<Climb> climbs;
+
+    ElevationProfile(const RecordColumns& records, const ElevationSettings& settings)
+        : gain(NAN), loss(NAN), max(NAN), min(NAN) {
+        std::vector<TimedValue> altitude = AltitudeSamples(records);
+        if (altitude.empty()) {
+            return;
+        }
+
+        Smooth(settings, &altitude);
+        gain = 0.0;
+        loss = 0.0;
+        max = min = altitude[0].value;
+        for (const TimedValue& sample : altitude) {
+            max = std::max(max, sample.value);
+            min = std::min(min, sample.value);
+        }
+        Measure(altitude, settings);
+    }
 
-        if (it->accumulated_power != FIT_UINT32_INVALID) {
-            enif_make_map_put(env, map, atom_accumulated_power, enif_make_uint(env, it->accumulated_power), &map);
-        }
+private:
+    std::vector<double> distances;  // By sample, NaN where its record has none
+
+    // enhanced_altitude, or altitude for records without it, in time order. The distance
+    // of each sample's record goes to distances.
+    std::vector<TimedValue> AltitudeSamples(const RecordColumns& records) {
+        FIT_UINT8 enhanced = record_field_index[fit::RecordMesg::FieldDefNum::EnhancedAltitude];
+        FIT_UINT8 plain = record_field_index[fit::RecordMesg::FieldDefNum::Altitude];
+        FIT_UINT8 distance = record_field_index[fit::RecordMesg::FieldDefNum::Distance];
+        std::vector<std::pair<TimedValue, double>> samples;
+        double value, meters;
+        for (size_t record = 0; record < records.size(); record++) {
+            if (records.GetValue(enhanced, record, &value) || records.GetValue(plain, record, &value)) {
+                bool has_distance = records.GetValue(distance, record, &meters);
+                samples.push_back({{records.Timestamp(record), value}, has_distance ? meters : NAN});
+            }
+        }
+
+        auto earlier = [](const std::pair<TimedValue, double>& a, const std::pair<TimedValue, double>& b) {
+            return a.first.time < b.first.time;
+        };
+        if (!std::is_sorted(samples.begin(), samples.end(), earlier)) {
+            std::stable_sort(samples.begin(), samples.end(), earlier);
+        }
+
+        std::vector<TimedValue> altitude;
+        for (size_t i = 0; i < samples.size(); i++) {
+            if (i > 0 && samples[i].first.time == samples[i - 1].first.time) {
+                continue;  // The earlier record stands, as in time_ordered_samples
+            }
+            altitude.push_back(samples[i].first);
+            distances.push_back(samples[i].second);
+        }
+        return altitude;
+    }
 
-        if (it->motor_power != FIT_UINT16_INVALID) {
-            enif_make_map_put(env, map, atom_motor_power, enif_make_int(env, it->motor_power), &map);
+    static void Smooth(const ElevationSettings& settings, std::vector<TimedValue>* altitude) {
+        std::vector<TimedValue>& samples = *altitude;
+        if (settings.smoothing == ElevationSettings::SMOOTH_MEDIAN) {
+            // A centred window, narrowing at the ends
+            std::vector<double> raw(samples.size());
+            for (size_t i = 0; i < samples.size(); i++) {
+                raw[i] = samples[i].value;
+            }
+            std::vector<double> window;
+            size_t half = settings.window / 2;
+            for (size_t i = 0; i < samples.size(); i++) {
+                size_t reach = std::min(half, std::min(i, samples.size() - 1 - i));
+                window.assign(raw.begin() + (i - reach), raw.begin() + (i + reach + 1));
+                std::nth_element(window.begin(), window.begin() + reach, window.end());
+                samples[i].value = window[reach];
+            }
+        } else if (settings.smoothing == ElevationSettings::SMOOTH_EXPONENTIAL) {
+            // Weighted by the time since the previous sample, so gaps catch up at once
+            double smoothed = samples[0].value;
+            for (size_t i = 1; i < samples.size(); i++) {
+                double elapsed = samples[i].time - samples[i - 1].time;
+                double alpha = 1.0 - std::exp(-elapsed / settings.time_constant);
+                smoothed += alpha * (samples[i].value - smoothed);
+                samples[i].value = smoothed;
+            }
         }
+    }
 
-        if (it->left_torque_effectiveness != FIT_FLOAT32_INVALID && !std::isnan(it->left_torque_effectiveness)) {
-            enif_make_map_put(env, map, atom_left_torque_effectiveness, enif_make_double(env, it->left_torque_effectiveness), &map);
+    // Counts a rise or fall once the altitude turns back by threshold from its furthest
+    // point, so noise smaller than threshold is never counted.
+    void Measure(const std::vector<TimedValue>& altitude, const ElevationSettings& settings) {
+        int direction = 0;   // 1 climbing, -1 descending, 0 not yet known
+        size_t anchor = 0;   // The last turning point
+        size_t extreme = 0;  // The furthest point since it
+        size_t low = 0;      // Lowest and highest points before a direction is known
+        size_t high = 0;
+        for (size_t i = 1; i < altitude.size(); i++) {
+            double value = altitude[i].value;
+            if (direction == 0) {
+                if (value <= altitude[low].value) {
+                    low = i;
+                }
+                if (value >= altitude[high].value) {
+                    high = i;
+                }
+                if (value - altitude[low].value >= settings.threshold) {
+                    direction = 1;
+                    anchor = low;
+                    extreme = i;
+                } else if (altitude[high].value - value >= settings.threshold) {
+                    direction = -1;
+                    anchor = high;
+                    extreme = i;
+                }
+            } else if ((value - altitude[extreme].value) * direction > 0.0 ||
+                       (direction < 0 && value == altitude[extreme].value)) {
+                extreme = i;  // A climb starts from the last of equally low points
+            } else if ((altitude[extreme].value - value) * direction >= settings.threshold) {
+                AddRun(altitude, anchor, extreme, direction, settings);
+                direction = -direction;
+                anchor = extreme;
+                extreme = i;
+            }
+        }
+        if (direction != 0) {
+            AddRun(altitude, anchor, extreme, direction, settings);
         }
+    }
 
-        if (it->right_torque_effectiveness != FIT_FLOAT32_INVALID && !std::isnan(it->right_torque_effectiveness)) {
-            enif_make_map_put(env, map, atom_right_torque_effectiveness, enif_make_double(env, it->right_torque_effectiveness), &map);
+    void AddRun(const std::vector<TimedValue>& altitude, size_t from, size_t to, int direction,
+                const ElevationSettings& settings) {
+        double change = altitude[to].value - altitude[from].value;
+        if (direction < 0) {
+            loss -= change;
+            return;
         }
 
-        if (it->left_pedal_smoothness != FIT_FLOAT32_INVALID && !std::isnan(it->left_pedal_smoothness)) {
-            enif_make_map_put(env, map, atom_left_pedal_smoothness, enif_make_double(env, it->left_pedal_smoothness), &map);
+        gain += change;
+        if (change >= settings.min_climb) {
+            double distance = distances[to] - distances[from];
+            if (distance < 0.0) {
+                distance = NAN;  // The distance was reset on the way, as between chained files
+            }
+            climbs.push_back({altitude[from].time, altitude[to].time, change, distance});
         }
+    }
+};
 
-        if (it->right_pedal_smoothness != FIT_FLOAT32_INVALID && !std::isnan(it->right_pedal_smoothness)) {
-            enif_make_map_put(env, map, atom_right_pedal_smoothness, enif_make_double(env, it->right_pedal_smoothness), &map);
-        }
+// The scaled value of a message field, or NaN if it is absent or invalid.
+static double mesg_value(const fit::Mesg& mesg, FIT_UINT8 num) {
+    const fit::Field* field = mesg.GetField(num);
+    if (field == FIT_NULL || !field->IsValueValid()) {
+        return NAN;
+    }
+    return field->GetFLOAT64Value(0, FIT_SUBFIELD_INDEX_MAIN_FIELD);
+}
 
-        if (it->combined_pedal_smoothness != FIT_FLOAT32_INVALID && !std::isnan(it->combined_pedal_smoothness)) {
-            enif_make_map_put(env, map, atom_combined_pedal_smoothness, enif_make_double(env, it->combined_pedal_smoothness), &map);
-        }
+// The elevation fields of a session message, NaN where absent.
+struct DeviceSessionElevation {
+    double total_ascent;
+    double total_descent;
+    double max_altitude;
+    double min_altitude;
 
-        // Cadence & Cycling
-        if (it->cadence != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_cadence, enif_make_int(env, it->cadence), &map);
+    explicit DeviceSessionElevation(const fit::Mesg& mesg) {
+        total_ascent = mesg_value(mesg, fit::SessionMesg::FieldDefNum::TotalAscent);
+        total_descent = mesg_value(mesg, fit::SessionMesg::FieldDefNum::TotalDescent);
+        max_altitude = mesg_value(mesg, fit::SessionMesg::FieldDefNum::EnhancedMaxAltitude);
+        if (std::isnan(max_altitude)) {
+            max_altitude = mesg_value(mesg, fit::SessionMesg::FieldDefNum::MaxAltitude);
         }
-
-        if (it->cadence256 != FIT_FLOAT32_INVALID && !std::isnan(it->cadence256)) {
-            enif_make_map_put(env, map, atom_cadence256, enif_make_double(env, it->cadence256), &map);
+        min_altitude = mesg_value(mesg, fit::SessionMesg::FieldDefNum::EnhancedMinAltitude);
+        if (std::isnan(min_altitude)) {
+            min_altitude = mesg_value(mesg, fit::SessionMesg::FieldDefNum::MinAltitude);
         }
+    }
+};
 
-        if (it->fractional_cadence != FIT_FLOAT32_INVALID && !std::isnan(it->fractional_cadence)) {
-            enif_make_map_put(env, map, atom_fractional_cadence, enif_make_double(env, it->fractional_cadence), &map);
-        }
+// A climb_pro message, a device's ClimbPro event for a climb on the course, NaN where a
+// field is absent.
+struct DeviceClimbPro {
+    double timestamp;  // Unix
+    double event;
+    double climb_number;
+    double climb_category;
+    double current_dist;
+
+    explicit DeviceClimbPro(const fit::Mesg& mesg) {
+        timestamp = mesg_value(mesg, fit::ClimbProMesg::FieldDefNum::Timestamp) + 631065600;
+        event = mesg_value(mesg, fit::ClimbProMesg::FieldDefNum::ClimbProEvent);
+        climb_number = mesg_value(mesg, fit::ClimbProMesg::FieldDefNum::ClimbNumber);
+        climb_category = mesg_value(mesg, fit::ClimbProMesg::FieldDefNum::ClimbCategory);
+        current_dist = mesg_value(mesg, fit::ClimbProMesg::FieldDefNum::CurrentDist);
+    }
+};
 
-        if (it->left_right_balance != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_left_right_balance, enif_make_int(env, it->left_right_balance), &map);
+// The fastest time in whole seconds over each of distances meters, from time-ordered
+// (time, distance) samples, or NaN where no stretch is that long. A stretch never spans a
+// drop in distance, where the device restarted counting.
+static std::vector<double> fastest_times(const std::vector<TimedValue>& distance, const std::vector<double>& targets) {
+    std::vector<double> fastest(targets.size(), NAN);
+    for (size_t k = 0; k < targets.size(); k++) {
+        size_t start = 0;
+        for (size_t end = 1; end < distance.size(); end++) {
+            if (distance[end].value < distance[end - 1].value) {
+                start = end;
+                continue;
+            }
+            // The latest start still at least the target away
+            while (start + 1 < end && distance[end].value - distance[start + 1].value >= targets[k]) {
+                start++;
+            }
+            if (distance[end].value - distance[start].value >= targets[k]) {
+                double seconds = distance[end].time - distance[start].time;
+                if (!(seconds >= fastest[k])) {
+                    fastest[k] = seconds;
+                }
+            }
         }
+    }
+    return fastest;
+}
 
-        if (it->cycle_length != FIT_FLOAT32_INVALID && !std::isnan(it->cycle_length)) {
-            enif_make_map_put(env, map, atom_cycle_length, enif_make_double(env, it->cycle_length), &map);
-        }
+// What the aggregate of a group of activities holds, alongside its scalar metrics.
+enum AggregateSeries {
+    AGGREGATE_BEST_POWER,            // Best mean power over each duration
+    AGGREGATE_FASTEST,               // Fastest time over each distance
+    AGGREGATE_HEART_RATE_HISTOGRAM,  // Seconds in each heart rate bin
+    AGGREGATE_POWER_HISTOGRAM,       // Seconds in each power bin
+    AGGREGATE_SERIES_COUNT
+};
 
-        if (it->cycle_length16 != FIT_FLOAT32_INVALID && !std::isnan(it->cycle_length16)) {
-            enif_make_map_put(env, map, atom_cycle_length16, enif_make_double(env, it->cycle_length16), &map);
-        }
+enum AggregateMerge { MERGE_SUM, MERGE_MAX };
 
-        if (it->cycles != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_cycles, enif_make_int(env, it->cycles), &map);
-        }
+// The scalar metrics aggregate_files computes, and how two groups' values combine.
+struct AggregateMetric {
+    const char* name;
+    AggregateMerge merge;
+};
 
-        if (it->total_cycles != FIT_UINT32_INVALID) {
-            enif_make_map_put(env, map, atom_total_cycles, enif_make_uint(env, it->total_cycles), &map);
-        }
+static const AggregateMetric aggregate_metrics[] = {
+    {"count", MERGE_SUM},
+    {"distance", MERGE_SUM},
+    {"elapsed_time", MERGE_SUM},
+    {"timer_time", MERGE_SUM},
+    {"moving_time", MERGE_SUM},
+    {"ascent", MERGE_SUM},
+    {"descent", MERGE_SUM},
+    {"max_speed", MERGE_MAX},
+    {"max_heart_rate", MERGE_MAX},
+    {"max_power", MERGE_MAX},
+    {"longest_distance", MERGE_MAX},
+    {"longest_time", MERGE_MAX},
+};
 
-        // Running Dynamics
-        if (it->vertical_oscillation != FIT_FLOAT32_INVALID && !std::isnan(it->vertical_oscillation)) {
-            enif_make_map_put(env, map, atom_vertical_oscillation, enif_make_double(env, it->vertical_oscillation), &map);
-        }
+enum {
+    METRIC_COUNT, METRIC_DISTANCE, METRIC_ELAPSED_TIME, METRIC_TIMER_TIME, METRIC_MOVING_TIME,
+    METRIC_ASCENT, METRIC_DESCENT, METRIC_MAX_SPEED, METRIC_MAX_HEART_RATE, METRIC_MAX_POWER,
+    METRIC_LONGEST_DISTANCE, METRIC_LONGEST_TIME, AGGREGATE_METRIC_COUNT
+};
 
-        if (it->stance_time != FIT_FLOAT32_INVALID && !std::isnan(it->stance_time)) {
-            enif_make_map_put(env, map, atom_stance_time, enif_make_double(env, it->stance_time), &map);
-        }
+static const char* const aggregate_series_names[AGGREGATE_SERIES_COUNT] = {
+    "best_power", "fastest", "heart_rate_histogram", "power_histogram"};
 
-        if (it->stance_time_percent != FIT_FLOAT32_INVALID && !std::isnan(it->stance_time_percent)) {
-            enif_make_map_put(env, map, atom_stance_time_percent, enif_make_double(env, it->stance_time_percent), &map);
-        }
+// Sums, maxima and histograms over one or more activities. Each part merges with the same
+// part of another aggregate, so per-file aggregates fold into per-thread groups and those
+// into the result in any order. NaN marks a metric no activity had.
+struct Aggregate {
+    double metrics[AGGREGATE_METRIC_COUNT];
+    std::vector<double> best_power;  // By duration
+    std::vector<double> fastest;     // By distance, in seconds
+    std::map<int64_t, double> histograms[2];  // Heart rate and power, seconds by bin index
 
-        if (it->stance_time_balance != FIT_FLOAT32_INVALID && !std::isnan(it->stance_time_balance)) {
-            enif_make_map_put(env, map, atom_stance_time_balance, enif_make_double(env, it->stance_time_balance), &map);
-        }
+    Aggregate() {
+        std::fill(metrics, metrics + AGGREGATE_METRIC_COUNT, NAN);
+    }
 
-        if (it->step_length != FIT_FLOAT32_INVALID && !std::isnan(it->step_length)) {
-            enif_make_map_put(env, map, atom_step_length, enif_make_double(env, it->step_length), &map);
+    void Merge(const Aggregate& other) {
+        for (size_t i = 0; i < AGGREGATE_METRIC_COUNT; i++) {
+            double value = other.metrics[i];
+            if (std::isnan(metrics[i])) {
+                metrics[i] = value;
+            } else if (!std::isnan(value)) {
+                metrics[i] = aggregate_metrics[i].merge == MERGE_SUM ? metrics[i] + value : std::max(metrics[i], value);
+            }
         }
 
-        if (it->vertical_ratio != FIT_FLOAT32_INVALID && !std::isnan(it->vertical_ratio)) {
-            enif_make_map_put(env, map, atom_vertical_ratio, enif_make_double(env, it->vertical_ratio), &map);
+        MergeBest(other.best_power, &best_power, [](double a, double b) { return a > b; });
+        MergeBest(other.fastest, &fastest, [](double a, double b) { return a < b; });
+        for (size_t i = 0; i < 2; i++) {
+            for (const auto& bin : other.histograms[i]) {
+                histograms[i][bin.first] += bin.second;
+            }
         }
+    }
 
-        // Physiological Data
-        if (it->calories != FIT_UINT16_INVALID) {
-            enif_make_map_put(env, map, atom_calories, enif_make_int(env, it->calories), &map);
+private:
+    template <typename Better>
+    static void MergeBest(const std::vector<double>& from, std::vector<double>* to, Better better) {
+        if (to->empty()) {
+            *to = from;
+            return;
         }
-
-        if (it->temperature != FIT_SINT8_INVALID) {
-            enif_make_map_put(env, map, atom_temperature, enif_make_int(env, it->temperature), &map);
+        for (size_t i = 0; i < from.size() && i < to->size(); i++) {
+            if (std::isnan((*to)[i]) || better(from[i], (*to)[i])) {
+                (*to)[i] = from[i];
+            }
         }
+    }
+};
 
-        if (it->core_temperature != FIT_FLOAT32_INVALID && !std::isnan(it->core_temperature)) {
-            enif_make_map_put(env, map, atom_core_temperature, enif_make_double(env, it->core_temperature), &map);
-        }
+// How aggregate_files groups activities by their start time.
+enum AggregateGroupBy { GROUP_ALL, GROUP_DAY, GROUP_WEEK, GROUP_MONTH, GROUP_YEAR };
+
+// Days since 1970-01-01 of a proleptic Gregorian date, and back, after Howard Hinnant's
+// days_from_civil and civil_from_days.
+static int64_t days_from_civil(int64_t year, unsigned int month, unsigned int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
 
-        if (it->respiration_rate != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_respiration_rate, enif_make_int(env, it->respiration_rate), &map);
-        }
+static void civil_from_days(int64_t days, int64_t* year, unsigned int* month, unsigned int* day) {
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t day_of_era = days - era * 146097;
+    int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int64_t month_index = (5 * day_of_year + 2) / 153;  // From March
+    *day = (unsigned int)(day_of_year - (153 * month_index + 2) / 5 + 1);
+    *month = (unsigned int)(month_index < 10 ? month_index + 3 : month_index - 9);
+    *year = year_of_era + era * 400 + (*month <= 2);
+}
 
-        if (it->enhanced_respiration_rate != FIT_FLOAT32_INVALID && !std::isnan(it->enhanced_respiration_rate)) {
-            enif_make_map_put(env, map, atom_enhanced_respiration_rate, enif_make_double(env, it->enhanced_respiration_rate), &map);
-        }
+// The first day, as days since 1970-01-01, of the day, Monday-based week, month or year
+// holding a Unix timestamp, in the time zone utc_offset seconds from UTC. 0 for GROUP_ALL.
+static int64_t group_start_day(unsigned int timestamp, int64_t utc_offset, AggregateGroupBy group_by) {
+    int64_t seconds = (int64_t)timestamp + utc_offset;
+    int64_t days = seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400;
+    int64_t year;
+    unsigned int month, day;
+    switch (group_by) {
+        case GROUP_DAY:
+            return days;
+        case GROUP_WEEK:
+            return days - ((days % 7 + 7 + 3) % 7);  // 1970-01-01 was a Thursday
+        case GROUP_MONTH:
+            civil_from_days(days, &year, &month, &day);
+            return days - (day - 1);
+        case GROUP_YEAR:
+            civil_from_days(days, &year, &month, &day);
+            return days_from_civil(year, 1, 1);
+        default:
+            return 0;
+    }
+}
 
-        if (it->current_stress != FIT_FLOAT32_INVALID && !std::isnan(it->current_stress)) {
-            enif_make_map_put(env, map, atom_current_stress, enif_make_double(env, it->current_stress), &map);
-        }
+// The listener class that processes messages from the FIT file.
+class Listener : public fit::MesgListener, public fit::MesgDefinitionListener {
+public:
+    RecordColumns records;
+    RecordSchema schema;
+    ActivitySummary summary;
+    SessionTracker* session_tracker;  // Optional, fed every record timestamp
+    MotionTracker* motion_tracker;    // Optional, fed timer events and every record
+    size_t data_size;                 // Bytes being decoded, used to presize the columns
+    std::vector<DeviceTimeInZone> time_in_zones;  // The device's own, in file order
+    std::vector<DeviceSessionElevation> session_elevations;
+    std::vector<DeviceClimbPro> climb_pro;
+
+    // With keep_records false only the summary is built and no records are stored.
+    explicit Listener(bool keep_records = true)
+        : schema(), summary(), session_tracker(nullptr), motion_tracker(nullptr), data_size(0), keep_records(keep_records), smallest_record_size(0) {
+        summary.total_distance = -1.0;
+        // Compressed timestamp headers add a timestamp no definition declares
+        schema.Add(fit::RecordMesg::FieldDefNum::Timestamp);
+    }
 
-        // Blood/Oxygen Data
-        if (it->total_hemoglobin_conc != FIT_FLOAT32_INVALID && !std::isnan(it->total_hemoglobin_conc)) {
-            enif_make_map_put(env, map, atom_total_hemoglobin_conc, enif_make_double(env, it->total_hemoglobin_conc), &map);
+    void OnMesgDefinition(fit::MesgDefinition& mesgDef) override {
+        if (mesgDef.GetNum() != FIT_MESG_NUM_RECORD) {
+            return;
         }
 
-        if (it->total_hemoglobin_conc_min != FIT_FLOAT32_INVALID && !std::isnan(it->total_hemoglobin_conc_min)) {
-            enif_make_map_put(env, map, atom_total_hemoglobin_conc_min, enif_make_double(env, it->total_hemoglobin_conc_min), &map);
+        size_t record_size = 1;  // Record header
+        for (const fit::FieldDefinition& fieldDef : mesgDef.GetFields()) {
+            schema.Add(fieldDef.GetNum());
+            record_size += fieldDef.GetSize();
         }
-
-        if (it->total_hemoglobin_conc_max != FIT_FLOAT32_INVALID && !std::isnan(it->total_hemoglobin_conc_max)) {
-            enif_make_map_put(env, map, atom_total_hemoglobin_conc_max, enif_make_double(env, it->total_hemoglobin_conc_max), &map);
+        for (const fit::DeveloperFieldDefinition& devFieldDef : mesgDef.GetDevFields()) {
+            record_size += devFieldDef.GetSize();
         }
 
-        if (it->saturated_hemoglobin_percent != FIT_FLOAT32_INVALID && !std::isnan(it->saturated_hemoglobin_percent)) {
-            enif_make_map_put(env, map, atom_saturated_hemoglobin_percent, enif_make_double(env, it->saturated_hemoglobin_percent), &map);
+        if (!keep_records) {
+            return;
         }
 
-        if (it->saturated_hemoglobin_percent_min != FIT_FLOAT32_INVALID && !std::isnan(it->saturated_hemoglobin_percent_min)) {
-            enif_make_map_put(env, map, atom_saturated_hemoglobin_percent_min, enif_make_double(env, it->saturated_hemoglobin_percent_min), &map);
+        // Give every field the schema now holds a column before its first record arrives
+        for (size_t i = 0; i < RECORD_FIELD_COUNT; i++) {
+            if (schema.Has(record_fields[i].num)) {
+                records.AddColumn((FIT_UINT8)i);
+            }
         }
 
-        if (it->saturated_hemoglobin_percent_max != FIT_FLOAT32_INVALID && !std::isnan(it->saturated_hemoglobin_percent_max)) {
-            enif_make_map_put(env, map, atom_saturated_hemoglobin_percent_max, enif_make_double(env, it->saturated_hemoglobin_percent_max), &map);
+        // No more records than this fit in the file, so the columns only regrow when a
+        // smaller record definition raises the bound. It counts every byte as record data,
+        // so files mostly holding other messages over-reserve until ShrinkToFit.
+        if (smallest_record_size == 0 || record_size < smallest_record_size) {
+            records.Reserve(data_size / record_size);
+            smallest_record_size = record_size;
         }
+    }
 
-        // E-bike Specific
-        if (it->battery_soc != FIT_FLOAT32_INVALID && !std::isnan(it->battery_soc)) {
-            enif_make_map_put(env, map, atom_battery_soc, enif_make_double(env, it->battery_soc), &map);
+    // This method is called for every message in the file.
+    void OnMesg(fit::Mesg& mesg) override {
+        // Check if this is a Record message (message number 20)
+        if (mesg.GetNum() == FIT_MESG_NUM_RECORD) {
+            if (!Summarize(mesg)) {
+                return;
+            }
+
+            if (keep_records) {
+                ProcessRecordMessage(mesg);
+            }
+        } else if (mesg.GetNum() == FIT_MESG_NUM_TIME_IN_ZONE) {
+            time_in_zones.push_back(DeviceTimeInZone(mesg));
+        } else if (mesg.GetNum() == FIT_MESG_NUM_SESSION) {
+            session_elevations.push_back(DeviceSessionElevation(mesg));
+        } else if (mesg.GetNum() == FIT_MESG_NUM_CLIMB_PRO) {
+            climb_pro.push_back(DeviceClimbPro(mesg));
+        } else if (mesg.GetNum() == FIT_MESG_NUM_EVENT && motion_tracker != nullptr) {
+            AddTimerEvent(mesg);
         }
+    }
 
-        if (it->ebike_travel_range != FIT_UINT16_INVALID) {
-            enif_make_map_put(env, map, atom_ebike_travel_range, enif_make_int(env, it->ebike_travel_range), &map);
-        }
+private:
+    bool keep_records;
+    size_t smallest_record_size;  // Of the record definitions seen so far, 0 before the first
 
-        if (it->ebike_battery_level != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_ebike_battery_level, enif_make_int(env, it->ebike_battery_level), &map);
+    // Returns the scaled value of a record field, or false if it is absent or invalid.
+    static bool get_record_value(const fit::Mesg& mesg, FIT_UINT8 num, double* value) {
+        const fit::Field* field = mesg.GetField(num);
+        if (field == FIT_NULL || !field->IsValueValid()) {
+            return false;
         }
 
-        if (it->ebike_assist_mode != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_ebike_assist_mode, enif_make_int(env, it->ebike_assist_mode), &map);
-        }
+        *value = field->GetFLOAT64Value(0, FIT_SUBFIELD_INDEX_MAIN_FIELD);
+        return !std::isnan(*value);
+    }
 
-        if (it->ebike_assist_level_percent != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_ebike_assist_level_percent, enif_make_int(env, it->ebike_assist_level_percent), &map);
+    // Passes a timer event on to the motion tracker; other events are ignored.
+    void AddTimerEvent(const fit::Mesg& mesg) {
+        const fit::Field* timestamp = mesg.GetField(fit::EventMesg::FieldDefNum::Timestamp);
+        const fit::Field* event = mesg.GetField(fit::EventMesg::FieldDefNum::Event);
+        const fit::Field* type = mesg.GetField(fit::EventMesg::FieldDefNum::EventType);
+        if (timestamp == FIT_NULL || !timestamp->IsValueValid() || event == FIT_NULL ||
+            event->GetENUMValue() != FIT_EVENT_TIMER || type == FIT_NULL || !type->IsValueValid()) {
+            return;
         }
+        motion_tracker->AddTimerEvent(timestamp->GetUINT32Value() + 631065600, type->GetENUMValue());
+    }
 
-        // Swimming/Water Sports
-        if (it->stroke_type != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_stroke_type, enif_make_int(env, it->stroke_type), &map);
+    // Folds one record into the summary. Records without a timestamp are skipped,
+    // exactly as ProcessRecordMessage drops them.
+    bool Summarize(const fit::Mesg& mesg) {
+        const fit::Field* timestamp_field = mesg.GetField(fit::RecordMesg::FieldDefNum::Timestamp);
+        if (timestamp_field == FIT_NULL || !timestamp_field->IsValueValid()) {
+            return false;
         }
 
-        if (it->resistance != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_resistance, enif_make_int(env, it->resistance), &map);
-        }
+        unsigned int timestamp = timestamp_field->GetUINT32Value() + 631065600; // Convert to Unix timestamp
+        double value;
 
-        if (it->ball_speed != FIT_FLOAT32_INVALID && !std::isnan(it->ball_speed)) {
-            enif_make_map_put(env, map, atom_ball_speed, enif_make_double(env, it->ball_speed), &map);
+        if (summary.record_count == 0 || timestamp < summary.start_time) {
+            summary.start_time = timestamp;
         }
-
-        // Diving
-        if (it->depth != FIT_FLOAT32_INVALID && !std::isnan(it->depth)) {
-            enif_make_map_put(env, map, atom_depth, enif_make_double(env, it->depth), &map);
+        if (summary.record_count == 0 || timestamp > summary.end_time) {
+            summary.end_time = timestamp;
         }
+        summary.record_count++;
 
-        if (it->absolute_pressure != FIT_UINT32_INVALID) {
-            enif_make_map_put(env, map, atom_absolute_pressure, enif_make_uint(env, it->absolute_pressure), &map);
+        if (session_tracker != nullptr) {
+            session_tracker->Add(timestamp);
         }
 
-        if (it->next_stop_depth != FIT_FLOAT32_INVALID && !std::isnan(it->next_stop_depth)) {
-            enif_make_map_put(env, map, atom_next_stop_depth, enif_make_double(env, it->next_stop_depth), &map);
+        if (motion_tracker != nullptr) {
+            double speed, distance;
+            if (!get_record_value(mesg, fit::RecordMesg::FieldDefNum::Speed, &speed) &&
+                !get_record_value(mesg, fit::RecordMesg::FieldDefNum::EnhancedSpeed, &speed)) {
+                speed = NAN;
+            }
+            if (!get_record_value(mesg, fit::RecordMesg::FieldDefNum::Distance, &distance)) {
+                distance = NAN;
+            }
+            motion_tracker->AddRecord(timestamp, speed, distance);
         }
 
-        if (it->next_stop_time != FIT_UINT32_INVALID) {
-            enif_make_map_put(env, map, atom_next_stop_time, enif_make_uint(env, it->next_stop_time), &map);
+        if (get_record_value(mesg, fit::RecordMesg::FieldDefNum::Distance, &value) && value >= 0.0 && value > summary.total_distance) {
+            summary.total_distance = value;
         }
 
-        if (it->time_to_surface != FIT_UINT32_INVALID) {
-            enif_make_map_put(env, map, atom_time_to_surface, enif_make_uint(env, it->time_to_surface), &map);
+        if (get_record_value(mesg, fit::RecordMesg::FieldDefNum::HeartRate, &value)) {
+            summary.heart_rate.add(value);
+        }
+        if (get_record_value(mesg, fit::RecordMesg::FieldDefNum::Power, &value)) {
+            summary.power.add(value);
+        }
+        if (get_record_value(mesg, fit::RecordMesg::FieldDefNum::Cadence, &value)) {
+            summary.cadence.add(value);
         }
 
-        if (it->ndl_time != FIT_UINT32_INVALID) {
-            enif_make_map_put(env, map, atom_ndl_time, enif_make_uint(env, it->ndl_time), &map);
+        // Newer devices only write enhanced_speed
+        if (get_record_value(mesg, fit::RecordMesg::FieldDefNum::Speed, &value) ||
+            get_record_value(mesg, fit::RecordMesg::FieldDefNum::EnhancedSpeed, &value)) {
+            summary.speed.add(value);
         }
 
-        if (it->cns_load != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_cns_load, enif_make_int(env, it->cns_load), &map);
+        for (FIT_UINT16 i = 0; i < mesg.GetNumFields(); i++) {
+            const fit::Field* field = mesg.GetFieldByIndex(i);
+            FIT_UINT8 num = field->GetNum();
+            if (field->IsValueValid()) {
+                summary.fields_present[num >> 6] |= (uint64_t)1 << (num & 63);
+            }
         }
 
-        if (it->n2_load != FIT_UINT16_INVALID) {
-            enif_make_map_put(env, map, atom_n2_load, enif_make_int(env, it->n2_load), &map);
+        return true;
+    }
+
+    // Appends the record's fields to the columns. Only the fields the message actually
+    // carries are visited; everything else keeps its invalid sentinel.
+    void ProcessRecordMessage(const fit::Mesg& mesg) {
+        uint32_t values[RECORD_FIELD_COUNT];
+        memcpy(values, invalid_values, sizeof(values));
+
+        // Last to first, so a field repeated in a definition resolves to its first copy as
+        // it does through RecordMesg's getters
+        for (FIT_UINT16 i = mesg.GetNumFields(); i-- > 0;) {
+            const fit::Field* field = mesg.GetFieldByIndex(i);
+            FIT_UINT8 index = record_field_index[field->GetNum()];
+            if (index == RECORD_FIELD_NONE) {
+                continue;
+            }
+
+            values[index] = field->IsValueValid() ? encode_value(record_fields[index], *field) : invalid_values[index];
+            records.AddColumn(index);
         }
 
-        if (it->air_time_remaining != FIT_UINT32_INVALID) {
-            enif_make_map_put(env, map, atom_air_time_remaining, enif_make_uint(env, it->air_time_remaining), &map);
+        // Only keep records with a valid timestamp
+        if (values[0] == FIT_DATE_TIME_INVALID) {
+            return;
         }
 
-        if (it->ascent_rate != FIT_FLOAT32_INVALID && !std::isnan(it->ascent_rate)) {
-            enif_make_map_put(env, map, atom_ascent_rate, enif_make_double(env, it->ascent_rate), &map);
+        values[0] += 631065600; // Convert to Unix timestamp
+        records.Append(values);
+    }
+};
+
+// How one profile field (or subfield) is turned into a map entry. Built once at load.
+struct FieldConverter {
+    ERL_NIF_TERM key;
+    FIT_FLOAT64 scale;
+    FIT_FLOAT64 offset;
+    bool date_time;  // Seconds since the FIT epoch, returned as a Unix timestamp
+};
+
+// Map key and field converters of one profile message.
+struct MesgConverter {
+    ERL_NIF_TERM key;
+    // By profile field index: the main field followed by each of its subfields
+    std::vector<std::vector<FieldConverter>> fields;
+};
+
+// One converter per fit::Profile::mesgs entry, and the global message number of each.
+static std::vector<MesgConverter> mesg_converters;
+static std::map<FIT_UINT16, size_t> mesg_converter_index;
+
+static void init_mesg_converters(ErlNifEnv* env) {
+    mesg_converters.clear();
+    mesg_converter_index.clear();
+
+    for (size_t i = 0; i < fit::Profile::MESGS; i++) {
+        const fit::Profile::MESG& mesg = fit::Profile::mesgs[i];
+        MesgConverter converter;
+        converter.key = enif_make_atom(env, mesg.name.c_str());
+
+        for (FIT_UINT16 j = 0; j < mesg.numFields; j++) {
+            const fit::Profile::FIELD& field = mesg.fields[j];
+            bool date_time = field.profileType == fit::Profile::Type::DateTime ||
+                             field.profileType == fit::Profile::Type::LocalDateTime;
+            std::vector<FieldConverter> options;
+            options.push_back({enif_make_atom(env, field.name.c_str()), field.scale, field.offset, date_time});
+
+            for (FIT_UINT16 k = 0; k < field.numSubFields; k++) {
+                const fit::Profile::SUBFIELD& subfield = field.subFields[k];
+                options.push_back({enif_make_atom(env, subfield.name.c_str()), subfield.scale, subfield.offset, false});
+            }
+            converter.fields.push_back(options);
         }
 
-        if (it->po2 != FIT_FLOAT32_INVALID && !std::isnan(it->po2)) {
-            enif_make_map_put(env, map, atom_po2, enif_make_double(env, it->po2), &map);
+        mesg_converters.push_back(converter);
+        mesg_converter_index[mesg.num] = i;
+    }
+}
+
+// Converts element i of a numeric field. Returns false if it holds the invalid value.
+// Scaled and floating point values become floats, everything else an integer.
+static bool make_field_element(ErlNifEnv* env, const fit::FieldBase& field, const FieldConverter& converter,
+                               FIT_UINT16 subfield, FIT_UINT8 i, ERL_NIF_TERM* term) {
+    FIT_UINT8 type = field.GetType();
+    bool scaled = converter.scale != 1.0 || converter.offset != 0.0;
+
+    // GetFLOAT64Value does not read 64-bit integers
+    if (type == FIT_BASE_TYPE_SINT64 || type == FIT_BASE_TYPE_UINT64 || type == FIT_BASE_TYPE_UINT64Z) {
+        FIT_UINT64 raw = (FIT_UINT64)field.GetSINT64Value(i);
+        if ((type == FIT_BASE_TYPE_SINT64 && raw == (FIT_UINT64)FIT_SINT64_INVALID) ||
+            (type == FIT_BASE_TYPE_UINT64 && raw == FIT_UINT64_INVALID) ||
+            (type == FIT_BASE_TYPE_UINT64Z && raw == FIT_UINT64Z_INVALID)) {
+            return false;
+        }
+
+        if (scaled) {
+            double value = type == FIT_BASE_TYPE_SINT64 ? (double)(FIT_SINT64)raw : (double)raw;
+            *term = enif_make_double(env, value / converter.scale - converter.offset);
+        } else if (type == FIT_BASE_TYPE_SINT64) {
+            *term = enif_make_int64(env, (ErlNifSInt64)raw);
+        } else {
+            *term = enif_make_uint64(env, raw);
         }
+        return true;
+    }
 
-        // Other Fields
-        if (it->activity_type != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_activity_type, enif_make_int(env, it->activity_type), &map);
+    double value = field.GetFLOAT64Value(i, subfield);
+    if (std::isnan(value)) {
+        return false;
+    }
+
+    if (scaled || type == FIT_BASE_TYPE_FLOAT32 || type == FIT_BASE_TYPE_FLOAT64) {
+        *term = enif_make_double(env, value);
+    } else if (converter.date_time) {
+        *term = enif_make_int64(env, (ErlNifSInt64)value + 631065600);  // Convert to Unix timestamp
+    } else if (type == FIT_BASE_TYPE_SINT8 || type == FIT_BASE_TYPE_SINT16 || type == FIT_BASE_TYPE_SINT32) {
+        *term = enif_make_int64(env, (ErlNifSInt64)value);
+    } else {
+        *term = enif_make_uint64(env, (ErlNifUInt64)value);
+    }
+    return true;
+}
+
+static ERL_NIF_TERM make_string(ErlNifEnv* env, const std::string& value) {
+    ERL_NIF_TERM term;
+    unsigned char* data = enif_make_new_binary(env, value.size(), &term);
+    memcpy(data, value.data(), value.size());
+    return term;
+}
+
+// Converts the first count elements of a decoded field to a term: strings and byte
+// arrays become binaries, a single element a number, and arrays a list with nil for
+// invalid elements. Returns false if no element is valid.
+static bool make_field_value(ErlNifEnv* env, const fit::FieldBase& field, const FieldConverter& converter,
+                             FIT_UINT16 subfield, FIT_UINT8 count, ERL_NIF_TERM* term) {
+    FIT_UINT8 type = field.GetType();
+
+    if (type == FIT_BASE_TYPE_BYTE) {
+        ERL_NIF_TERM binary;
+        unsigned char* data = enif_make_new_binary(env, field.GetSize(), &binary);
+        for (FIT_UINT8 i = 0; i < field.GetSize(); i++) {
+            data[i] = field.GetValuesUINT8(i);
+        }
+        *term = binary;
+        return true;
+    }
+
+    ERL_NIF_TERM elements[256];
+    FIT_UINT8 valid = 0;  // One past the last valid element
+    for (FIT_UINT8 i = 0; i < count; i++) {
+        if (type == FIT_BASE_TYPE_STRING) {
+            FIT_WSTRING value = field.GetSTRINGValue(i);
+            if (value == FIT_WSTRING_INVALID) {
+                elements[i] = enif_make_atom(env, "nil");
+            } else {
+                elements[i] = make_string(env, fit::Unicode::Encode_BaseToUTF8(value));
+                valid = i + 1;
+            }
+        } else if (make_field_element(env, field, converter, subfield, i, &elements[i])) {
+            valid = i + 1;
+        } else {
+            elements[i] = enif_make_atom(env, "nil");
         }
+    }
+
+    if (valid == 0) {
+        return false;
+    }
+
+    // The padding after a string reads as empty strings
+    if (type == FIT_BASE_TYPE_STRING) {
+        count = valid;
+    }
+
+    *term = count == 1 ? elements[0] : enif_make_list_from_array(env, elements, count);
+    return true;
+}
+
+// A described developer field of a local message definition, with its map key and
+// units made once per definition.
+struct DevFieldConverter {
+    FIT_UINT8 developer_data_index;
+    FIT_UINT8 num;
+    ERL_NIF_TERM name;  // Binary, as developer field names come from the file
+    ERL_NIF_TERM units;  // Binary, or nil if the description has none
+};
+
+// Converts every message of the selected types to a map as it is decoded. Fields the
+// profile doesn't know, and messages of types it doesn't know, are skipped. Developer
+// fields with a description go under :developer_fields, keyed by their name.
+class MessageCollector : public fit::MesgListener, public fit::MesgDefinitionListener {
+public:
+    std::vector<std::vector<ERL_NIF_TERM>> messages;  // By mesg_converters index
+
+    // wanted holds a flag per mesg_converters entry.
+    MessageCollector(ErlNifEnv* env, const std::vector<bool>& wanted)
+        : messages(mesg_converters.size()), env(env), wanted(wanted) {
+        memset(defined_counts, 0, sizeof(defined_counts));
+    }
 
-        if (it->device_index != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_device_index, enif_make_int(env, it->device_index), &map);
+    void OnMesgDefinition(fit::MesgDefinition& mesgDef) override {
+        FIT_UINT8* counts = defined_counts[mesgDef.GetLocalNum() % FIT_MAX_LOCAL_MESGS];
+        memset(counts, 0, sizeof(defined_counts[0]));
+        for (const fit::FieldDefinition& fieldDef : mesgDef.GetFields()) {
+            FIT_UINT8 base_type = fieldDef.GetType() & FIT_BASE_TYPE_NUM_MASK;
+            if (base_type >= FIT_BASE_TYPES) {
+                continue;  // The decoder ignores the field
+            }
+            counts[fieldDef.GetNum()] = std::max(fieldDef.GetSize() / fit::baseTypeSizes[base_type], 1);
+        }
+
+        std::vector<DevFieldConverter>& dev_fields = dev_field_converters[mesgDef.GetLocalNum() % FIT_MAX_LOCAL_MESGS];
+        dev_fields.clear();
+        for (const fit::DeveloperFieldDefinition& devDef : mesgDef.GetDevFields()) {
+            if (!devDef.IsDefined()) {
+                continue;
+            }
+            const fit::FieldDescriptionMesg& description = devDef.GetDescription();
+            std::string units = fit::Unicode::Encode_BaseToUTF8(description.GetUnits(0));
+            dev_fields.push_back({devDef.GetDeveloperDataIndex(), devDef.GetNum(),
+                                  make_string(env, fit::Unicode::Encode_BaseToUTF8(description.GetFieldName(0))),
+                                  units.empty() ? enif_make_atom(env, "nil") : make_string(env, units)});
         }
+    }
+
+    void OnMesg(fit::Mesg& mesg) override {
+        auto entry = mesg_converter_index.find(mesg.GetNum());
+        if (entry == mesg_converter_index.end() || !wanted[entry->second]) {
+            return;
+        }
+
+        const MesgConverter& converter = mesg_converters[entry->second];
+        const FIT_UINT8* counts = defined_counts[mesg.GetLocalNum() % FIT_MAX_LOCAL_MESGS];
+        std::vector<ERL_NIF_TERM> keys;
+        std::vector<ERL_NIF_TERM> values;
+        keys.reserve(mesg.GetNumFields());
+        values.reserve(mesg.GetNumFields());
+
+        for (FIT_UINT16 i = 0; i < mesg.GetNumFields(); i++) {
+            const fit::Field* field = mesg.GetFieldByIndex(i);
+            FIT_UINT16 index = field->GetIndex();
+            if (index >= converter.fields.size()) {
+                continue;
+            }
+
+            // Fields with subfields are named and scaled by the one the message selects
+            const std::vector<FieldConverter>& options = converter.fields[index];
+            FIT_UINT16 subfield = FIT_SUBFIELD_INDEX_MAIN_FIELD;
+            if (options.size() > 1) {
+                FIT_UINT16 active = mesg.GetActiveSubFieldIndexByFieldIndex(i);
+                if (active < options.size() - 1) {
+                    subfield = active;
+                }
+            }
+            const FieldConverter& field_converter = options[subfield == FIT_SUBFIELD_INDEX_MAIN_FIELD ? 0 : subfield + 1];
+
+            // Component expansion appends to a field the message already carries, so only the
+            // elements its definition declares are its own. Expanded-only fields keep them all.
+            FIT_UINT8 count = field->GetNumValues();
+            FIT_UINT8 defined = counts[field->GetNum()];
+            if (defined != 0 && defined < count && field->GetType() != FIT_BASE_TYPE_STRING) {
+                count = defined;
+            }
+
+            ERL_NIF_TERM value;
+            if (make_field_value(env, *field, field_converter, subfield, count, &value)) {
+                keys.push_back(field_converter.key);
+                values.push_back(value);
+            }
+        }
+
+        ERL_NIF_TERM dev_map;
+        if (make_developer_fields(mesg, &dev_map)) {
+            keys.push_back(developer_fields_key);
+            values.push_back(dev_map);
+        }
+
+        messages[entry->second].push_back(make_map(keys, values));
+    }
+
+private:
+    ErlNifEnv* env;
+    const std::vector<bool>& wanted;
+    FIT_UINT8 defined_counts[FIT_MAX_LOCAL_MESGS][256];  // Elements per field number, by local message
+    std::vector<DevFieldConverter> dev_field_converters[FIT_MAX_LOCAL_MESGS];
+    ERL_NIF_TERM developer_fields_key = enif_make_atom(env, "developer_fields");
+    ERL_NIF_TERM value_key = enif_make_atom(env, "value");
+    ERL_NIF_TERM units_key = enif_make_atom(env, "units");
+
+    ERL_NIF_TERM make_map(std::vector<ERL_NIF_TERM>& keys, std::vector<ERL_NIF_TERM>& values) {
+        ERL_NIF_TERM map;
+        if (!enif_make_map_from_arrays(env, keys.data(), values.data(), keys.size(), &map)) {
+            // A key given twice, such as a subfield sharing a name with another field; the first one wins
+            map = enif_make_new_map(env);
+            for (size_t i = keys.size(); i-- > 0;) {
+                enif_make_map_put(env, map, keys[i], values[i], &map);
+            }
+        }
+        return map;
+    }
+
+    // Builds %{name => %{value:, units:}} for the message's described developer fields.
+    // Returns false if it has none with a valid value.
+    bool make_developer_fields(const fit::Mesg& mesg, ERL_NIF_TERM* map) {
+        const std::vector<DevFieldConverter>& dev_fields = dev_field_converters[mesg.GetLocalNum() % FIT_MAX_LOCAL_MESGS];
+        if (dev_fields.empty()) {
+            return false;
+        }
+
+        const FieldConverter converter = {developer_fields_key, 1.0, 0.0, false};
+        std::vector<ERL_NIF_TERM> keys;
+        std::vector<ERL_NIF_TERM> values;
+
+        for (const fit::DeveloperField& field : mesg.GetDeveloperFields()) {
+            for (const DevFieldConverter& dev_field : dev_fields) {
+                if (dev_field.num != field.GetNum() ||
+                    dev_field.developer_data_index != field.GetDefinition().GetDeveloperDataIndex()) {
+                    continue;
+                }
+
+                ERL_NIF_TERM value;
+                if (make_field_value(env, field, converter, FIT_SUBFIELD_INDEX_MAIN_FIELD, field.GetNumValues(), &value)) {
+                    ERL_NIF_TERM entry_keys[] = {value_key, units_key};
+                    ERL_NIF_TERM entry_values[] = {value, dev_field.units};
+                    ERL_NIF_TERM entry;
+                    enif_make_map_from_arrays(env, entry_keys, entry_values, 2, &entry);
+                    keys.push_back(dev_field.name);
+                    values.push_back(entry);
+                }
+                break;
+            }
+        }
+
+        if (keys.empty()) {
+            return false;
+        }
+        *map = make_map(keys, values);
+        return true;
+    }
+};
+
+// Read-only stream buffer over a byte range, so part of a binary can be decoded without
+// copying it into a stringstream first.
+class ByteRangeBuffer : public std::streambuf {
+public:
+    ByteRangeBuffer(const unsigned char* data, size_t size) {
+        char* begin = reinterpret_cast<char*>(const_cast<unsigned char*>(data));
+        setg(begin, begin, begin + size);
+    }
 
-        if (it->zone != FIT_UINT8_INVALID) {
-            enif_make_map_put(env, map, atom_zone, enif_make_int(env, it->zone), &map);
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        off_type base = 0;
+        if (dir == std::ios_base::cur) {
+            base = gptr() - eback();
+        } else if (dir == std::ios_base::end) {
+            base = egptr() - eback();
         }
+        return seekpos(pos_type(base + off), which);
+    }
 
-        if (it->time128 != FIT_FLOAT32_INVALID && !std::isnan(it->time128)) {
-            enif_make_map_put(env, map, atom_time128, enif_make_double(env, it->time128), &map);
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+        if (pos < 0 || pos > egptr() - eback()) {
+            return pos_type(off_type(-1));
         }
+        setg(eback(), eback() + off_type(pos), egptr());
+        return pos;
+    }
+};
+
+// Decodes size bytes of FIT data. Returns nullptr, or the name of the error atom. Touches
+// no environment, so any thread can call it.
+static const char* decode_buffer(const void* data, size_t size, fit::MesgListener& mesg_listener,
+                                 fit::MesgDefinitionListener& definition_listener) {
+    // Read the FIT data in place rather than copying it into a string stream.
+    ByteRangeBuffer buffer(static_cast<const unsigned char*>(data), size);
+    std::istream fit_stream(&buffer);
+
+    fit::Decode decode;
+    decode.NoThrow();
+
+    // Check if the FIT file is valid.
+    if (!decode.CheckIntegrity(fit_stream)) {
+        return "error_integrity_check_failed";
+    }
+
+    // Reset stream position after integrity check
+    fit_stream.clear();
+    fit_stream.seekg(0, std::ios::beg);
+
+    // Read the file from the stream with our listener.
+    if (!decode.Read(fit_stream, mesg_listener, definition_listener)) {
+        return "error_sdk_exception";
+    }
+
+    return nullptr;
+}
+
+// Checks and decodes a FIT binary into the listeners. On failure sets *error to the
+// atom to hand back to Elixir and returns false.
+static bool decode_binary(ErlNifEnv* env, const ErlNifBinary& fit_binary, fit::MesgListener& mesg_listener,
+                          fit::MesgDefinitionListener& definition_listener, ERL_NIF_TERM* error) {
+    const char* reason = decode_buffer(fit_binary.data, fit_binary.size, mesg_listener, definition_listener);
+    if (reason != nullptr) {
+        *error = enif_make_atom(env, reason);
+        return false;
+    }
+
+    return true;
+}
+
+static bool decode_binary(ErlNifEnv* env, const ErlNifBinary& fit_binary, Listener& listener, ERL_NIF_TERM* error) {
+    listener.data_size = fit_binary.size;
+    return decode_binary(env, fit_binary, listener, listener, error);
+}
+
+// A decoded record field value as the integer or float the record maps hold.
+static inline ERL_NIF_TERM make_record_value(ErlNifEnv* env, const RecordField& field, double value) {
+    switch (field.type) {
+        case RECORD_VALUE_FLOAT32:
+            return enif_make_double(env, value);
+        case RECORD_VALUE_SINT8:
+        case RECORD_VALUE_SINT32:
+            return enif_make_int(env, (int)value);
+        default:
+            return enif_make_uint(env, (unsigned int)value);
+    }
+}
 
-        if (it->grit != FIT_FLOAT32_INVALID && !std::isnan(it->grit)) {
-            enif_make_map_put(env, map, atom_grit, enif_make_double(env, it->grit), &map);
+// Converts the decoded records in [first, last) to a list of maps holding only their valid
+// fields, keeping only records timestamped within [start_time, end_time]. Only the stored
+// columns are checked, and their keys are made once and shared by every map.
+static ERL_NIF_TERM make_record_list(ErlNifEnv* env, const RecordColumns& records, size_t first, size_t last,
+                                     unsigned int start_time = 0, unsigned int end_time = UINT32_MAX) {
+    const std::vector<FIT_UINT8>& columns = records.fields();
+    ERL_NIF_TERM column_keys[RECORD_FIELD_COUNT];
+    for (size_t i = 0; i < columns.size(); i++) {
+        column_keys[i] = enif_make_atom(env, record_fields[columns[i]].name);
+    }
+
+    ERL_NIF_TERM keys[RECORD_FIELD_COUNT];
+    ERL_NIF_TERM values[RECORD_FIELD_COUNT];
+    ERL_NIF_TERM result_list = enif_make_list(env, 0);
+
+    // Iterate through the collected records in reverse to build the Elixir list correctly.
+    for (size_t record = last; record-- > first;) {
+        unsigned int timestamp = records.Timestamp(record);
+        if (timestamp < start_time || timestamp > end_time) {
+            continue;
         }
 
-        if (it->flow != FIT_FLOAT32_INVALID && !std::isnan(it->flow)) {
-            enif_make_map_put(env, map, atom_flow, enif_make_double(env, it->flow), &map);
+        size_t count = 0;
+        double value;
+        for (size_t i = 0; i < columns.size(); i++) {
+            const RecordField& field = record_fields[columns[i]];
+            if (!decode_value(field, records.Raw(columns[i], record), &value)) {
+                continue;
+            }
+
+            keys[count] = column_keys[i];
+            values[count] = make_record_value(env, field, value);
+            count++;
         }
 
-        if (it->time_from_course != FIT_FLOAT32_INVALID && !std::isnan(it->time_from_course)) {
-            enif_make_map_put(env, map, atom_time_from_course, enif_make_double(env, it->time_from_course), &map);
+        ERL_NIF_TERM map;
+        enif_make_map_from_arrays(env, keys, values, count, &map);
+        result_list = enif_make_list_cell(env, map, result_list);
+    }
+
+    return result_list;
+}
+
+static ERL_NIF_TERM make_record_list(ErlNifEnv* env, const RecordColumns& records,
+                                     unsigned int start_time = 0, unsigned int end_time = UINT32_MAX) {
+    return make_record_list(env, records, 0, records.size(), start_time, end_time);
+}
+
+// %{min:, max:, avg:} for a summarized field, or nil if no record carried it.
+static ERL_NIF_TERM make_field_stats(ErlNifEnv* env, const FieldStats& stats, bool integer) {
+    if (stats.count == 0) {
+        return enif_make_atom(env, "nil");
+    }
+
+    ERL_NIF_TERM keys[3] = {
+        enif_make_atom(env, "min"),
+        enif_make_atom(env, "max"),
+        enif_make_atom(env, "avg")
+    };
+    ERL_NIF_TERM values[3] = {
+        integer ? enif_make_int64(env, (int64_t)stats.min) : enif_make_double(env, stats.min),
+        integer ? enif_make_int64(env, (int64_t)stats.max) : enif_make_double(env, stats.max),
+        enif_make_double(env, stats.sum / stats.count)
+    };
+
+    ERL_NIF_TERM map;
+    enif_make_map_from_arrays(env, keys, values, 3, &map);
+    return map;
+}
+
+static ERL_NIF_TERM make_summary(ErlNifEnv* env, const ActivitySummary& summary) {
+    ERL_NIF_TERM nil = enif_make_atom(env, "nil");
+    bool has_records = summary.record_count > 0;
+
+    // Present record fields, in the same order as the record map keys
+    ERL_NIF_TERM fields = enif_make_list(env, 0);
+    for (size_t i = sizeof(record_fields) / sizeof(record_fields[0]); i-- > 0;) {
+        FIT_UINT8 num = record_fields[i].num;
+        if (summary.fields_present[num >> 6] & ((uint64_t)1 << (num & 63))) {
+            fields = enif_make_list_cell(env, enif_make_atom(env, record_fields[i].name), fields);
         }
+    }
+
+    ERL_NIF_TERM keys[10] = {
+        enif_make_atom(env, "record_count"),
+        enif_make_atom(env, "start_time"),
+        enif_make_atom(env, "end_time"),
+        enif_make_atom(env, "duration_seconds"),
+        enif_make_atom(env, "total_distance"),
+        enif_make_atom(env, "heart_rate"),
+        enif_make_atom(env, "power"),
+        enif_make_atom(env, "cadence"),
+        enif_make_atom(env, "speed"),
+        enif_make_atom(env, "fields")
+    };
+    ERL_NIF_TERM values[10] = {
+        enif_make_uint64(env, summary.record_count),
+        has_records ? enif_make_uint(env, summary.start_time) : nil,
+        has_records ? enif_make_uint(env, summary.end_time) : nil,
+        has_records ? enif_make_uint(env, summary.end_time - summary.start_time) : nil,
+        summary.total_distance >= 0.0 ? enif_make_double(env, summary.total_distance) : nil,
+        make_field_stats(env, summary.heart_rate, true),
+        make_field_stats(env, summary.power, true),
+        make_field_stats(env, summary.cadence, true),
+        make_field_stats(env, summary.speed, false),
+        fields
+    };
+
+    ERL_NIF_TERM map;
+    enif_make_map_from_arrays(env, keys, values, 10, &map);
+    return map;
+}
+
+static bool get_number(ErlNifEnv* env, ERL_NIF_TERM term, double* value) {
+    ErlNifSInt64 integer;
+    if (enif_get_int64(env, term, &integer)) {
+        *value = (double)integer;
+        return true;
+    }
+    return enif_get_double(env, term, value);
+}
 
-        if (it->left_pco != FIT_SINT8_INVALID) {
-            enif_make_map_put(env, map, atom_left_pco, enif_make_int(env, it->left_pco), &map);
+// Reads a keyword list of :ftp, :max_hr, :resting_hr, :hr_zones and :sex into settings.
+// Returns false for anything else or a value out of range.
+static bool get_load_settings(ErlNifEnv* env, ERL_NIF_TERM list, LoadSettings* settings) {
+    *settings = LoadSettings();
+    ERL_NIF_TERM head;
+    while (enif_get_list_cell(env, list, &head, &list)) {
+        int arity;
+        const ERL_NIF_TERM* option;
+        char key[16];
+        if (!enif_get_tuple(env, head, &arity, &option) || arity != 2 ||
+            !enif_get_atom(env, option[0], key, sizeof(key), ERL_NIF_LATIN1)) {
+            return false;
+        }
+
+        if (strcmp(key, "ftp") == 0) {
+            if (!get_number(env, option[1], &settings->ftp) || settings->ftp <= 0.0) {
+                return false;
+            }
+        } else if (strcmp(key, "max_hr") == 0) {
+            if (!get_number(env, option[1], &settings->max_hr) || settings->max_hr <= 0.0) {
+                return false;
+            }
+        } else if (strcmp(key, "resting_hr") == 0) {
+            if (!get_number(env, option[1], &settings->resting_hr) || settings->resting_hr <= 0.0) {
+                return false;
+            }
+        } else if (strcmp(key, "sex") == 0) {
+            settings->female = enif_is_identical(option[1], enif_make_atom(env, "female"));
+            if (!settings->female && !enif_is_identical(option[1], enif_make_atom(env, "male"))) {
+                return false;
+            }
+        } else if (strcmp(key, "hr_zones") == 0) {
+            ERL_NIF_TERM zones = option[1];
+            ERL_NIF_TERM zone;
+            double bound;
+            settings->hr_zones.clear();
+            while (enif_get_list_cell(env, zones, &zone, &zones)) {
+                if (!get_number(env, zone, &bound) ||
+                    (!settings->hr_zones.empty() && bound <= settings->hr_zones.back())) {
+                    return false;
+                }
+                settings->hr_zones.push_back(bound);
+            }
+            if (!enif_is_empty_list(env, zones)) {
+                return false;
+            }
+        } else {
+            return false;
         }
+    }
+    return enif_is_empty_list(env, list) &&
+           (settings->max_hr == 0.0 || settings->resting_hr < settings->max_hr);
+}
+
+static ERL_NIF_TERM make_training_load(ErlNifEnv* env, const TrainingLoad& load) {
+    ERL_NIF_TERM keys[6] = {
+        enif_make_atom(env, "normalized_power"),
+        enif_make_atom(env, "intensity_factor"),
+        enif_make_atom(env, "training_stress_score"),
+        enif_make_atom(env, "variability_index"),
+        enif_make_atom(env, "trimp"),
+        enif_make_atom(env, "edwards_trimp")
+    };
+    double metrics[6] = {load.normalized_power, load.intensity_factor, load.training_stress_score,
+                         load.variability_index, load.trimp, load.edwards_trimp};
+    ERL_NIF_TERM values[6];
+    for (size_t i = 0; i < 6; i++) {
+        values[i] = std::isnan(metrics[i]) ? enif_make_atom(env, "nil") : enif_make_double(env, metrics[i]);
+    }
+
+    ERL_NIF_TERM map;
+    enif_make_map_from_arrays(env, keys, values, 6, &map);
+    return map;
+}
 
-        if (it->right_pco != FIT_SINT8_INVALID) {
-            enif_make_map_put(env, map, atom_right_pco, enif_make_int(env, it->right_pco), &map);
+// This is the main NIF function that Elixir will call.
+static ERL_NIF_TERM decode_fit_file_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifBinary fit_binary;
+    if (!enif_inspect_binary(env, argv[0], &fit_binary)) {
+        return enif_make_badarg(env);
+    }
+
+    Listener listener;
+    ERL_NIF_TERM error;
+    if (!decode_binary(env, fit_binary, listener, &error)) {
+        return error;
+    }
+
+    return make_record_list(env, listener.records);
+}
+
+// The atom naming why a decode stopped.
+static ERL_NIF_TERM make_decode_reason(ErlNifEnv* env, fit::Decode::STATUS status) {
+    switch (status) {
+        case fit::Decode::STATUS_INVALID_HEADER: return enif_make_atom(env, "invalid_header");
+        case fit::Decode::STATUS_INVALID_DATA_SIZE: return enif_make_atom(env, "invalid_data_size");
+        case fit::Decode::STATUS_UNSUPPORTED_PROTOCOL: return enif_make_atom(env, "unsupported_protocol");
+        case fit::Decode::STATUS_UNSUPPORTED_ARCHITECTURE: return enif_make_atom(env, "unsupported_architecture");
+        case fit::Decode::STATUS_INVALID_FIELD_SIZE: return enif_make_atom(env, "invalid_field_size");
+        case fit::Decode::STATUS_MISSING_DEFINITION: return enif_make_atom(env, "missing_definition");
+        case fit::Decode::STATUS_INVALID_DEVELOPER_DATA: return enif_make_atom(env, "invalid_developer_data");
+        case fit::Decode::STATUS_INCOMPLETE_MESSAGE: return enif_make_atom(env, "incomplete_message");
+        case fit::Decode::STATUS_UNEXPECTED_END: return enif_make_atom(env, "unexpected_end");
+        case fit::Decode::STATUS_CRC_FAILED: return enif_make_atom(env, "crc_mismatch");
+        case fit::Decode::STATUS_TOO_MANY_ACCUMULATED_FIELDS: return enif_make_atom(env, "too_many_accumulated_fields");
+        default: return enif_make_atom(env, "unknown");
+    }
+}
+
+// Whether data starts with a definition message the decoder would accept for a message the
+// profile knows: reserved byte 0, a known architecture, and fields sized in whole elements
+// of a known base type. Used to find where to resume after corrupted bytes. Sets *length
+// to the size of the definition and *mesg_size to that of the data messages it defines.
+static bool is_plausible_definition(const unsigned char* data, size_t size, size_t* length, size_t* mesg_size) {
+    if (size < 6 || (data[0] & 0xD0) != FIT_HDR_TYPE_DEF_BIT || data[1] != 0 || data[2] > FIT_ARCH_ENDIAN_BIG) {
+        return false;
+    }
+
+    FIT_UINT16 num = data[2] == FIT_ARCH_ENDIAN_BIG ? (data[3] << 8) | data[4] : data[3] | (data[4] << 8);
+    if (mesg_converter_index.find(num) == mesg_converter_index.end()) {
+        return false;
+    }
+
+    size_t num_fields = data[5];
+    size_t pos = 6;
+    if (num_fields == 0 || size < pos + num_fields * 3) {
+        return false;
+    }
+    *mesg_size = 1;  // Record header
+    for (size_t i = 0; i < num_fields; i++, pos += 3) {
+        FIT_UINT8 field_size = data[pos + 1];
+        *mesg_size += field_size;
+        FIT_UINT8 type = data[pos + 2];
+        FIT_UINT8 base_type = type & FIT_BASE_TYPE_NUM_MASK;
+        if (field_size == 0 || base_type >= FIT_BASE_TYPES ||
+            (type & ~(FIT_BASE_TYPE_ENDIAN_FLAG | FIT_BASE_TYPE_NUM_MASK)) != 0 ||
+            field_size % fit::baseTypeSizes[base_type] != 0) {
+            return false;
         }
+    }
 
-        if (it->pressure_sac != FIT_FLOAT32_INVALID && !std::isnan(it->pressure_sac)) {
-            enif_make_map_put(env, map, atom_pressure_sac, enif_make_double(env, it->pressure_sac), &map);
+    if (data[0] & FIT_HDR_DEV_FIELD_BIT) {
+        if (size < pos + 1 || size < pos + 1 + data[pos] * 3) {
+            return false;
+        }
+        for (size_t i = 0, num_dev_fields = data[pos++]; i < num_dev_fields; i++, pos += 3) {
+            if (data[pos + 1] == 0) {
+                return false;
+            }
+            *mesg_size += data[pos + 1];
         }
+    }
+    *length = pos;
+    return true;
+}
 
-        if (it->volume_sac != FIT_FLOAT32_INVALID && !std::isnan(it->volume_sac)) {
-            enif_make_map_put(env, map, atom_volume_sac, enif_make_double(env, it->volume_sac), &map);
+// How many messages past a resume point must line up before decoding resumes there.
+static const int SALVAGE_CHECKED_MESGS = 8;
+
+// Sizes of the data messages of each local message the decoder has a definition for, 0 for
+// the others.
+static void defined_mesg_sizes(const fit::Decode& decode, size_t* mesg_sizes) {
+    for (FIT_UINT8 local = 0; local < FIT_MAX_LOCAL_MESGS; local++) {
+        const fit::MesgDefinition* definition = decode.GetMesgDefinition(local);
+        mesg_sizes[local] = 0;
+        if (definition != FIT_NULL) {
+            mesg_sizes[local] = 1 + definition->GetDeveloperFieldTotalSize();
+            for (const fit::FieldDefinition& field : definition->GetFields()) {
+                mesg_sizes[local] += field.GetSize();
+            }
         }
+    }
+}
+
+// Whether decoding can resume at data[offset], given the defined_mesg_sizes of the decoder.
+// The message there and the ones after it, up to SALVAGE_CHECKED_MESGS or the end of the data,
+// must each start with a plausible definition or with a data message header for a local
+// message defined by then, and the last must end within the data. The first must not use a
+// compressed timestamp header: any byte with the top bit set reads as one, so a byte repeating
+// at the same place in every message would line up with them.
+static bool is_plausible_resume(const unsigned char* data, size_t offset, size_t end, const size_t* defined_sizes) {
+    if (data[offset] & FIT_HDR_TIME_REC_BIT) {
+        return false;
+    }
 
-        if (it->rmv != FIT_FLOAT32_INVALID && !std::isnan(it->rmv)) {
-            enif_make_map_put(env, map, atom_rmv, enif_make_double(env, it->rmv), &map);
+    size_t mesg_sizes[FIT_MAX_LOCAL_MESGS];
+    memcpy(mesg_sizes, defined_sizes, sizeof(mesg_sizes));
+
+    size_t pos = offset;
+    for (int checked = 0; checked < SALVAGE_CHECKED_MESGS && pos < end; checked++) {
+        FIT_UINT8 header = data[pos];
+        size_t length;
+        if (header & FIT_HDR_TIME_REC_BIT) {
+            length = mesg_sizes[(header & FIT_HDR_TIME_TYPE_MASK) >> FIT_HDR_TIME_TYPE_SHIFT];
+        } else if (header & FIT_HDR_TYPE_DEF_BIT) {
+            size_t mesg_size;
+            if (!is_plausible_definition(data + pos, end - pos, &length, &mesg_size)) {
+                return false;
+            }
+            mesg_sizes[header & FIT_HDR_TYPE_MASK] = mesg_size;
+        } else {
+            // Bits 4 and 5 of a data message header are reserved
+            length = (header & 0x30) == 0 ? mesg_sizes[header & FIT_HDR_TYPE_MASK] : 0;
+        }
+        if (length == 0) {
+            return false;
         }
+        pos += length;
+    }
+    return pos <= end;
+}
 
-        result_list = enif_make_list_cell(env, map, result_list);
+// The data size a FIT file header at data declares, or -1 if data doesn't start with one.
+static long long header_data_size(const unsigned char* data, size_t size) {
+    if (size < FIT_HEADER_SIZE_NO_CRC || data[0] < FIT_HEADER_SIZE_NO_CRC || memcmp(data + 8, ".FIT", 4) != 0) {
+        return -1;
     }
+    return (long long)data[4] | (long long)data[5] << 8 | (long long)data[6] << 16 | (long long)data[7] << 24;
+}
 
-    return result_list;
+// Where the messages of a file being salvaged end, leaving out its trailing file CRC. Sets
+// *size_wrong if the header's data size can't be right: 0, or ending short of the data with
+// no chained file following. A data size past the end is a truncated file, decoded as is.
+static size_t salvage_data_end(const unsigned char* data, size_t size, bool* size_wrong) {
+    *size_wrong = false;
+    long long data_size = header_data_size(data, size);
+    if (data_size < 0) {
+        return size;
+    }
+
+    size_t data_end = data[0] + (size_t)data_size;
+    if (data_size > 0 && data_end + 2 == size) {
+        return data_end;
+    }
+    if (data_size == 0 ||
+        (data_end + 2 < size && header_data_size(data + data_end + 2, size - data_end - 2) < 0)) {
+        *size_wrong = true;
+        // A file whose size alone was never written still ends in a valid file CRC
+        if (size >= (size_t)data[0] + 2 && fit::CRC::Calc16(data, (FIT_UINT32)size) == 0) {
+            return size - 2;
+        }
+    }
+    return size;
 }
 
-// The list of functions this NIF exports.
-static ErlNifFunc nif_funcs[] = {
-    {"decode_fit_file", 1, decode_fit_file_nif}
-};
+// Continues a decode that stopped with an error by skipping to the next point where decoding
+// can plausibly resume and resuming there in the same decoder, until the data ends at end or
+// is cut short. The decoder keeps its definitions, so runs of data messages defined before
+// the damage are recovered too. Appends each skipped byte range to skipped.
+static void salvage_records(const unsigned char* data, size_t end, fit::Decode& decode,
+                            std::vector<std::pair<size_t, size_t>>& skipped) {
+    ByteRangeBuffer buffer(data, end);
+    std::istream stream(&buffer);
+    fit::Decode::STATUS status = decode.GetStatus();
+    size_t offset = decode.GetErrorOffset();
+
+    // A cut-off message can't be resumed: nothing follows it
+    while (status != fit::Decode::STATUS_UNEXPECTED_END && offset < end) {
+        size_t mesg_sizes[FIT_MAX_LOCAL_MESGS];
+        defined_mesg_sizes(decode, mesg_sizes);
+        size_t next = offset + 1;
+        while (next < end && !is_plausible_resume(data, next, end, mesg_sizes)) {
+            next++;
+        }
+        skipped.push_back({offset, next});
+        if (next >= end) {
+            break;
+        }
+
+        if (decode.Resync(stream, (FIT_UINT32)next)) {
+            break;
+        }
+        status = decode.GetStatus();
+        offset = decode.GetErrorOffset();
+    }
+}
+
+// Decodes the records of a FIT binary in a single pass without the integrity check, and
+// keeps the records decoded before an error. Returns {:ok, records}, or
+// {:partial, records, %{offset: offset, reason: reason}} with the byte offset it stopped at.
+// With salvage true a header data size that can't be right is ignored, and decoding resumes
+// after corrupted bytes at the next plausible definition message; the error map then also
+// lists the skipped byte ranges as {start, stop} tuples.
+static ERL_NIF_TERM decode_fit_file_partial_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (argc != 2) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifBinary fit_binary;
+    if (!enif_inspect_binary(env, argv[0], &fit_binary)) {
+        return enif_make_badarg(env);
+    }
+
+    bool salvage = enif_is_identical(argv[1], enif_make_atom(env, "true"));
+    bool size_wrong = false;
+    size_t end = salvage ? salvage_data_end(fit_binary.data, fit_binary.size, &size_wrong) : fit_binary.size;
+
+    ByteRangeBuffer buffer(fit_binary.data, size_wrong ? end : fit_binary.size);
+    std::istream fit_stream(&buffer);
+
+    Listener listener;
+    listener.data_size = fit_binary.size;
+    fit::Decode decode;
+    decode.NoThrow();
+    if (size_wrong) {
+        decode.setInvalidDataSize(FIT_TRUE);  // Decode to the end of the data instead
+    }
+    decode.Read(fit_stream, listener, listener);
+
+    if (decode.GetStatus() == fit::Decode::STATUS_OK) {
+        return enif_make_tuple2(env, enif_make_atom(env, "ok"), make_record_list(env, listener.records));
+    }
+
+    // The first error is reported even when salvage decodes past it
+    ERL_NIF_TERM keys[3] = {enif_make_atom(env, "offset"), enif_make_atom(env, "reason")};
+    ERL_NIF_TERM values[3] = {enif_make_uint(env, decode.GetErrorOffset()), make_decode_reason(env, decode.GetStatus())};
+    std::vector<std::pair<size_t, size_t>> skipped;
+    if (salvage) {
+        salvage_records(fit_binary.data, end, decode, skipped);
+    }
+
+    ERL_NIF_TERM records = make_record_list(env, listener.records);
+    if (salvage) {
+        ERL_NIF_TERM ranges = enif_make_list(env, 0);
+        for (size_t i = skipped.size(); i-- > 0;) {
+            ERL_NIF_TERM range = enif_make_tuple2(env, enif_make_uint64(env, skipped[i].first),
+                                                  enif_make_uint64(env, skipped[i].second));
+            ranges = enif_make_list_cell(env, range, ranges);
+        }
+        keys[2] = enif_make_atom(env, "skipped");
+        values[2] = ranges;
+    }
+
+    ERL_NIF_TERM error;
+    enif_make_map_from_arrays(env, keys, values, salvage ? 3 : 2, &error);
+    return enif_make_tuple3(env, enif_make_atom(env, "partial"), records, error);
+}
+
+// Decodes a FIT binary into an activity summary, and optionally the records as well.
+// Returns {:ok, summary} or {:ok, summary, records}. When argv[2] holds training load
+// settings, the summary also carries :training_load.
+static ERL_NIF_TERM summarize_fit_file_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (argc != 3) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifBinary fit_binary;
+    LoadSettings settings;
+    if (!enif_inspect_binary(env, argv[0], &fit_binary) || !get_load_settings(env, argv[2], &settings)) {
+        return enif_make_badarg(env);
+    }
+
+    bool with_records = enif_is_identical(argv[1], enif_make_atom(env, "true"));
+    bool with_load = !enif_is_empty_list(env, argv[2]);
+
+    // Training load is computed from the record columns
+    Listener listener(with_records || with_load);
+    ERL_NIF_TERM error;
+    if (!decode_binary(env, fit_binary, listener, &error)) {
+        return error;
+    }
+
+    ERL_NIF_TERM summary = make_summary(env, listener.summary);
+    if (with_load) {
+        ERL_NIF_TERM load = make_training_load(env, TrainingLoad(listener.records, settings));
+        enif_make_map_put(env, summary, enif_make_atom(env, "training_load"), load, &summary);
+    }
+    if (with_records) {
+        return enif_make_tuple3(env, enif_make_atom(env, "ok"), summary, make_record_list(env, listener.records));
+    }
+
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), summary);
+}
+
+// [{start_time, end_time, record_count}] in time order.
+static ERL_NIF_TERM make_session_list(ErlNifEnv* env, const SessionTracker& tracker) {
+    ERL_NIF_TERM sessions = enif_make_list(env, 0);
+    for (auto it = tracker.sessions.rbegin(); it != tracker.sessions.rend(); ++it) {
+        ERL_NIF_TERM session = enif_make_tuple3(env,
+            enif_make_uint(env, it->second.start_time),
+            enif_make_uint(env, it->second.end_time),
+            enif_make_uint64(env, it->second.record_count));
+        sessions = enif_make_list_cell(env, session, sessions);
+    }
+    return sessions;
+}
+
+// Decodes a FIT binary and splits its records into sessions at gaps longer than argv[1]
+// seconds. argv[2] selects which records come back: none, all, or longest (only those
+// in the session spanning the most time). Returns {:ok, sessions} or {:ok, sessions, records},
+// where sessions is a list of {start_time, end_time, record_count} in time order.
+static ERL_NIF_TERM decode_sessions_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (argc != 3) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifBinary fit_binary;
+    unsigned int gap;
+    if (!enif_inspect_binary(env, argv[0], &fit_binary) || !enif_get_uint(env, argv[1], &gap)) {
+        return enif_make_badarg(env);
+    }
+
+    bool all_records = enif_is_identical(argv[2], enif_make_atom(env, "all"));
+    bool longest_records = enif_is_identical(argv[2], enif_make_atom(env, "longest"));
+    if (!all_records && !longest_records && !enif_is_identical(argv[2], enif_make_atom(env, "none"))) {
+        return enif_make_badarg(env);
+    }
+
+    SessionTracker tracker(gap);
+    Listener listener(all_records || longest_records);
+    listener.session_tracker = &tracker;
+
+    ERL_NIF_TERM error;
+    if (!decode_binary(env, fit_binary, listener, &error)) {
+        return error;
+    }
+
+    ERL_NIF_TERM sessions = make_session_list(env, tracker);
+    ERL_NIF_TERM ok = enif_make_atom(env, "ok");
+    if (all_records) {
+        return enif_make_tuple3(env, ok, sessions, make_record_list(env, listener.records));
+    }
+
+    if (longest_records) {
+        const Session* longest = tracker.Longest();
+        ERL_NIF_TERM records = longest == nullptr
+            ? enif_make_list(env, 0)
+            : make_record_list(env, listener.records, longest->start_time, longest->end_time);
+        return enif_make_tuple3(env, ok, sessions, records);
+    }
+
+    return enif_make_tuple2(env, ok, sessions);
+}
+
+// Decodes every message of the types in argv[1], a list of message name atoms or :all,
+// to maps. Returns {:ok, %{type => [map]}} with a key for each requested type, or for
+// :all each type the file contains.
+static ERL_NIF_TERM decode_messages_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (argc != 2) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifBinary fit_binary;
+    if (!enif_inspect_binary(env, argv[0], &fit_binary)) {
+        return enif_make_badarg(env);
+    }
+
+    bool all_types = enif_is_identical(argv[1], enif_make_atom(env, "all"));
+    std::vector<bool> wanted(mesg_converters.size(), all_types);
+    if (!all_types) {
+        ERL_NIF_TERM list = argv[1];
+        ERL_NIF_TERM head;
+        while (enif_get_list_cell(env, list, &head, &list)) {
+            size_t i = 0;
+            while (i < mesg_converters.size() && !enif_is_identical(head, mesg_converters[i].key)) {
+                i++;
+            }
+            if (i == mesg_converters.size()) {
+                return enif_make_badarg(env);
+            }
+            wanted[i] = true;
+        }
+        if (!enif_is_empty_list(env, list)) {
+            return enif_make_badarg(env);
+        }
+    }
+
+    MessageCollector collector(env, wanted);
+    ERL_NIF_TERM error;
+    if (!decode_binary(env, fit_binary, collector, collector, &error)) {
+        return error;
+    }
+
+    ERL_NIF_TERM result = enif_make_new_map(env);
+    for (size_t i = 0; i < mesg_converters.size(); i++) {
+        const std::vector<ERL_NIF_TERM>& messages = collector.messages[i];
+        if (!wanted[i] || (all_types && messages.empty())) {
+            continue;
+        }
+
+        ERL_NIF_TERM list = enif_make_list_from_array(env, messages.data(), messages.size());
+        enif_make_map_put(env, result, mesg_converters[i].key, list, &result);
+    }
+
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+}
+
+// A local message definition as walk_messages tracks it.
+struct LocalDefinition {
+    bool defined;
+    FIT_UINT16 num;  // Global message number
+    size_t size;  // Of a data message, header byte included
+    size_t dev_size;  // Of the developer fields in a data message
+};
+
+// Walks the messages of a FIT binary, and its chained files, by the lengths their
+// definitions give, without decoding any of them. Calls visitor.OnFile(data_size) for each
+// file header, visitor.OnDefinition(local, definition, begin, end) for each definition
+// message and visitor.OnData(local, definition, begin) for each data message. Returns false
+// if a header is invalid, a data message has no definition, or a message runs past its
+// file's data. File CRCs aren't checked.
+template <typename Visitor>
+static bool walk_messages(const unsigned char* data, size_t size, Visitor& visitor) {
+    size_t pos = 0;
+    do {
+        long long data_size = header_data_size(data + pos, size - pos);
+        if (data_size < 0 || (data[pos + 1] >> FIT_PROTOCOL_VERSION_MAJOR_SHIFT) > FIT_PROTOCOL_VERSION_MAJOR ||
+            size - pos < data[pos] + (size_t)data_size + 2) {
+            return false;
+        }
+
+        LocalDefinition definitions[FIT_MAX_LOCAL_MESGS] = {};
+        size_t end = pos + data[pos] + (size_t)data_size;
+        pos += data[pos];
+        visitor.OnFile((size_t)data_size);
+
+        while (pos < end) {
+            FIT_UINT8 header = data[pos];
+            if ((header & (FIT_HDR_TIME_REC_BIT | FIT_HDR_TYPE_DEF_BIT)) == FIT_HDR_TYPE_DEF_BIT) {
+                if (end - pos < 6 || end - pos < 6 + (size_t)data[pos + 5] * 3) {
+                    return false;
+                }
+                FIT_UINT16 num = data[pos + 2] == FIT_ARCH_ENDIAN_BIG ? (data[pos + 3] << 8) | data[pos + 4]
+                                                                      : data[pos + 3] | (data[pos + 4] << 8);
+                size_t next = pos + 6 + data[pos + 5] * 3;
+                size_t mesg_size = 1;
+                for (size_t field = pos + 6; field < next; field += 3) {
+                    mesg_size += data[field + 1];
+                }
+                size_t dev_size = 0;
+                if (header & FIT_HDR_DEV_FIELD_BIT) {
+                    if (next >= end || end - next - 1 < (size_t)data[next] * 3) {
+                        return false;
+                    }
+                    size_t dev_fields = next + 1;
+                    next = dev_fields + data[next] * 3;
+                    for (size_t field = dev_fields; field < next; field += 3) {
+                        dev_size += data[field + 1];
+                    }
+                }
+
+                LocalDefinition& definition = definitions[header & FIT_HDR_TYPE_MASK];
+                definition = {true, num, mesg_size + dev_size, dev_size};
+                visitor.OnDefinition(header & FIT_HDR_TYPE_MASK, definition, data + pos, data + next);
+                pos = next;
+                continue;
+            }
+
+            // A compressed timestamp header names one of the first four local messages
+            FIT_UINT8 local = header & FIT_HDR_TIME_REC_BIT ? (header & FIT_HDR_TIME_TYPE_MASK) >> FIT_HDR_TIME_TYPE_SHIFT
+                                                            : header & FIT_HDR_TYPE_MASK;
+            const LocalDefinition& definition = definitions[local];
+            if (!definition.defined || end - pos < definition.size) {
+                return false;
+            }
+            visitor.OnData(local, definition, data + pos);
+            pos += definition.size;
+        }
+
+        pos = end + 2;  // Past the file CRC
+    } while (pos < size);
+
+    return true;
+}
+
+// Message types peek_fit_file_nif returns. Developer data ids and field descriptions are
+// kept as well, so the developer fields of the kept messages can be named.
+static const FIT_UINT16 peek_mesg_nums[] = {FIT_MESG_NUM_FILE_ID, FIT_MESG_NUM_DEVICE_INFO, FIT_MESG_NUM_SESSION,
+                                            FIT_MESG_NUM_LAP, FIT_MESG_NUM_ACTIVITY};
+
+static bool is_peek_mesg(FIT_UINT16 num) {
+    return num == FIT_MESG_NUM_DEVELOPER_DATA_ID || num == FIT_MESG_NUM_FIELD_DESCRIPTION ||
+           std::find(std::begin(peek_mesg_nums), std::end(peek_mesg_nums), num) != std::end(peek_mesg_nums);
+}
+
+// Copies the definitions and data messages of the types is_peek_mesg wants out of a walk.
+// A compressed timestamp message kept without the skipped ones before it would get a wrong
+// timestamp, but devices only write records that way.
+struct PeekVisitor {
+    std::vector<unsigned char> kept;
+
+    void OnFile(size_t) {}
+
+    void OnDefinition(FIT_UINT8, const LocalDefinition& definition, const unsigned char* begin,
+                      const unsigned char* end) {
+        if (is_peek_mesg(definition.num)) {
+            kept.insert(kept.end(), begin, end);
+        }
+    }
+
+    void OnData(FIT_UINT8, const LocalDefinition& definition, const unsigned char* begin) {
+        if (is_peek_mesg(definition.num)) {
+            kept.insert(kept.end(), begin, begin + definition.size);
+        }
+    }
+};
+
+// Returns the file_id, device_info, session, lap and activity messages of a FIT binary as
+// {:ok, %{type => [map]}}, like decode_messages_nif, without decoding any other message or
+// checking the file CRC.
+static ERL_NIF_TERM peek_fit_file_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifBinary fit_binary;
+    if (!enif_inspect_binary(env, argv[0], &fit_binary)) {
+        return enif_make_badarg(env);
+    }
+
+    PeekVisitor visitor;
+    if (fit_binary.size > 0 && !walk_messages(fit_binary.data, fit_binary.size, visitor)) {
+        return enif_make_atom(env, "error_integrity_check_failed");
+    }
+    const std::vector<unsigned char>& kept = visitor.kept;
+
+    std::vector<bool> wanted(mesg_converters.size(), false);
+    for (FIT_UINT16 num : peek_mesg_nums) {
+        wanted[mesg_converter_index[num]] = true;
+    }
+
+    // The kept messages decode as one headerless stream
+    MessageCollector collector(env, wanted);
+    if (!kept.empty()) {
+        ByteRangeBuffer buffer(kept.data(), kept.size());
+        std::istream stream(&buffer);
+        fit::Decode decode;
+        decode.NoThrow();
+        decode.SkipHeader();
+        if (!decode.Read(stream, collector, collector)) {
+            return enif_make_atom(env, "error_sdk_exception");
+        }
+    }
+
+    ERL_NIF_TERM result = enif_make_new_map(env);
+    for (FIT_UINT16 num : peek_mesg_nums) {
+        size_t i = mesg_converter_index[num];
+        const std::vector<ERL_NIF_TERM>& messages = collector.messages[i];
+        ERL_NIF_TERM list = enif_make_list_from_array(env, messages.data(), messages.size());
+        enif_make_map_put(env, result, mesg_converters[i].key, list, &result);
+    }
+
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+}
+
+// Message counts and sizes of one global message type in a census.
+struct TypeCensus {
+    FIT_UINT16 num;
+    uint64_t messages;
+    uint64_t bytes;  // Of its data messages, header bytes included
+    uint64_t definitions;
+    uint64_t developer_bytes;  // Of the developer fields in its data messages
+};
+
+// Number of data messages carrying one developer field.
+struct DeveloperFieldCensus {
+    FIT_UINT8 developer_data_index;
+    FIT_UINT8 num;
+    uint64_t messages;
+};
+
+// Tallies the messages of a walk by global type without looking at their fields.
+struct CensusVisitor {
+    uint64_t files = 0;
+    uint64_t bytes = 0;  // Data bytes of all files
+    uint64_t definitions = 0;
+    uint64_t messages = 0;
+    std::vector<TypeCensus> types;  // In order of first definition
+    std::vector<DeveloperFieldCensus> developer_fields;
+
+    void OnFile(size_t data_size) {
+        files++;
+        bytes += data_size;
+    }
+
+    void OnDefinition(FIT_UINT8 local, const LocalDefinition& definition, const unsigned char* begin,
+                      const unsigned char*) {
+        definitions++;
+        auto entry = type_index.find(definition.num);
+        if (entry == type_index.end()) {
+            entry = type_index.insert({definition.num, types.size()}).first;
+            types.push_back({definition.num, 0, 0, 0, 0});
+        }
+        types[entry->second].definitions++;
+        local_types[local] = entry->second;
+
+        // walk_messages has checked the developer field definitions fit
+        std::vector<size_t>& dev_fields = local_dev_fields[local];
+        dev_fields.clear();
+        if (begin[0] & FIT_HDR_DEV_FIELD_BIT) {
+            const unsigned char* dev = begin + 6 + begin[5] * 3;
+            for (size_t i = 0; i < dev[0]; i++) {
+                FIT_UINT8 num = dev[1 + i * 3];
+                FIT_UINT8 developer_data_index = dev[3 + i * 3];
+                size_t j = 0;
+                while (j < developer_fields.size() && (developer_fields[j].num != num ||
+                                                       developer_fields[j].developer_data_index != developer_data_index)) {
+                    j++;
+                }
+                if (j == developer_fields.size()) {
+                    developer_fields.push_back({developer_data_index, num, 0});
+                }
+                dev_fields.push_back(j);
+            }
+        }
+    }
+
+    void OnData(FIT_UINT8 local, const LocalDefinition& definition, const unsigned char*) {
+        messages++;
+        TypeCensus& type = types[local_types[local]];
+        type.messages++;
+        type.bytes += definition.size;
+        type.developer_bytes += definition.dev_size;
+        for (size_t i : local_dev_fields[local]) {
+            developer_fields[i].messages++;
+        }
+    }
+
+private:
+    std::map<FIT_UINT16, size_t> type_index;  // Into types, by global message number
+    size_t local_types[FIT_MAX_LOCAL_MESGS] = {};
+    std::vector<size_t> local_dev_fields[FIT_MAX_LOCAL_MESGS];  // Into developer_fields
+};
+
+// Counts the messages of a FIT binary by type without decoding any of them. Returns
+// {:ok, %{files:, bytes:, definitions:, messages:, types:, developer_fields:}}, where types
+// maps each global message type, by profile name or else by number, to
+// %{messages:, bytes:, definitions:, developer_bytes:}, and developer_fields maps
+// {developer_data_index, field_number} to the number of data messages carrying it.
+static ERL_NIF_TERM census_fit_file_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifBinary fit_binary;
+    if (!enif_inspect_binary(env, argv[0], &fit_binary)) {
+        return enif_make_badarg(env);
+    }
+
+    CensusVisitor census;
+    if (fit_binary.size > 0 && !walk_messages(fit_binary.data, fit_binary.size, census)) {
+        return enif_make_atom(env, "error_integrity_check_failed");
+    }
+
+    ERL_NIF_TERM type_keys[] = {enif_make_atom(env, "messages"), enif_make_atom(env, "bytes"),
+                                enif_make_atom(env, "definitions"), enif_make_atom(env, "developer_bytes")};
+    ERL_NIF_TERM types = enif_make_new_map(env);
+    for (const TypeCensus& type : census.types) {
+        ERL_NIF_TERM values[] = {enif_make_uint64(env, type.messages), enif_make_uint64(env, type.bytes),
+                                 enif_make_uint64(env, type.definitions), enif_make_uint64(env, type.developer_bytes)};
+        ERL_NIF_TERM tallies;
+        enif_make_map_from_arrays(env, type_keys, values, 4, &tallies);
+
+        auto entry = mesg_converter_index.find(type.num);
+        ERL_NIF_TERM key = entry == mesg_converter_index.end() ? enif_make_uint(env, type.num)
+                                                               : mesg_converters[entry->second].key;
+        enif_make_map_put(env, types, key, tallies, &types);
+    }
+
+    ERL_NIF_TERM developer_fields = enif_make_new_map(env);
+    for (const DeveloperFieldCensus& field : census.developer_fields) {
+        ERL_NIF_TERM key = enif_make_tuple2(env, enif_make_uint(env, field.developer_data_index),
+                                            enif_make_uint(env, field.num));
+        enif_make_map_put(env, developer_fields, key, enif_make_uint64(env, field.messages), &developer_fields);
+    }
+
+    ERL_NIF_TERM keys[] = {enif_make_atom(env, "files"), enif_make_atom(env, "bytes"),
+                           enif_make_atom(env, "definitions"), enif_make_atom(env, "messages"),
+                           enif_make_atom(env, "types"), enif_make_atom(env, "developer_fields")};
+    ERL_NIF_TERM values[] = {enif_make_uint64(env, census.files), enif_make_uint64(env, census.bytes),
+                             enif_make_uint64(env, census.definitions), enif_make_uint64(env, census.messages),
+                             types, developer_fields};
+    ERL_NIF_TERM result;
+    enif_make_map_from_arrays(env, keys, values, 6, &result);
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), result);
+}
+
+// A decoded activity kept in native memory behind a resource, so callers can ask for
+// a few numbers without copying every record onto a process heap.
+struct Activity {
+    RecordColumns records;
+    ActivitySummary summary;
+    SessionTracker sessions;
+    std::vector<DeviceTimeInZone> time_in_zones;
+    std::vector<DeviceSessionElevation> session_elevations;
+    std::vector<DeviceClimbPro> climb_pro;
+
+    Activity() : summary(), sessions(3600) {}
+};
+
+static ErlNifResourceType* activity_resource_type = nullptr;
+
+static void activity_destructor(ErlNifEnv* env, void* obj) {
+    static_cast<Activity*>(obj)->~Activity();
+}
+
+static bool get_activity(ErlNifEnv* env, ERL_NIF_TERM term, Activity** activity) {
+    return enif_get_resource(env, term, activity_resource_type, reinterpret_cast<void**>(activity));
+}
+
+// Maps a record field atom such as :heart_rate to its record_fields entry.
+static const RecordField* find_record_field(ErlNifEnv* env, ERL_NIF_TERM atom) {
+    char name[64];
+    if (!enif_get_atom(env, atom, name, sizeof(name), ERL_NIF_LATIN1)) {
+        return nullptr;
+    }
+
+    for (const RecordField& field : record_fields) {
+        if (strcmp(field.name, name) == 0) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+// Reads the fields, point count and method arguments of the downsample NIFs.
+static bool get_downsample_args(ErlNifEnv* env, const ERL_NIF_TERM argv[], std::vector<FIT_UINT8>* fields,
+                                size_t* max_points, DownsampleMethod* method) {
+    ERL_NIF_TERM list = argv[0];
+    ERL_NIF_TERM head;
+    while (enif_get_list_cell(env, list, &head, &list)) {
+        const RecordField* field = find_record_field(env, head);
+        if (field == nullptr) {
+            return false;
+        }
+        fields->push_back((FIT_UINT8)(field - record_fields));
+    }
+
+    ErlNifUInt64 points;
+    if (!enif_is_empty_list(env, list) || fields->empty() || !enif_get_uint64(env, argv[1], &points) || points == 0) {
+        return false;
+    }
+    *max_points = (size_t)points;
+
+    if (enif_is_identical(argv[2], enif_make_atom(env, "lttb"))) {
+        *method = DOWNSAMPLE_LTTB;
+    } else if (enif_is_identical(argv[2], enif_make_atom(env, "minmax"))) {
+        *method = DOWNSAMPLE_MINMAX;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// %{timestamp: [...], field => [...]} for the picked records, nil where one lacks a field.
+static ERL_NIF_TERM make_downsampled(ErlNifEnv* env, const RecordColumns& records,
+                                     const std::vector<FIT_UINT8>& fields, const std::vector<size_t>& picked) {
+    ERL_NIF_TERM nil = enif_make_atom(env, "nil");
+    std::vector<ERL_NIF_TERM> terms(picked.size());
+    for (size_t i = 0; i < picked.size(); i++) {
+        terms[i] = enif_make_uint(env, records.Timestamp(picked[i]));
+    }
+
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    enif_make_map_put(env, map, enif_make_atom(env, "timestamp"),
+                      enif_make_list_from_array(env, terms.data(), terms.size()), &map);
+    double value;
+    for (FIT_UINT8 index : fields) {
+        for (size_t i = 0; i < picked.size(); i++) {
+            terms[i] = records.GetValue(index, picked[i], &value) ? make_record_value(env, record_fields[index], value)
+                                                                  : nil;
+        }
+        enif_make_map_put(env, map, enif_make_atom(env, record_fields[index].name),
+                          enif_make_list_from_array(env, terms.data(), terms.size()), &map);
+    }
+    return map;
+}
+
+// Decodes a FIT binary and downsamples the record fields argv[1] to at most argv[2] points
+// with method argv[3], without building any record map. Returns {:ok, map} like
+// make_downsampled.
+static ERL_NIF_TERM downsample_fit_file_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifBinary fit_binary;
+    std::vector<FIT_UINT8> fields;
+    size_t max_points;
+    DownsampleMethod method;
+    if (argc != 4 || !enif_inspect_binary(env, argv[0], &fit_binary) ||
+        !get_downsample_args(env, argv + 1, &fields, &max_points, &method)) {
+        return enif_make_badarg(env);
+    }
+
+    Listener listener;
+    ERL_NIF_TERM error;
+    if (!decode_binary(env, fit_binary, listener, &error)) {
+        return error;
+    }
+
+    std::vector<size_t> picked = downsample_records(listener.records, fields, max_points, method);
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), make_downsampled(env, listener.records, fields, picked));
+}
+
+// Decodes a FIT binary and measures its elapsed, timer and moving time from timer events
+// and records, counting intervals of at least argv[1] m/s as moving, without storing any
+// record. Returns {:ok, elapsed, timer | nil, moving | nil, [{pause_start, pause_end}]} in
+// seconds, {:error, :no_records} or an error atom.
+static ERL_NIF_TERM moving_time_fit_file_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    ErlNifBinary fit_binary;
+    double speed_threshold;
+    if (argc != 2 || !enif_inspect_binary(env, argv[0], &fit_binary) ||
+        !get_number(env, argv[1], &speed_threshold) || speed_threshold < 0.0) {
+        return enif_make_badarg(env);
+    }
+
+    MotionTracker tracker(speed_threshold);
+    Listener listener(false);
+    listener.motion_tracker = &tracker;
+    ERL_NIF_TERM error;
+    if (!decode_binary(env, fit_binary, listener, &error)) {
+        return error;
+    }
+
+    if (!tracker.HasRecords()) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "no_records"));
+    }
+
+    unsigned int seconds;
+    ERL_NIF_TERM timer_time = tracker.GetTimerTime(&seconds) ? enif_make_uint(env, seconds) : enif_make_atom(env, "nil");
+    ERL_NIF_TERM moving_time = tracker.GetMovingTime(&seconds) ? enif_make_uint(env, seconds) : enif_make_atom(env, "nil");
+    std::vector<ERL_NIF_TERM> pauses;
+    for (const Pause& pause : tracker.pauses) {
+        pauses.push_back(enif_make_tuple2(env, enif_make_uint(env, pause.start_time), enif_make_uint(env, pause.end_time)));
+    }
+
+    return enif_make_tuple5(env, enif_make_atom(env, "ok"), enif_make_uint(env, tracker.ElapsedTime()), timer_time,
+                            moving_time, enif_make_list_from_array(env, pauses.data(), pauses.size()));
+}
+
+// Decodes a FIT binary into an Activity resource. Returns {:ok, activity} or an error atom.
+static ERL_NIF_TERM open_activity_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifBinary fit_binary;
+    if (!enif_inspect_binary(env, argv[0], &fit_binary)) {
+        return enif_make_badarg(env);
+    }
+
+    Activity* activity = new (enif_alloc_resource(activity_resource_type, sizeof(Activity))) Activity();
+    ERL_NIF_TERM error;
+    bool decoded;
+    {
+        Listener listener;
+        listener.session_tracker = &activity->sessions;
+        decoded = decode_binary(env, fit_binary, listener, &error);
+        if (decoded) {
+            activity->records = std::move(listener.records);
+            activity->records.ShrinkToFit();
+            activity->summary = listener.summary;
+            activity->time_in_zones = std::move(listener.time_in_zones);
+            activity->session_elevations = std::move(listener.session_elevations);
+            activity->climb_pro = std::move(listener.climb_pro);
+        }
+    }
+
+    if (!decoded) {
+        enif_release_resource(activity);
+        return error;
+    }
+
+    ERL_NIF_TERM term = enif_make_resource(env, activity);
+    enif_release_resource(activity);
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), term);
+}
+
+// Number of records held by the activity.
+static ERL_NIF_TERM activity_record_count_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    if (argc != 1 || !get_activity(env, argv[0], &activity)) {
+        return enif_make_badarg(env);
+    }
+
+    return enif_make_uint64(env, activity->records.size());
+}
+
+// Unix timestamp of the first record, or nil.
+static ERL_NIF_TERM activity_first_timestamp_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    if (argc != 1 || !get_activity(env, argv[0], &activity)) {
+        return enif_make_badarg(env);
+    }
+
+    if (activity->records.size() == 0) {
+        return enif_make_atom(env, "nil");
+    }
+    return enif_make_uint(env, activity->records.Timestamp(0));
+}
+
+// Duration of the longest session, with the same results as FitDecoder.get_activity_duration/1.
+static ERL_NIF_TERM activity_duration_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    if (argc != 1 || !get_activity(env, argv[0], &activity)) {
+        return enif_make_badarg(env);
+    }
+
+    const Session* longest = activity->sessions.Longest();
+    if (longest == nullptr) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "no_records"));
+    }
+    if (longest->start_time == longest->end_time) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "insufficient_data"));
+    }
+
+    return enif_make_tuple2(env, enif_make_atom(env, "ok"), enif_make_uint(env, longest->end_time - longest->start_time));
+}
+
+// Session boundaries of the activity (one hour gap), as returned by decode_sessions.
+static ERL_NIF_TERM activity_sessions_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    if (argc != 1 || !get_activity(env, argv[0], &activity)) {
+        return enif_make_badarg(env);
+    }
+
+    return make_session_list(env, activity->sessions);
+}
+
+// %{min:, max:, avg:, count:} over the records carrying argv[1], or nil if none do.
+static ERL_NIF_TERM activity_field_stats_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    if (argc != 2 || !get_activity(env, argv[0], &activity)) {
+        return enif_make_badarg(env);
+    }
+
+    const RecordField* field = find_record_field(env, argv[1]);
+    if (field == nullptr) {
+        return enif_make_badarg(env);
+    }
+
+    FieldStats stats = {};
+    double value;
+    FIT_UINT8 index = (FIT_UINT8)(field - record_fields);
+    for (size_t record = 0; record < activity->records.size(); record++) {
+        if (activity->records.GetValue(index, record, &value)) {
+            stats.add(value);
+        }
+    }
+
+    ERL_NIF_TERM map = make_field_stats(env, stats, field->type != RECORD_VALUE_FLOAT32);
+    if (stats.count > 0) {
+        enif_make_map_put(env, map, enif_make_atom(env, "count"), enif_make_uint64(env, stats.count), &map);
+    }
+    return map;
+}
+
+// [{duration, mean, start_time}] for the record field argv[1] over each duration in argv[2],
+// a list of seconds, or :log for the mean_max_durations up to the longest segment followed by
+// that segment's length. Durations longer than every segment are left out.
+static ERL_NIF_TERM activity_mean_max_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    if (argc != 3 || !get_activity(env, argv[0], &activity)) {
+        return enif_make_badarg(env);
+    }
+
+    const RecordField* field = find_record_field(env, argv[1]);
+    if (field == nullptr) {
+        return enif_make_badarg(env);
+    }
+
+    SecondSeries series(activity->records, (FIT_UINT8)(field - record_fields));
+    std::vector<size_t> durations;
+    if (enif_is_identical(argv[2], enif_make_atom(env, "log"))) {
+        size_t longest = series.LongestSegment();
+        for (unsigned int duration : mean_max_durations) {
+            if (duration < longest) {
+                durations.push_back(duration);
+            }
+        }
+        if (longest > 0) {
+            durations.push_back(longest);
+        }
+    } else {
+        ERL_NIF_TERM list = argv[2];
+        ERL_NIF_TERM head;
+        ErlNifUInt64 duration;
+        while (enif_get_list_cell(env, list, &head, &list)) {
+            if (!enif_get_uint64(env, head, &duration) || duration == 0) {
+                return enif_make_badarg(env);
+            }
+            durations.push_back((size_t)duration);
+        }
+        if (!enif_is_empty_list(env, list)) {
+            return enif_make_badarg(env);
+        }
+    }
+
+    MeanMax mean_max(series);
+    std::vector<ERL_NIF_TERM> points;
+    for (size_t duration : durations) {
+        double mean;
+        unsigned int start_time;
+        if (mean_max.Best(duration, &mean, &start_time)) {
+            points.push_back(enif_make_tuple3(env, enif_make_uint64(env, duration), enif_make_double(env, mean),
+                                              enif_make_uint(env, start_time)));
+        }
+    }
+    return enif_make_list_from_array(env, points.data(), points.size());
+}
+
+// Seconds the activity spent in each zone of record field argv[1], for the ascending high
+// boundaries in argv[2]. Returns a list one longer than the boundaries.
+static ERL_NIF_TERM activity_time_in_zone_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    if (argc != 3 || !get_activity(env, argv[0], &activity)) {
+        return enif_make_badarg(env);
+    }
+
+    const RecordField* field = find_record_field(env, argv[1]);
+    if (field == nullptr) {
+        return enif_make_badarg(env);
+    }
+
+    std::vector<double> bounds;
+    ERL_NIF_TERM list = argv[2];
+    ERL_NIF_TERM head;
+    double bound;
+    while (enif_get_list_cell(env, list, &head, &list)) {
+        if (!get_number(env, head, &bound) || (!bounds.empty() && bound <= bounds.back())) {
+            return enif_make_badarg(env);
+        }
+        bounds.push_back(bound);
+    }
+    if (!enif_is_empty_list(env, list)) {
+        return enif_make_badarg(env);
+    }
+
+    std::vector<uint64_t> seconds = time_in_zones(activity->records, (FIT_UINT8)(field - record_fields), bounds);
+    std::vector<ERL_NIF_TERM> terms(seconds.size());
+    for (size_t i = 0; i < seconds.size(); i++) {
+        terms[i] = enif_make_uint64(env, seconds[i]);
+    }
+    return enif_make_list_from_array(env, terms.data(), terms.size());
+}
+
+// Integers or floats, with nil for NaN.
+static ERL_NIF_TERM make_number_list(ErlNifEnv* env, const std::vector<double>& values, bool integer) {
+    std::vector<ERL_NIF_TERM> terms(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        if (std::isnan(values[i])) {
+            terms[i] = enif_make_atom(env, "nil");
+        } else {
+            terms[i] = integer ? enif_make_int64(env, (int64_t)values[i]) : enif_make_double(env, values[i]);
+        }
+    }
+    return enif_make_list_from_array(env, terms.data(), terms.size());
+}
+
+// The activity's time_in_zone messages as maps of timestamp, reference_mesg, reference_index
+// and, per record field, %{high_boundaries:, seconds:} or nil.
+static ERL_NIF_TERM activity_device_time_in_zone_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    if (argc != 1 || !get_activity(env, argv[0], &activity)) {
+        return enif_make_badarg(env);
+    }
+
+    ERL_NIF_TERM nil = enif_make_atom(env, "nil");
+    ERL_NIF_TERM zone_keys[2] = {enif_make_atom(env, "high_boundaries"), enif_make_atom(env, "seconds")};
+    ERL_NIF_TERM keys[3 + TIME_IN_ZONE_FIELD_COUNT] = {
+        enif_make_atom(env, "timestamp"),
+        enif_make_atom(env, "reference_mesg"),
+        enif_make_atom(env, "reference_index")
+    };
+    // Boundaries take the form of the record field's values, and the times are in seconds
+    bool integer_boundaries[TIME_IN_ZONE_FIELD_COUNT];
+    for (size_t i = 0; i < TIME_IN_ZONE_FIELD_COUNT; i++) {
+        const RecordField& field = record_fields[record_field_index[time_in_zone_fields[i].record_field]];
+        keys[3 + i] = enif_make_atom(env, field.name);
+        integer_boundaries[i] = field.type != RECORD_VALUE_FLOAT32;
+    }
+
+    std::vector<ERL_NIF_TERM> messages;
+    for (const DeviceTimeInZone& message : activity->time_in_zones) {
+        ERL_NIF_TERM values[3 + TIME_IN_ZONE_FIELD_COUNT];
+        values[0] = message.timestamp != 0 ? enif_make_uint(env, message.timestamp) : nil;
+        values[1] = message.reference_mesg != FIT_UINT16_INVALID ? enif_make_uint(env, message.reference_mesg) : nil;
+        values[2] = message.reference_index != FIT_UINT16_INVALID ? enif_make_uint(env, message.reference_index) : nil;
+
+        for (size_t i = 0; i < TIME_IN_ZONE_FIELD_COUNT; i++) {
+            const DeviceZones& zones = message.zones[i];
+            values[3 + i] = nil;
+            if (!zones.high_boundaries.empty() || !zones.seconds.empty()) {
+                ERL_NIF_TERM zone_values[2] = {make_number_list(env, zones.high_boundaries, integer_boundaries[i]),
+                                               make_number_list(env, zones.seconds, false)};
+                enif_make_map_from_arrays(env, zone_keys, zone_values, 2, &values[3 + i]);
+            }
+        }
+
+        ERL_NIF_TERM map;
+        enif_make_map_from_arrays(env, keys, values, 3 + TIME_IN_ZONE_FIELD_COUNT, &map);
+        messages.push_back(map);
+    }
+    return enif_make_list_from_array(env, messages.data(), messages.size());
+}
+
+static bool get_resample_policy(ErlNifEnv* env, ERL_NIF_TERM term, ResamplePolicy* policy) {
+    if (enif_is_identical(term, enif_make_atom(env, "linear"))) {
+        *policy = RESAMPLE_LINEAR;
+    } else if (enif_is_identical(term, enif_make_atom(env, "previous"))) {
+        *policy = RESAMPLE_PREVIOUS;
+    } else if (enif_is_identical(term, enif_make_atom(env, "none"))) {
+        *policy = RESAMPLE_NONE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Resamples record fields onto a regular grid. argv[1] is a list of {field, policy}, or
+// {:all, policy} for every field with a value, and argv[2] is {interval, max_gap,
+// start_time, end_time}, with nil start and end times spanning the records. Returns
+// {:ok, start_time, count, [{field, binary}]} with count native-endian doubles per binary,
+// NaN where missing, or {:error, :no_records} or {:error, :too_many_points}.
+static ERL_NIF_TERM activity_resample_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    int arity;
+    const ERL_NIF_TERM* grid;
+    unsigned int interval;
+    unsigned int max_gap;
+    if (argc != 3 || !get_activity(env, argv[0], &activity) || !enif_get_tuple(env, argv[2], &arity, &grid) ||
+        arity != 4 || !enif_get_uint(env, grid[0], &interval) || interval == 0 ||
+        !enif_get_uint(env, grid[1], &max_gap)) {
+        return enif_make_badarg(env);
+    }
+
+    const RecordColumns& records = activity->records;
+    std::vector<std::pair<FIT_UINT8, ResamplePolicy>> fields;
+    const ERL_NIF_TERM* all;
+    ResamplePolicy policy;
+    bool all_fields = enif_get_tuple(env, argv[1], &arity, &all) && arity == 2 &&
+                      enif_is_identical(all[0], enif_make_atom(env, "all"));
+    if (all_fields) {
+        if (!get_resample_policy(env, all[1], &policy)) {
+            return enif_make_badarg(env);
+        }
+        for (FIT_UINT8 index : records.fields()) {
+            if (index != 0) {
+                fields.push_back({index, policy});
+            }
+        }
+    } else {
+        ERL_NIF_TERM list = argv[1];
+        ERL_NIF_TERM head;
+        const ERL_NIF_TERM* option;
+        while (enif_get_list_cell(env, list, &head, &list)) {
+            const RecordField* field;
+            if (!enif_get_tuple(env, head, &arity, &option) || arity != 2 ||
+                (field = find_record_field(env, option[0])) == nullptr || !get_resample_policy(env, option[1], &policy)) {
+                return enif_make_badarg(env);
+            }
+            fields.push_back({(FIT_UINT8)(field - record_fields), policy});
+        }
+        if (!enif_is_empty_list(env, list)) {
+            return enif_make_badarg(env);
+        }
+    }
+
+    ERL_NIF_TERM nil = enif_make_atom(env, "nil");
+    unsigned int start_time = activity->summary.start_time;
+    unsigned int end_time = activity->summary.end_time;
+    if ((!enif_is_identical(grid[2], nil) && !enif_get_uint(env, grid[2], &start_time)) ||
+        (!enif_is_identical(grid[3], nil) && !enif_get_uint(env, grid[3], &end_time))) {
+        return enif_make_badarg(env);
+    }
+    if (activity->summary.record_count == 0 && (enif_is_identical(grid[2], nil) || enif_is_identical(grid[3], nil))) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "no_records"));
+    }
+
+    uint64_t count = end_time >= start_time ? (end_time - start_time) / interval + 1 : 0;
+    if (count > RESAMPLE_MAX_POINTS) {
+        return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "too_many_points"));
+    }
+
+    std::vector<double> values(count);
+    std::vector<ERL_NIF_TERM> columns;
+    for (const auto& entry : fields) {
+        std::vector<TimedValue> samples = time_ordered_samples(records, entry.first);
+        if (samples.empty() && all_fields) {
+            continue;  // A column every record left invalid
+        }
+
+        resample_field(samples, entry.second, start_time, interval, max_gap, count, values.data());
+        ERL_NIF_TERM binary;
+        unsigned char* data = enif_make_new_binary(env, count * sizeof(double), &binary);
+        if (count > 0) {
+            memcpy(data, values.data(), count * sizeof(double));
+        }
+        columns.push_back(enif_make_tuple2(env, enif_make_atom(env, record_fields[entry.first].name), binary));
+    }
+
+    return enif_make_tuple4(env, enif_make_atom(env, "ok"), enif_make_uint(env, start_time), enif_make_uint64(env, count),
+                            enif_make_list_from_array(env, columns.data(), columns.size()));
+}
+
+// The activity's GPS track in degrees, simplified by argv[1], :douglas_peucker or
+// :visvalingam, to a tolerance of argv[2] meters, as argv[3]: :points for a list of
+// {lat, lon}, :polyline for a Google encoded polyline or :float32 for a binary of
+// native-endian lat, lon pairs.
+static ERL_NIF_TERM activity_track_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    double tolerance;
+    if (argc != 4 || !get_activity(env, argv[0], &activity) || !get_number(env, argv[2], &tolerance) ||
+        tolerance < 0.0) {
+        return enif_make_badarg(env);
+    }
+
+    bool visvalingam_whyatt = enif_is_identical(argv[1], enif_make_atom(env, "visvalingam"));
+    if (!visvalingam_whyatt && !enif_is_identical(argv[1], enif_make_atom(env, "douglas_peucker"))) {
+        return enif_make_badarg(env);
+    }
+
+    std::vector<TrackPoint> points = track_points(activity->records);
+    std::vector<bool> keep(points.size(), true);
+    if (tolerance > 0.0 && points.size() > 2) {
+        if (visvalingam_whyatt) {
+            visvalingam(points, tolerance * tolerance, &keep);
+        } else {
+            std::fill(keep.begin(), keep.end(), false);
+            keep.front() = keep.back() = true;
+            douglas_peucker(points, tolerance, &keep);
+        }
+    }
+
+    if (enif_is_identical(argv[3], enif_make_atom(env, "points"))) {
+        std::vector<ERL_NIF_TERM> terms;
+        for (size_t i = 0; i < points.size(); i++) {
+            if (keep[i]) {
+                terms.push_back(enif_make_tuple2(env, enif_make_double(env, points[i].lat),
+                                                 enif_make_double(env, points[i].lon)));
+            }
+        }
+        return enif_make_list_from_array(env, terms.data(), terms.size());
+    }
+
+    if (enif_is_identical(argv[3], enif_make_atom(env, "polyline"))) {
+        std::string polyline;
+        int64_t last_lat = 0;
+        int64_t last_lon = 0;
+        for (size_t i = 0; i < points.size(); i++) {
+            if (keep[i]) {
+                int64_t lat = (int64_t)std::llround(points[i].lat * 1e5);
+                int64_t lon = (int64_t)std::llround(points[i].lon * 1e5);
+                append_polyline_value(lat - last_lat, &polyline);
+                append_polyline_value(lon - last_lon, &polyline);
+                last_lat = lat;
+                last_lon = lon;
+            }
+        }
+        return make_string(env, polyline);
+    }
+
+    if (enif_is_identical(argv[3], enif_make_atom(env, "float32"))) {
+        std::vector<float> packed;
+        for (size_t i = 0; i < points.size(); i++) {
+            if (keep[i]) {
+                packed.push_back((float)points[i].lat);
+                packed.push_back((float)points[i].lon);
+            }
+        }
+        ERL_NIF_TERM binary;
+        unsigned char* data = enif_make_new_binary(env, packed.size() * sizeof(float), &binary);
+        if (!packed.empty()) {
+            memcpy(data, packed.data(), packed.size() * sizeof(float));
+        }
+        return binary;
+    }
+
+    return enif_make_badarg(env);
+}
+
+// Downsamples the activity's record fields argv[1] to at most argv[2] points with method
+// argv[3], like downsample_fit_file_nif.
+static ERL_NIF_TERM activity_downsample_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    std::vector<FIT_UINT8> fields;
+    size_t max_points;
+    DownsampleMethod method;
+    if (argc != 4 || !get_activity(env, argv[0], &activity) ||
+        !get_downsample_args(env, argv + 1, &fields, &max_points, &method)) {
+        return enif_make_badarg(env);
+    }
+
+    std::vector<size_t> picked = downsample_records(activity->records, fields, max_points, method);
+    return make_downsampled(env, activity->records, fields, picked);
+}
+
+static ERL_NIF_TERM make_optional_number(ErlNifEnv* env, double value, bool integer) {
+    if (std::isnan(value)) {
+        return enif_make_atom(env, "nil");
+    }
+    return integer ? enif_make_int64(env, (int64_t)value) : enif_make_double(env, value);
+}
+
+// Elevation gain, loss, extremes and climbs of the activity, with the device's own session
+// totals and ClimbPro events. argv[1] is :none, {:median, samples} or {:exponential,
+// seconds}, argv[2] the hysteresis threshold and argv[3] the least gain of a climb, in meters.
+static ERL_NIF_TERM activity_elevation_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    ElevationSettings settings;
+    if (argc != 4 || !get_activity(env, argv[0], &activity) || !get_number(env, argv[2], &settings.threshold) ||
+        settings.threshold <= 0.0 || !get_number(env, argv[3], &settings.min_climb)) {
+        return enif_make_badarg(env);
+    }
+
+    int arity;
+    const ERL_NIF_TERM* smoothing;
+    ErlNifUInt64 window;
+    if (enif_is_identical(argv[1], enif_make_atom(env, "none"))) {
+        settings.smoothing = ElevationSettings::SMOOTH_NONE;
+    } else if (!enif_get_tuple(env, argv[1], &arity, &smoothing) || arity != 2) {
+        return enif_make_badarg(env);
+    } else if (enif_is_identical(smoothing[0], enif_make_atom(env, "median")) &&
+               enif_get_uint64(env, smoothing[1], &window) && window % 2 == 1) {
+        settings.smoothing = ElevationSettings::SMOOTH_MEDIAN;
+        settings.window = (size_t)window;
+    } else if (enif_is_identical(smoothing[0], enif_make_atom(env, "exponential")) &&
+               get_number(env, smoothing[1], &settings.time_constant) && settings.time_constant > 0.0) {
+        settings.smoothing = ElevationSettings::SMOOTH_EXPONENTIAL;
+    } else {
+        return enif_make_badarg(env);
+    }
+
+    ElevationProfile profile(activity->records, settings);
+    std::vector<ERL_NIF_TERM> climbs;
+    for (const Climb& climb : profile.climbs) {
+        ERL_NIF_TERM keys[5] = {
+            enif_make_atom(env, "start_time"), enif_make_atom(env, "end_time"), enif_make_atom(env, "gain"),
+            enif_make_atom(env, "distance"), enif_make_atom(env, "grade")
+        };
+        double grade = climb.distance > 0.0 ? climb.gain / climb.distance * 100.0 : NAN;
+        ERL_NIF_TERM values[5] = {
+            enif_make_uint(env, climb.start_time), enif_make_uint(env, climb.end_time),
+            enif_make_double(env, climb.gain), make_optional_number(env, climb.distance, false),
+            make_optional_number(env, grade, false)
+        };
+        ERL_NIF_TERM map;
+        enif_make_map_from_arrays(env, keys, values, 5, &map);
+        climbs.push_back(map);
+    }
+
+    std::vector<ERL_NIF_TERM> sessions;
+    for (const DeviceSessionElevation& session : activity->session_elevations) {
+        ERL_NIF_TERM keys[4] = {
+            enif_make_atom(env, "total_ascent"), enif_make_atom(env, "total_descent"),
+            enif_make_atom(env, "max_altitude"), enif_make_atom(env, "min_altitude")
+        };
+        ERL_NIF_TERM values[4] = {
+            make_optional_number(env, session.total_ascent, true), make_optional_number(env, session.total_descent, true),
+            make_optional_number(env, session.max_altitude, false), make_optional_number(env, session.min_altitude, false)
+        };
+        ERL_NIF_TERM map;
+        enif_make_map_from_arrays(env, keys, values, 4, &map);
+        sessions.push_back(map);
+    }
+
+    std::vector<ERL_NIF_TERM> climb_pro;
+    for (const DeviceClimbPro& event : activity->climb_pro) {
+        ERL_NIF_TERM keys[5] = {
+            enif_make_atom(env, "timestamp"), enif_make_atom(env, "climb_pro_event"),
+            enif_make_atom(env, "climb_number"), enif_make_atom(env, "climb_category"),
+            enif_make_atom(env, "current_dist")
+        };
+        ERL_NIF_TERM values[5] = {
+            make_optional_number(env, event.timestamp, true), make_optional_number(env, event.event, true),
+            make_optional_number(env, event.climb_number, true), make_optional_number(env, event.climb_category, true),
+            make_optional_number(env, event.current_dist, false)
+        };
+        ERL_NIF_TERM map;
+        enif_make_map_from_arrays(env, keys, values, 5, &map);
+        climb_pro.push_back(map);
+    }
+
+    ERL_NIF_TERM device_keys[2] = {enif_make_atom(env, "sessions"), enif_make_atom(env, "climb_pro")};
+    ERL_NIF_TERM device_values[2] = {
+        enif_make_list_from_array(env, sessions.data(), sessions.size()),
+        enif_make_list_from_array(env, climb_pro.data(), climb_pro.size())
+    };
+    ERL_NIF_TERM device;
+    enif_make_map_from_arrays(env, device_keys, device_values, 2, &device);
+
+    ERL_NIF_TERM keys[6] = {
+        enif_make_atom(env, "gain"), enif_make_atom(env, "loss"), enif_make_atom(env, "max"),
+        enif_make_atom(env, "min"), enif_make_atom(env, "climbs"), enif_make_atom(env, "device")
+    };
+    ERL_NIF_TERM values[6] = {
+        make_optional_number(env, profile.gain, false), make_optional_number(env, profile.loss, false),
+        make_optional_number(env, profile.max, false), make_optional_number(env, profile.min, false),
+        enif_make_list_from_array(env, climbs.data(), climbs.size()), device
+    };
+    ERL_NIF_TERM map;
+    enif_make_map_from_arrays(env, keys, values, 6, &map);
+    return map;
+}
+
+// Training load metrics of the activity for the settings in argv[1], a keyword list.
+static ERL_NIF_TERM activity_training_load_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    LoadSettings settings;
+    if (argc != 2 || !get_activity(env, argv[0], &activity) || !get_load_settings(env, argv[1], &settings)) {
+        return enif_make_badarg(env);
+    }
+
+    return make_training_load(env, TrainingLoad(activity->records, settings));
+}
+
+// Record maps for argv[1] records starting at index argv[2], like Enum.slice/3.
+static ERL_NIF_TERM activity_slice_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    Activity* activity;
+    ErlNifUInt64 start, amount;
+    if (argc != 3 || !get_activity(env, argv[0], &activity) ||
+        !enif_get_uint64(env, argv[1], &start) || !enif_get_uint64(env, argv[2], &amount)) {
+        return enif_make_badarg(env);
+    }
+
+    size_t size = activity->records.size();
+    size_t first = start < size ? start : size;
+    size_t last = amount < size - first ? first + amount : size;
+    return make_record_list(env, activity->records, first, last);
+}
+
+// Builds {:ok, file_count} or {:error, reason, byte_offset} from a verify result.
+static ERL_NIF_TERM make_verify_result(ErlNifEnv* env, const fit::Verify& verify, fit::Verify::STATUS status) {
+    const char* reason;
+
+    switch (status) {
+        case fit::Verify::STATUS_OK:
+            return enif_make_tuple2(env, enif_make_atom(env, "ok"), enif_make_uint(env, verify.GetNumFiles()));
+        case fit::Verify::STATUS_HEADER_INVALID:
+            reason = "header_invalid";
+            break;
+        case fit::Verify::STATUS_HEADER_CRC_FAILED:
+            reason = "header_crc_failed";
+            break;
+        case fit::Verify::STATUS_DATA_SIZE_INVALID:
+            reason = "data_size_invalid";
+            break;
+        case fit::Verify::STATUS_TRUNCATED:
+            reason = "truncated";
+            break;
+        default:
+            reason = "file_crc_failed";
+            break;
+    }
+
+    return enif_make_tuple3(env,
+        enif_make_atom(env, "error"),
+        enif_make_atom(env, reason),
+        enif_make_uint(env, verify.GetErrorOffset()));
+}
+
+// Maps the errno of a failed open/mmap to the atom File.read/1 would return.
+static const char* errno_reason(int err) {
+    switch (err) {
+        case ENOENT: return "enoent";
+        case EACCES: return "eacces";
+        case EISDIR: return "eisdir";
+        case ENOTDIR: return "enotdir";
+        case ENOMEM: return "enomem";
+        case EFBIG: return "efbig";
+        default: return "file_read_failed";
+    }
+}
+
+static ERL_NIF_TERM make_errno_error(ErlNifEnv* env, int err) {
+    return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, errno_reason(err)));
+}
+
+// A FIT file mapped read-only into memory. error is the errno that stopped it, or 0. An
+// empty file maps to no data.
+struct MappedFile {
+    const void* data;
+    size_t size;
+    int error;
+
+    explicit MappedFile(const std::string& path) : data(nullptr), size(0), error(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = errno;
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            error = errno;
+        } else if (S_ISDIR(st.st_mode)) {
+            error = EISDIR;
+        } else if ((unsigned long long)st.st_size > UINT32_MAX) {
+            error = EFBIG;
+        } else if (st.st_size > 0) {
+            void* mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                error = errno;
+            } else {
+                madvise(mapped, (size_t)st.st_size, MADV_SEQUENTIAL);
+                data = mapped;
+                size = (size_t)st.st_size;
+            }
+        }
+
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (data != nullptr) {
+            munmap(const_cast<void*>(data), size);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Checks header and CRC integrity of an in-memory FIT binary without decoding it.
+static ERL_NIF_TERM verify_fit_binary_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifBinary fit_binary;
+    if (!enif_inspect_binary(env, argv[0], &fit_binary) || fit_binary.size > UINT32_MAX) {
+        return enif_make_badarg(env);
+    }
+
+    fit::Verify verify;
+    fit::Verify::STATUS status = verify.CheckBuffer(fit_binary.data, (FIT_UINT32)fit_binary.size);
+
+    return make_verify_result(env, verify, status);
+}
+
+// Same as verify_fit_binary_nif but maps the file instead of copying it onto the BEAM heap.
+static ERL_NIF_TERM verify_fit_path_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    if (argc != 1) {
+        return enif_make_badarg(env);
+    }
+
+    ErlNifBinary path_binary;
+    if (!enif_inspect_binary(env, argv[0], &path_binary)) {
+        return enif_make_badarg(env);
+    }
+
+    std::string path(reinterpret_cast<const char*>(path_binary.data), path_binary.size);
+    MappedFile file(path);
+    if (file.error != 0) {
+        return make_errno_error(env, file.error);
+    }
+
+    fit::Verify verify;
+    fit::Verify::STATUS status = verify.CheckBuffer(file.data, (FIT_UINT32)file.size);
+
+    return make_verify_result(env, verify, status);
+}
+
+// What aggregate_files computes and how it groups the activities.
+struct AggregateSettings {
+    bool metrics[AGGREGATE_METRIC_COUNT];
+    bool series[AGGREGATE_SERIES_COUNT];
+    AggregateGroupBy group_by;
+    int64_t utc_offset;              // Seconds from UTC of the time zone days start in
+    std::vector<size_t> durations;   // Of best_power, in seconds
+    std::vector<double> distances;   // Of fastest, in meters
+    unsigned int bin_widths[2];      // Heart rate and power histogram bins
+    double speed_threshold;          // Of moving_time, in m/s
+};
+
+// Decodes the FIT file at path into a one-activity Aggregate, and the group its first
+// record falls in. Only the records the asked-for metrics need are kept, and only for the
+// length of the call. Returns nullptr, or the name of the error atom.
+static const char* aggregate_file(const std::string& path, const AggregateSettings& settings, int64_t* group,
+                                  Aggregate* aggregate) {
+    MappedFile file(path);
+    if (file.error != 0) {
+        return errno_reason(file.error);
+    }
+
+    bool keep_records = settings.metrics[METRIC_ASCENT] || settings.metrics[METRIC_DESCENT];
+    for (size_t i = 0; i < AGGREGATE_SERIES_COUNT; i++) {
+        keep_records = keep_records || settings.series[i];
+    }
+
+    // Elapsed time spans timer events as well, as in moving_time_fit_file_nif
+    MotionTracker tracker(settings.speed_threshold);
+    Listener listener(keep_records);
+    listener.motion_tracker = &tracker;
+    listener.data_size = file.size;
+    const char* error = decode_buffer(file.data, file.size, listener, listener);
+    if (error != nullptr) {
+        return error;
+    }
+
+    const ActivitySummary& summary = listener.summary;
+    if (summary.record_count == 0) {
+        return "no_records";
+    }
+
+    *group = group_start_day(summary.start_time, settings.utc_offset, settings.group_by);
+    double* metrics = aggregate->metrics;
+    metrics[METRIC_COUNT] = 1.0;
+    metrics[METRIC_DISTANCE] = metrics[METRIC_LONGEST_DISTANCE] =
+        summary.total_distance >= 0.0 ? summary.total_distance : NAN;
+    metrics[METRIC_ELAPSED_TIME] = metrics[METRIC_LONGEST_TIME] = tracker.ElapsedTime();
+    if (summary.speed.count > 0) {
+        metrics[METRIC_MAX_SPEED] = summary.speed.max;
+    }
+    if (summary.heart_rate.count > 0) {
+        metrics[METRIC_MAX_HEART_RATE] = summary.heart_rate.max;
+    }
+    if (summary.power.count > 0) {
+        metrics[METRIC_MAX_POWER] = summary.power.max;
+    }
+
+    unsigned int seconds;
+    if (tracker.GetTimerTime(&seconds)) {
+        metrics[METRIC_TIMER_TIME] = seconds;
+    }
+    if (tracker.GetMovingTime(&seconds)) {
+        metrics[METRIC_MOVING_TIME] = seconds;
+    }
+
+    const RecordColumns& records = listener.records;
+    if (settings.metrics[METRIC_ASCENT] || settings.metrics[METRIC_DESCENT]) {
+        // The defaults of FitDecoder.Activity.elevation/2
+        ElevationSettings elevation;
+        elevation.smoothing = ElevationSettings::SMOOTH_MEDIAN;
+        elevation.window = 5;
+        elevation.time_constant = 0.0;
+        elevation.threshold = 3.0;
+        elevation.min_climb = INFINITY;
+        ElevationProfile profile(records, elevation);
+        metrics[METRIC_ASCENT] = profile.gain;
+        metrics[METRIC_DESCENT] = profile.loss;
+    }
+
+    FIT_UINT8 power = record_field_index[fit::RecordMesg::FieldDefNum::Power];
+    if (settings.series[AGGREGATE_BEST_POWER]) {
+        SecondSeries series(records, power);
+        MeanMax mean_max(series);
+        double mean;
+        unsigned int start_time;
+        for (size_t duration : settings.durations) {
+            aggregate->best_power.push_back(mean_max.Best(duration, &mean, &start_time) ? mean : NAN);
+        }
+    }
+
+    if (settings.series[AGGREGATE_FASTEST]) {
+        FIT_UINT8 distance = record_field_index[fit::RecordMesg::FieldDefNum::Distance];
+        aggregate->fastest = fastest_times(time_ordered_samples(records, distance), settings.distances);
+    }
+
+    const FIT_UINT8 histogram_fields[2] = {record_field_index[fit::RecordMesg::FieldDefNum::HeartRate], power};
+    for (size_t i = 0; i < 2; i++) {
+        if (!settings.series[AGGREGATE_HEART_RATE_HISTOGRAM + i]) {
+            continue;
+        }
+        std::map<int64_t, double>& histogram = aggregate->histograms[i];
+        double width = settings.bin_widths[i];
+        for_each_held_sample(records, histogram_fields[i], [&](double value, unsigned int held) {
+            histogram[(int64_t)std::floor(value / width)] += held;
+        });
+    }
+
+    return nullptr;
+}
+
+// The work aggregate_files shares among its threads, and what one thread found.
+struct AggregateWorker {
+    const std::vector<std::string>* paths;
+    const AggregateSettings* settings;
+    std::atomic<size_t>* next;  // The next path to take
+    std::map<int64_t, Aggregate> groups;
+    std::vector<std::pair<size_t, const char*>> failed;  // Path index and error atom name
+};
+
+// Takes paths until none are left, folding each file into the worker's groups.
+static void* aggregate_worker(void* arg) {
+    AggregateWorker* worker = static_cast<AggregateWorker*>(arg);
+    for (size_t i = (*worker->next)++; i < worker->paths->size(); i = (*worker->next)++) {
+        Aggregate aggregate;
+        int64_t group;
+        const char* error = aggregate_file((*worker->paths)[i], *worker->settings, &group, &aggregate);
+        if (error != nullptr) {
+            worker->failed.push_back({i, error});
+        } else {
+            worker->groups[group].Merge(aggregate);
+        }
+    }
+    return nullptr;
+}
+
+static ERL_NIF_TERM make_aggregate_metric(ErlNifEnv* env, size_t metric, double value) {
+    switch (metric) {
+        case METRIC_COUNT:
+        case METRIC_ELAPSED_TIME:
+        case METRIC_TIMER_TIME:
+        case METRIC_MOVING_TIME:
+        case METRIC_LONGEST_TIME:
+        case METRIC_MAX_HEART_RATE:
+        case METRIC_MAX_POWER:
+            return make_optional_number(env, value, true);
+        default:
+            return make_optional_number(env, value, false);
+    }
+}
+
+// %{key => value} for the values that aren't NaN, keys[i] going with values[i].
+static ERL_NIF_TERM make_best_map(ErlNifEnv* env, const std::vector<ERL_NIF_TERM>& keys,
+                                  const std::vector<double>& values, bool integer) {
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    for (size_t i = 0; i < keys.size() && i < values.size(); i++) {
+        if (!std::isnan(values[i])) {
+            enif_make_map_put(env, map, keys[i], make_optional_number(env, values[i], integer), &map);
+        }
+    }
+    return map;
+}
+
+// Decodes the FIT files at the paths in argv[0] on argv[3] native threads and aggregates
+// the metrics in argv[1] by group, without building any record or message term. argv[2] is
+// {group_by, utc_offset, durations, distances, {heart_rate_bin, power_bin}, speed_threshold}.
+// Returns {[{group_start_day | nil, %{metric => value}}], [{path_index, reason}]}, groups in
+// time order.
+static ERL_NIF_TERM aggregate_files_nif(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+    unsigned int path_count, thread_count;
+    if (argc != 4 || !enif_get_list_length(env, argv[0], &path_count) || !enif_get_uint(env, argv[3], &thread_count) ||
+        thread_count == 0) {
+        return enif_make_badarg(env);
+    }
+
+    std::vector<std::string> paths;
+    ERL_NIF_TERM list = argv[0];
+    ERL_NIF_TERM head;
+    ErlNifBinary path;
+    while (enif_get_list_cell(env, list, &head, &list)) {
+        if (!enif_inspect_binary(env, head, &path)) {
+            return enif_make_badarg(env);
+        }
+        paths.emplace_back(reinterpret_cast<const char*>(path.data), path.size);
+    }
+
+    AggregateSettings settings = {};
+    std::vector<ERL_NIF_TERM> metric_keys;  // The requested scalar metrics and series, in order
+    std::vector<int> metric_ids;            // Scalar metrics as is, series after them
+    char name[32];
+    list = argv[1];
+    while (enif_get_list_cell(env, list, &head, &list)) {
+        if (!enif_get_atom(env, head, name, sizeof(name), ERL_NIF_LATIN1)) {
+            return enif_make_badarg(env);
+        }
+        int id = -1;
+        for (size_t i = 0; i < AGGREGATE_METRIC_COUNT; i++) {
+            if (strcmp(name, aggregate_metrics[i].name) == 0) {
+                id = (int)i;
+            }
+        }
+        for (size_t i = 0; i < AGGREGATE_SERIES_COUNT; i++) {
+            if (strcmp(name, aggregate_series_names[i]) == 0) {
+                id = (int)(AGGREGATE_METRIC_COUNT + i);
+            }
+        }
+        if (id < 0) {
+            return enif_make_badarg(env);
+        }
+        // A repeated metric would only fail once the result map is built, after every file
+        // has been decoded
+        bool& requested = id < AGGREGATE_METRIC_COUNT ? settings.metrics[id]
+                                                      : settings.series[id - AGGREGATE_METRIC_COUNT];
+        if (requested) {
+            return enif_make_badarg(env);
+        }
+        requested = true;
+        metric_keys.push_back(head);
+        metric_ids.push_back(id);
+    }
+
+    int arity;
+    const ERL_NIF_TERM* options;
+    const ERL_NIF_TERM* bins;
+    ErlNifSInt64 utc_offset;
+    if (!enif_get_tuple(env, argv[2], &arity, &options) || arity != 6 || !enif_get_int64(env, options[1], &utc_offset) ||
+        !enif_get_tuple(env, options[4], &arity, &bins) || arity != 2 || !enif_get_uint(env, bins[0], &settings.bin_widths[0]) ||
+        !enif_get_uint(env, bins[1], &settings.bin_widths[1]) || settings.bin_widths[0] == 0 ||
+        settings.bin_widths[1] == 0 || !get_number(env, options[5], &settings.speed_threshold) ||
+        settings.speed_threshold < 0.0) {
+        return enif_make_badarg(env);
+    }
+    settings.utc_offset = utc_offset;
+
+    static const char* const group_names[] = {"all", "day", "week", "month", "year"};
+    bool group_known = false;
+    for (int i = 0; i < 5; i++) {
+        if (enif_is_identical(options[0], enif_make_atom(env, group_names[i]))) {
+            settings.group_by = (AggregateGroupBy)i;
+            group_known = true;
+        }
+    }
+
+    // Durations and distances keep their terms as the keys of the best_power and fastest maps
+    std::vector<ERL_NIF_TERM> duration_keys, distance_keys;
+    ErlNifUInt64 duration;
+    double distance;
+    list = options[2];
+    while (enif_get_list_cell(env, list, &head, &list)) {
+        if (!enif_get_uint64(env, head, &duration) || duration == 0) {
+            return enif_make_badarg(env);
+        }
+        settings.durations.push_back((size_t)duration);
+        duration_keys.push_back(head);
+    }
+    list = options[3];
+    while (enif_get_list_cell(env, list, &head, &list)) {
+        if (!get_number(env, head, &distance) || distance <= 0.0) {
+            return enif_make_badarg(env);
+        }
+        settings.distances.push_back(distance);
+        distance_keys.push_back(head);
+    }
+    if (!group_known) {
+        return enif_make_badarg(env);
+    }
+
+    // The calling thread works too, and does all the work if no thread can be started
+    std::atomic<size_t> next(0);
+    thread_count = std::min(thread_count, std::max(path_count, 1u));
+    std::vector<AggregateWorker> workers(thread_count);
+    for (AggregateWorker& worker : workers) {
+        worker.paths = &paths;
+        worker.settings = &settings;
+        worker.next = &next;
+    }
+    std::vector<ErlNifTid> threads;
+    for (size_t i = 1; i < workers.size(); i++) {
+        ErlNifTid tid;
+        if (enif_thread_create((char*)"fit_aggregate", &tid, aggregate_worker, &workers[i], NULL) != 0) {
+            break;
+        }
+        threads.push_back(tid);
+    }
+    aggregate_worker(&workers[0]);
+    for (ErlNifTid tid : threads) {
+        enif_thread_join(tid, NULL);
+    }
+
+    // Merge into the first worker's groups
+    std::map<int64_t, Aggregate>& groups = workers[0].groups;
+    std::vector<std::pair<size_t, const char*>>& failed = workers[0].failed;
+    for (size_t i = 1; i < workers.size(); i++) {
+        for (const auto& group : workers[i].groups) {
+            groups[group.first].Merge(group.second);
+        }
+        failed.insert(failed.end(), workers[i].failed.begin(), workers[i].failed.end());
+    }
+    std::sort(failed.begin(), failed.end());
+
+    std::vector<ERL_NIF_TERM> group_terms;
+    for (const auto& group : groups) {
+        const Aggregate& aggregate = group.second;
+        std::vector<ERL_NIF_TERM> values;
+        for (int id : metric_ids) {
+            if (id < AGGREGATE_METRIC_COUNT) {
+                values.push_back(make_aggregate_metric(env, id, aggregate.metrics[id]));
+            } else if (id == AGGREGATE_METRIC_COUNT + AGGREGATE_BEST_POWER) {
+                values.push_back(make_best_map(env, duration_keys, aggregate.best_power, false));
+            } else if (id == AGGREGATE_METRIC_COUNT + AGGREGATE_FASTEST) {
+                values.push_back(make_best_map(env, distance_keys, aggregate.fastest, true));
+            } else {
+                size_t i = id - AGGREGATE_METRIC_COUNT - AGGREGATE_HEART_RATE_HISTOGRAM;
+                ERL_NIF_TERM histogram = enif_make_new_map(env);
+                for (const auto& bin : aggregate.histograms[i]) {
+                    ERL_NIF_TERM start = enif_make_int64(env, bin.first * (int64_t)settings.bin_widths[i]);
+                    enif_make_map_put(env, histogram, start, enif_make_uint64(env, (uint64_t)bin.second), &histogram);
+                }
+                values.push_back(histogram);
+            }
+        }
+
+        // Metrics are unique, as parsing rejects a repeated one
+        ERL_NIF_TERM map;
+        enif_make_map_from_arrays(env, metric_keys.data(), values.data(), values.size(), &map);
+        ERL_NIF_TERM key = settings.group_by == GROUP_ALL ? enif_make_atom(env, "nil") : enif_make_int64(env, group.first);
+        group_terms.push_back(enif_make_tuple2(env, key, map));
+    }
+
+    std::vector<ERL_NIF_TERM> failed_terms;
+    for (const auto& failure : failed) {
+        failed_terms.push_back(enif_make_tuple2(env, enif_make_uint64(env, failure.first),
+                                                enif_make_atom(env, failure.second)));
+    }
+
+    return enif_make_tuple2(env, enif_make_list_from_array(env, group_terms.data(), group_terms.size()),
+                            enif_make_list_from_array(env, failed_terms.data(), failed_terms.size()));
+}
+
+// The list of functions this NIF exports.
+static ErlNifFunc nif_funcs[] = {
+    {"decode_fit_file", 1, decode_fit_file_nif},
+    {"decode_fit_file_partial", 2, decode_fit_file_partial_nif},
+    {"summarize_fit_file", 3, summarize_fit_file_nif},
+    {"decode_sessions", 3, decode_sessions_nif},
+    {"decode_messages", 2, decode_messages_nif},
+    {"peek_fit_file", 1, peek_fit_file_nif},
+    {"census_fit_file", 1, census_fit_file_nif},
+    {"downsample_fit_file", 4, downsample_fit_file_nif},
+    {"moving_time_fit_file", 2, moving_time_fit_file_nif},
+    {"open_activity", 1, open_activity_nif},
+    {"activity_record_count", 1, activity_record_count_nif},
+    {"activity_first_timestamp", 1, activity_first_timestamp_nif},
+    {"activity_duration", 1, activity_duration_nif},
+    {"activity_sessions", 1, activity_sessions_nif},
+    {"activity_field_stats", 2, activity_field_stats_nif},
+    {"activity_slice", 3, activity_slice_nif},
+    {"activity_mean_max", 3, activity_mean_max_nif},
+    {"activity_time_in_zone", 3, activity_time_in_zone_nif},
+    {"activity_device_time_in_zone", 1, activity_device_time_in_zone_nif},
+    {"activity_training_load", 2, activity_training_load_nif},
+    {"activity_resample", 3, activity_resample_nif},
+    {"activity_track", 4, activity_track_nif},
+    {"activity_downsample", 4, activity_downsample_nif},
+    {"activity_elevation", 4, activity_elevation_nif},
+    {"verify_fit_binary", 1, verify_fit_binary_nif, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+    {"verify_fit_path", 1, verify_fit_path_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+    {"aggregate_files", 4, aggregate_files_nif, ERL_NIF_DIRTY_JOB_IO_BOUND}
+};
+
+static int load(ErlNifEnv* env, void** priv_data, ERL_NIF_TERM load_info) {
+    init_record_fields();
+    init_mesg_converters(env);
+
+    activity_resource_type = enif_open_resource_type(env, NULL, "fit_activity", activity_destructor,
+                                                     ERL_NIF_RT_CREATE, NULL);
+    return activity_resource_type == NULL ? -1 : 0;
+}
 
 // Initialize the NIF library.
-ERL_NIF_INIT(Elixir.FitDecoder.NIF, nif_funcs, NULL, NULL, NULL, NULL)
+ERL_NIF_INIT(Elixir.FitDecoder.NIF, nif_funcs, load, NULL, NULL, NULL)
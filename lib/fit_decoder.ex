@@ -47,8 +47,54 @@ defmodule FitDecoder do
     # Define a stub for the NIF.
     # This will be replaced by the actual C++ function when the NIF is loaded.
     def decode_fit_file(_binary), do: :erlang.nif_error(:nif_not_loaded)
+    def decode_fit_file_partial(_binary, _salvage), do: :erlang.nif_error(:nif_not_loaded)
+    def summarize_fit_file(_binary, _with_records, _load_opts),
+      do: :erlang.nif_error(:nif_not_loaded)
+    def decode_sessions(_binary, _gap_seconds, _records), do: :erlang.nif_error(:nif_not_loaded)
+    def decode_messages(_binary, _types), do: :erlang.nif_error(:nif_not_loaded)
+    def peek_fit_file(_binary), do: :erlang.nif_error(:nif_not_loaded)
+    def census_fit_file(_binary), do: :erlang.nif_error(:nif_not_loaded)
+
+    def downsample_fit_file(_binary, _fields, _points, _method),
+      do: :erlang.nif_error(:nif_not_loaded)
+
+    def moving_time_fit_file(_binary, _speed_threshold), do: :erlang.nif_error(:nif_not_loaded)
+
+    def open_activity(_binary), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_record_count(_activity), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_first_timestamp(_activity), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_duration(_activity), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_sessions(_activity), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_field_stats(_activity, _field), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_slice(_activity, _start, _amount), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_mean_max(_activity, _field, _durations), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_training_load(_activity, _opts), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_time_in_zone(_activity, _field, _bounds), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_device_time_in_zone(_activity), do: :erlang.nif_error(:nif_not_loaded)
+    def activity_resample(_activity, _fields, _grid), do: :erlang.nif_error(:nif_not_loaded)
+
+    def activity_track(_activity, _algorithm, _tolerance, _format),
+      do: :erlang.nif_error(:nif_not_loaded)
+
+    def activity_downsample(_activity, _fields, _points, _method),
+      do: :erlang.nif_error(:nif_not_loaded)
+
+    def activity_elevation(_activity, _smoothing, _threshold, _min_climb),
+      do: :erlang.nif_error(:nif_not_loaded)
+
+    def aggregate_files(_paths, _metrics, _settings, _threads),
+      do: :erlang.nif_error(:nif_not_loaded)
+
+    def verify_fit_binary(_binary), do: :erlang.nif_error(:nif_not_loaded)
+    def verify_fit_path(_path), do: :erlang.nif_error(:nif_not_loaded)
   end
 
+  # A gap of more than 1 hour between record timestamps starts a new session
+  @session_gap_seconds 3600
+
+  # Options of summarize_fit_file/2 that are passed on for the training load
+  @training_load_options [:ftp, :max_hr, :resting_hr, :hr_zones, :sex]
+
   @doc """
   Decodes a FIT file binary and returns a list of maps, where each map
   represents a "Record" message containing sensor data.
@@ -110,6 +156,773 @@ defmodule FitDecoder do
     end
   end
 
+  @doc """
+  Decodes the records of a FIT file binary like `decode_fit_file/1`, but
+  keeps the records decoded before an error instead of discarding them.
+
+  The file is decoded in a single pass, without the separate integrity
+  check, so a truncated upload or a corrupted tail still yields every
+  record before the damage.
+
+  ## Parameters
+
+    * `binary` - A binary containing FIT file data
+    * `opts` - Keyword list of options:
+      * `:salvage` - When `true`, keep decoding past the damage: a header
+        data size that can't be right (0, or ending partway through the
+        data) is ignored, and after a corrupted message decoding resumes
+        at the next point where the following messages line up, keeping
+        the definitions, timestamp and accumulated values read before the
+        damage. Defaults to `false`.
+
+  ## Returns
+
+    * `{:ok, records}` - The file decoded cleanly
+    * `{:partial, records, %{offset: offset, reason: reason}}` - Decoding
+      stopped at byte `offset`; `records` are those decoded before it.
+      `reason` is one of `:unexpected_end` (truncated), `:crc_mismatch`,
+      `:missing_definition`, `:incomplete_message`, `:invalid_field_size`,
+      `:invalid_developer_data`, `:unsupported_architecture`,
+      `:invalid_header`, `:invalid_data_size`, `:unsupported_protocol` or
+      `:too_many_accumulated_fields`.
+      With `salvage: true`, `offset` and `reason` describe the first
+      error, `records` also holds those recovered after it, and the map
+      has a `:skipped` list of the `{start, stop}` byte ranges passed over.
+
+  ## Examples
+
+      iex> FitDecoder.decode_fit_file_partial(<<>>)
+      {:ok, []}
+
+      iex> FitDecoder.decode_fit_file_partial(<<1, 2, 3, 4>>)
+      {:partial, [], %{offset: 0, reason: :invalid_header}}
+
+  """
+  def decode_fit_file_partial(binary, opts \\ []) when is_binary(binary) do
+    NIF.decode_fit_file_partial(binary, Keyword.get(opts, :salvage, false))
+  end
+
+  @doc """
+  Same as `decode_fit_file_partial/2` but reads the file from disk.
+
+  ## Returns
+
+    * Same as `decode_fit_file_partial/2`
+    * `{:error, reason}` if the file cannot be read
+
+  ## Examples
+
+      iex> FitDecoder.decode_fit_file_partial_from_path("/nonexistent/file.fit")
+      {:error, :enoent}
+
+  """
+  def decode_fit_file_partial_from_path(file_path, opts \\ []) when is_binary(file_path) do
+    case File.read(file_path) do
+      {:ok, binary} -> decode_fit_file_partial(binary, opts)
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  @doc """
+  Decodes a FIT file binary and returns a summary of its records, computed
+  in a single pass while decoding.
+
+  Unlike `decode_fit_file/1` followed by `get_activity_info/1`, no record maps
+  are built unless `records: true` is given, which makes this the cheap path
+  for listing many activities.
+
+  ## Parameters
+
+    * `binary` - A binary containing FIT file data
+    * `opts` - Keyword list of options:
+      * `:records` - Also return the decoded records (default `false`)
+      * `:ftp` - Functional threshold power in watts, for the power metrics
+      * `:max_hr` / `:resting_hr` - Heart rate bounds, for the TRIMP metrics
+      * `:hr_zones` - Ascending lower bounds of Edwards zones 1 to 5
+        (default 50%, 60%, 70%, 80% and 90% of `:max_hr`)
+      * `:sex` - `:male` (default) or `:female`, for the TRIMP weighting
+
+  ## Returns
+
+    * `{:ok, summary}` on success
+    * `{:ok, summary, records}` when `records: true`
+    * An error atom (`:error_integrity_check_failed`, `:error_sdk_exception`) on failure
+
+  The summary map contains:
+    * `:record_count` - Number of records with a timestamp (integer)
+    * `:date` - Date of the first record (`Date` struct, or nil)
+    * `:start_time` / `:end_time` - Earliest and latest Unix timestamps (or nil)
+    * `:duration_seconds` - `end_time - start_time` (integer, or nil)
+    * `:total_distance` - Largest distance in meters (float, or nil)
+    * `:heart_rate`, `:power`, `:cadence`, `:speed` - `%{min:, max:, avg:}`
+      over the records carrying the field, or nil if none do. `:speed` falls
+      back to `:enhanced_speed`.
+    * `:fields` - Record fields present in at least one record (list of atoms)
+    * `:training_load` - Only when one of the training load options is given,
+      see `FitDecoder.Activity.training_load/2`
+
+  Unlike `get_activity_info/1`, the summary covers every record rather than
+  the longest continuous session.
+
+  ## Examples
+
+      iex> {:ok, summary} = FitDecoder.summarize_fit_file(<<>>)
+      iex> summary.record_count
+      0
+
+      iex> FitDecoder.summarize_fit_file(<<1, 2, 3, 4>>)
+      :error_integrity_check_failed
+
+  """
+  def summarize_fit_file(binary, opts \\ []) when is_binary(binary) and is_list(opts) do
+    load_opts = Keyword.take(opts, @training_load_options)
+
+    case NIF.summarize_fit_file(binary, Keyword.get(opts, :records, false), load_opts) do
+      {:ok, summary} -> {:ok, put_summary_date(summary)}
+      {:ok, summary, records} -> {:ok, put_summary_date(summary), records}
+      error -> error
+    end
+  end
+
+  @doc """
+  Same as `summarize_fit_file/2` but reads the file from disk.
+
+  ## Returns
+
+    * Same as `summarize_fit_file/2`
+    * `{:error, reason}` if the file cannot be read
+
+  ## Examples
+
+      iex> FitDecoder.summarize_fit_file_from_path("/nonexistent/file.fit")
+      {:error, :enoent}
+
+  """
+  def summarize_fit_file_from_path(file_path, opts \\ []) when is_binary(file_path) do
+    case File.read(file_path) do
+      {:ok, binary} -> summarize_fit_file(binary, opts)
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  @doc """
+  Decodes a FIT file binary and splits its records into sessions wherever
+  consecutive timestamps are more than `:gap_seconds` apart.
+
+  Segmentation happens inside the decoder as records stream past, so no
+  timestamps are collected or sorted on the Elixir side, and with
+  `records: :longest` the records outside the longest session are never
+  turned into maps.
+
+  ## Parameters
+
+    * `binary` - A binary containing FIT file data
+    * `opts` - Keyword list of options:
+      * `:gap_seconds` - Largest gap within a session (default `3600`)
+      * `:records` - `:none` (default), `:all`, or `:longest` to return only
+        the records of the session spanning the most time
+
+  ## Returns
+
+    * `{:ok, sessions}` when `records: :none`
+    * `{:ok, sessions, records}` otherwise
+    * An error atom (`:error_integrity_check_failed`, `:error_sdk_exception`) on failure
+
+  Sessions are `%{start_time:, end_time:, record_count:}` maps in time order,
+  with Unix timestamps.
+
+  ## Examples
+
+      iex> FitDecoder.decode_sessions(<<>>)
+      {:ok, []}
+
+      iex> FitDecoder.decode_sessions(<<1, 2, 3, 4>>, records: :longest)
+      :error_integrity_check_failed
+
+  """
+  def decode_sessions(binary, opts \\ []) when is_binary(binary) and is_list(opts) do
+    gap_seconds = Keyword.get(opts, :gap_seconds, @session_gap_seconds)
+    records = Keyword.get(opts, :records, :none)
+
+    case NIF.decode_sessions(binary, gap_seconds, records) do
+      {:ok, sessions} -> {:ok, Enum.map(sessions, &session_to_map/1)}
+      {:ok, sessions, records} -> {:ok, Enum.map(sessions, &session_to_map/1), records}
+      error -> error
+    end
+  end
+
+  @doc """
+  Same as `decode_sessions/2` but reads the file from disk.
+
+  ## Returns
+
+    * Same as `decode_sessions/2`
+    * `{:error, reason}` if the file cannot be read
+
+  ## Examples
+
+      iex> FitDecoder.decode_sessions_from_path("/nonexistent/file.fit")
+      {:error, :enoent}
+
+  """
+  def decode_sessions_from_path(file_path, opts \\ []) when is_binary(file_path) do
+    case File.read(file_path) do
+      {:ok, binary} -> decode_sessions(binary, opts)
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  @doc """
+  Decodes every message of the given types in a FIT file binary, in a
+  single pass.
+
+  Messages are converted using the FIT profile: each map is keyed by the
+  profile's field names, values are scaled, fields whose meaning depends on
+  another field are named after the active subfield (e.g. `:garmin_product`
+  rather than `:product`), and date_time fields are Unix timestamps. Strings
+  and byte arrays are binaries, and array fields are lists with `nil` for
+  invalid elements. Fields holding only invalid values are left out, as are
+  fields and message types the profile doesn't know.
+
+  Developer fields (those added by Connect IQ apps such as Stryd) that the
+  file describes are collected under `:developer_fields`, a map from the
+  field name given by the app to `%{value:, units:}`. The names are binaries,
+  since they come from the file. The `:field_description` and
+  `:developer_data_id` messages carry the rest of each field's metadata.
+
+  ## Parameters
+
+    * `binary` - A binary containing FIT file data
+    * `types` - A list of profile message names, such as
+      `[:session, :lap, :event]`, or `:all`
+
+  ## Returns
+
+    * `{:ok, messages}` on success, a map from message name to the list of
+      messages of that type in file order. Every requested type has a key,
+      with `:all` every type the file contains does.
+    * An error atom (`:error_integrity_check_failed`, `:error_sdk_exception`) on failure
+
+  Raises `ArgumentError` for a name that isn't a profile message.
+
+  ## Examples
+
+      iex> FitDecoder.decode_messages(<<>>, [:session, :lap])
+      {:ok, %{session: [], lap: []}}
+
+      iex> FitDecoder.decode_messages(<<1, 2, 3, 4>>, :all)
+      :error_integrity_check_failed
+
+  """
+  def decode_messages(binary, types) when is_binary(binary) and (types == :all or is_list(types)) do
+    NIF.decode_messages(binary, types)
+  end
+
+  @doc """
+  Same as `decode_messages/2` but reads the file from disk.
+
+  ## Returns
+
+    * Same as `decode_messages/2`
+    * `{:error, reason}` if the file cannot be read
+
+  ## Examples
+
+      iex> FitDecoder.decode_messages_from_path("/nonexistent/file.fit", :all)
+      {:error, :enoent}
+
+  """
+  def decode_messages_from_path(file_path, types) when is_binary(file_path) do
+    case File.read(file_path) do
+      {:ok, binary} -> decode_messages(binary, types)
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  @doc """
+  Returns a FIT file's metadata messages without decoding its records.
+
+  The file is scanned message by message using the lengths its definitions
+  give. Only the `:file_id`, `:device_info`, `:session`, `:lap` and
+  `:activity` messages are decoded; records and every other message are
+  skipped over. Reaching the session and activity messages at the end of the
+  file therefore costs far less than decoding it. The messages are
+  converted exactly as `decode_messages/2` converts them.
+
+  The file CRC is not checked. Use `verify_fit_file/1` for that.
+
+  ## Parameters
+
+    * `binary` - A binary containing FIT file data
+
+  ## Returns
+
+    * `{:ok, messages}` on success, a map with a key for each of the five
+      types, holding the list of its messages in file order
+    * `:error_integrity_check_failed` if a file header is invalid or a
+      message is undefined or runs past the end of the data
+    * `:error_sdk_exception` if a kept message fails to decode
+
+  ## Examples
+
+      iex> FitDecoder.peek(<<>>)
+      {:ok, %{file_id: [], device_info: [], session: [], lap: [], activity: []}}
+
+      iex> FitDecoder.peek(<<1, 2, 3, 4>>)
+      :error_integrity_check_failed
+
+  """
+  def peek(binary) when is_binary(binary) do
+    NIF.peek_fit_file(binary)
+  end
+
+  @doc """
+  Same as `peek/1` but reads the file from disk.
+
+  ## Returns
+
+    * Same as `peek/1`
+    * `{:error, reason}` if the file cannot be read
+
+  ## Examples
+
+      iex> FitDecoder.peek_from_path("/nonexistent/file.fit")
+      {:error, :enoent}
+
+  """
+  def peek_from_path(file_path) when is_binary(file_path) do
+    case File.read(file_path) do
+      {:ok, binary} -> peek(binary)
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  @doc """
+  Counts the messages in a FIT file by type without decoding any of them.
+
+  Like `peek/1`, the file is walked using the message lengths its
+  definitions give, but no message is decoded at all. This makes it cheap
+  enough to run on every upload for capacity planning and for spotting
+  unusual files. The file CRC is not checked.
+
+  ## Parameters
+
+    * `binary` - A binary containing FIT file data
+
+  ## Returns
+
+    * `{:ok, census}` on success, a map with:
+      * `:files` - Number of FIT files, counting chained ones
+      * `:bytes` - Message bytes in all files, without headers and CRCs
+      * `:definitions` - Number of definition messages
+      * `:messages` - Number of data messages
+      * `:types` - A map from message type to
+        `%{messages:, bytes:, definitions:, developer_bytes:}`. Types are
+        keyed by profile name, such as `:record`, or by global message
+        number if the profile doesn't know them. `:bytes` includes each
+        message's header byte. `:developer_bytes` is the part of it taken
+        by developer fields. More than one definition means the type was
+        redefined.
+      * `:developer_fields` - A map from
+        `{developer_data_index, field_number}` to the number of data
+        messages carrying that developer field
+    * `:error_integrity_check_failed` if a file header is invalid or a
+      message is undefined or runs past the end of the data
+
+  ## Examples
+
+      iex> FitDecoder.census(<<>>)
+      {:ok, %{files: 0, bytes: 0, definitions: 0, messages: 0, types: %{}, developer_fields: %{}}}
+
+      iex> FitDecoder.census(<<1, 2, 3, 4>>)
+      :error_integrity_check_failed
+
+  """
+  def census(binary) when is_binary(binary) do
+    NIF.census_fit_file(binary)
+  end
+
+  @doc """
+  Same as `census/1` but reads the file from disk.
+
+  ## Returns
+
+    * Same as `census/1`
+    * `{:error, reason}` if the file cannot be read
+
+  ## Examples
+
+      iex> FitDecoder.census_from_path("/nonexistent/file.fit")
+      {:error, :enoent}
+
+  """
+  def census_from_path(file_path) when is_binary(file_path) do
+    case File.read(file_path) do
+      {:ok, binary} -> census(binary)
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  @doc """
+  Decodes a FIT file binary and downsamples record fields for charting,
+  without building any record map.
+
+  At most `points` records are kept from those carrying any of `fields`,
+  and every field is charted against the same timestamps.
+
+  ## Parameters
+
+    * `binary` - A binary containing FIT file data
+    * `fields` - Record fields to chart, such as `[:altitude, :heart_rate]`
+    * `points` - The most records to keep
+    * `opts` - Keyword list of options:
+      * `:method` - `:lttb` (default) for Largest-Triangle-Three-Buckets,
+        which keeps the first and last records and, in each bucket between,
+        the record whose triangle with its neighbours is largest, summed
+        over the fields relative to each field's range. `:minmax` keeps the
+        records holding each field's minimum and maximum in each bucket,
+        so spikes survive. With fewer than two points per field, the
+        extremes of the fields listed first are kept.
+
+  ## Returns
+
+    * `{:ok, %{timestamp: [...], field => [...]}}` with a value or nil per
+      kept record, in time order
+    * An error atom (`:error_integrity_check_failed`, `:error_sdk_exception`) on failure
+
+  Raises `ArgumentError` for an unknown field or method.
+
+  ## Examples
+
+      iex> FitDecoder.downsample(<<>>, [:heart_rate], 100)
+      {:ok, %{timestamp: [], heart_rate: []}}
+
+  """
+  def downsample(binary, fields, points, opts \\ [])
+      when is_binary(binary) and is_list(fields) and is_integer(points) and points > 0 do
+    NIF.downsample_fit_file(binary, fields, points, Keyword.get(opts, :method, :lttb))
+  end
+
+  @doc """
+  Same as `downsample/4` but reads the file from disk.
+
+  ## Returns
+
+    * Same as `downsample/4`
+    * `{:error, reason}` if the file cannot be read
+
+  ## Examples
+
+      iex> FitDecoder.downsample_from_path("/nonexistent/file.fit", [:heart_rate], 100)
+      {:error, :enoent}
+
+  """
+  def downsample_from_path(file_path, fields, points, opts \\ []) when is_binary(file_path) do
+    case File.read(file_path) do
+      {:ok, binary} -> downsample(binary, fields, points, opts)
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  @doc """
+  Decodes a FIT file binary and measures its elapsed, timer and moving time
+  in one pass, without building any record or event map.
+
+  `get_activity_duration/1` only spans the first and last timestamps. Here
+  the timer start and stop events are paired as well: the timer runs from a
+  start to the next stop or stop-all, so time the device was paused,
+  manually or by auto-pause, is left out of the timer time. Moving time
+  further leaves out the stretches where the timer ran but the activity
+  stood still.
+
+  ## Parameters
+
+    * `binary` - A binary containing FIT file data
+    * `opts` - Keyword list of options:
+      * `:speed_threshold` - Speed in m/s from which the time between two
+        records counts as moving (default 0.5). The speed is the distance
+        covered between the records when both carry `:distance`, so a long
+        dropout spent standing still doesn't count, and the later record's
+        `:speed` or `:enhanced_speed` otherwise.
+
+  ## Returns
+
+    * `{:ok, %{elapsed_time:, timer_time:, moving_time:, pauses:}}` - Times
+      in seconds. `:timer_time` is nil without timer events, and
+      `:moving_time` is nil when no record carries a speed or distance
+      (without timer events, the timer is taken to run throughout).
+      `:pauses` lists each stop followed by a restart as
+      `%{start_time:, end_time:}`, in file order.
+    * `{:error, :no_records}` - If the file has no records
+    * An error atom (`:error_integrity_check_failed`, `:error_sdk_exception`) on failure
+
+  Raises `ArgumentError` for a negative speed threshold.
+
+  ## Examples
+
+      iex> FitDecoder.moving_time(<<>>)
+      {:error, :no_records}
+
+  """
+  def moving_time(binary, opts \\ []) when is_binary(binary) and is_list(opts) do
+    case NIF.moving_time_fit_file(binary, Keyword.get(opts, :speed_threshold, 0.5)) do
+      {:ok, elapsed_time, timer_time, moving_time, pauses} ->
+        pauses =
+          for {start_time, end_time} <- pauses do
+            %{start_time: start_time, end_time: end_time}
+          end
+
+        times = %{elapsed_time: elapsed_time, timer_time: timer_time, moving_time: moving_time}
+        {:ok, Map.put(times, :pauses, pauses)}
+
+      error ->
+        error
+    end
+  end
+
+  @doc """
+  Same as `moving_time/2` but reads the file from disk.
+
+  ## Returns
+
+    * Same as `moving_time/2`
+    * `{:error, reason}` if the file cannot be read
+
+  ## Examples
+
+      iex> FitDecoder.moving_time_from_path("/nonexistent/file.fit")
+      {:error, :enoent}
+
+  """
+  def moving_time_from_path(file_path, opts \\ []) when is_binary(file_path) do
+    case File.read(file_path) do
+      {:ok, binary} -> moving_time(binary, opts)
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  @doc """
+  Decodes a FIT file binary into an activity handle whose records stay in
+  native memory. Query it with the functions in `FitDecoder.Activity`.
+
+  ## Parameters
+
+    * `binary` - A binary containing FIT file data
+
+  ## Returns
+
+    * `{:ok, activity}` on success
+    * An error atom (`:error_integrity_check_failed`, `:error_sdk_exception`) on failure
+
+  ## Examples
+
+      iex> {:ok, activity} = FitDecoder.open_activity(<<>>)
+      iex> FitDecoder.Activity.record_count(activity)
+      0
+
+      iex> FitDecoder.open_activity(<<1, 2, 3, 4>>)
+      :error_integrity_check_failed
+
+  """
+  def open_activity(binary) when is_binary(binary) do
+    NIF.open_activity(binary)
+  end
+
+  @doc """
+  Same as `open_activity/1` but reads the file from disk.
+
+  ## Returns
+
+    * Same as `open_activity/1`
+    * `{:error, reason}` if the file cannot be read
+
+  ## Examples
+
+      iex> FitDecoder.open_activity_from_path("/nonexistent/file.fit")
+      {:error, :enoent}
+
+  """
+  def open_activity_from_path(file_path) when is_binary(file_path) do
+    case File.read(file_path) do
+      {:ok, binary} -> open_activity(binary)
+      {:error, reason} -> {:error, reason}
+    end
+  end
+
+  @doc """
+  Checks the integrity of a FIT file binary without decoding any messages.
+
+  Only the file header is parsed (including its optional CRC) and a bulk CRC
+  is computed over the header, data records and trailing file CRC. Chained
+  FIT files are verified one after another. This is much cheaper than
+  `decode_fit_file/1` and is intended for sweeping large archives for
+  corrupt files.
+
+  ## Parameters
+
+    * `binary` - A binary containing FIT file data
+
+  ## Returns
+
+    * `{:ok, file_count}` - All chained files are intact
+    * `{:error, reason, byte_offset}` - `reason` is one of `:header_invalid`,
+      `:header_crc_failed`, `:data_size_invalid`, `:truncated` or
+      `:file_crc_failed`; `byte_offset` is where the failing file starts
+
+  ## Examples
+
+      iex> FitDecoder.verify_fit_file(<<>>)
+      {:error, :truncated, 0}
+
+      iex> FitDecoder.verify_fit_file(<<1, 2, 3, 4>>)
+      {:error, :truncated, 0}
+
+  """
+  def verify_fit_file(binary) when is_binary(binary) do
+    NIF.verify_fit_binary(binary)
+  end
+
+  @doc """
+  Same as `verify_fit_file/1` but reads the file from disk.
+
+  The file is memory-mapped by the NIF, so it is never copied onto the
+  process heap.
+
+  ## Returns
+
+    * Same as `verify_fit_file/1`
+    * `{:error, reason}` if the file cannot be opened
+
+  ## Examples
+
+      iex> FitDecoder.verify_fit_file_from_path("/nonexistent/file.fit")
+      {:error, :enoent}
+
+  """
+  def verify_fit_file_from_path(file_path) when is_binary(file_path) do
+    NIF.verify_fit_path(file_path)
+  end
+
+  @doc """
+  Verifies many FIT files on disk and returns a `{path, result}` tuple per
+  file, where `result` is the return value of `verify_fit_file_from_path/1`.
+
+  ## Examples
+
+      iex> FitDecoder.verify_fit_files(["/nonexistent/file.fit"])
+      [{"/nonexistent/file.fit", {:error, :enoent}}]
+
+  """
+  def verify_fit_files(file_paths) when is_list(file_paths) do
+    Enum.map(file_paths, fn path -> {path, verify_fit_file_from_path(path)} end)
+  end
+
+  @doc """
+  Decodes many FIT files on native threads and aggregates metrics over them
+  by day, week, month or year, such as weekly distance or monthly best
+  efforts.
+
+  Each file is decoded into its own per-activity metrics, which are merged
+  into the totals of its group as sums, maxima, best efforts or histograms.
+  Only the merged totals ever reach the BEAM, never a record. The files
+  are shared among `:max_concurrency` threads, so throughput grows with
+  the cores until the disk can't keep up. The call runs on a dirty
+  scheduler and doesn't block the others.
+
+  ## Parameters
+
+    * `file_paths` - Paths of the FIT files
+    * `metrics` - The metrics to aggregate:
+      * `:count` - Number of activities
+      * `:distance`, `:elapsed_time`, `:timer_time`, `:moving_time` - Sums,
+        in meters and seconds, with times as in `moving_time/2`
+      * `:ascent`, `:descent` - Summed elevation gain and loss in meters,
+        as `FitDecoder.Activity.elevation/2` measures them by default
+      * `:max_speed`, `:max_heart_rate`, `:max_power` - Highest record values
+      * `:longest_distance`, `:longest_time` - The longest single activity,
+        by distance and by elapsed time
+      * `:best_power` - `%{duration => watts}`, the best mean power over
+        each of `:durations`, as in `FitDecoder.Activity.mean_max/3`
+      * `:fastest` - `%{distance => seconds}`, the fastest time over each of
+        `:distances`, from record to record
+      * `:heart_rate_histogram`, `:power_histogram` - `%{bin_start =>
+        seconds}`, time spent in each bin of `:histogram_bins`, held as in
+        `FitDecoder.Activity.time_in_zone/3`
+    * `opts` - Keyword list of options:
+      * `:group_by` - `:week` (default, starting on Monday), `:day`,
+        `:month`, `:year` or `:all`
+      * `:utc_offset` - Seconds from UTC of the time zone days start in
+        (default 0)
+      * `:durations` - Seconds for `:best_power` (default `[5, 60, 300,
+        1200, 3600]`)
+      * `:distances` - Meters for `:fastest` (default `[1000, 5000, 10000,
+        21097.5, 42195]`)
+      * `:histogram_bins` - Bin widths as `[heart_rate: 10, power: 25]`
+        (the defaults)
+      * `:speed_threshold` - As in `moving_time/2` (default 0.5)
+      * `:max_concurrency` - Threads to decode on (default
+        `System.schedulers_online/0`)
+
+  ## Returns
+
+  `{:ok, result}` where `result` has:
+
+    * `:groups` - `%{group => %{metric => value}}`, keyed by the `Date` the
+      day, week, month or year starts on, or `:all`. An activity goes by
+      the time of its first record. A metric no activity in the group has
+      is nil.
+    * `:failed` - `{path, reason}` for each file that couldn't be read
+      (`:enoent`, ...), decoded (`:error_integrity_check_failed`,
+      `:error_sdk_exception`) or had no records (`:no_records`)
+    * `:files`, `:seconds` and `:files_per_second` - How many files were
+      given, the wall time taken and the throughput
+
+  Raises `ArgumentError` for an unknown or repeated metric or an unknown
+  option value.
+
+  ## Examples
+
+      iex> {:ok, result} = FitDecoder.aggregate(["/nonexistent/file.fit"], [:distance])
+      iex> {result.groups, result.failed}
+      {%{}, [{"/nonexistent/file.fit", :enoent}]}
+
+  """
+  def aggregate(file_paths, metrics, opts \\ [])
+      when is_list(file_paths) and is_list(metrics) and is_list(opts) do
+    file_paths = Enum.map(file_paths, &IO.chardata_to_string/1)
+    bins = Keyword.get(opts, :histogram_bins, [])
+
+    settings = {
+      Keyword.get(opts, :group_by, :week),
+      Keyword.get(opts, :utc_offset, 0),
+      Keyword.get(opts, :durations, [5, 60, 300, 1200, 3600]),
+      Keyword.get(opts, :distances, [1000, 5000, 10_000, 21_097.5, 42_195]),
+      {Keyword.get(bins, :heart_rate, 10), Keyword.get(bins, :power, 25)},
+      Keyword.get(opts, :speed_threshold, 0.5)
+    }
+
+    threads = Keyword.get(opts, :max_concurrency, System.schedulers_online())
+    started = System.monotonic_time()
+    {groups, failed} = NIF.aggregate_files(file_paths, metrics, settings, threads)
+    elapsed = System.monotonic_time() - started
+    seconds = System.convert_time_unit(elapsed, :native, :microsecond) / 1_000_000
+
+    paths = List.to_tuple(file_paths)
+    files = length(file_paths)
+
+    {:ok,
+     %{
+       groups: Map.new(groups, fn {day, values} -> {group_key(day), values} end),
+       failed: Enum.map(failed, fn {index, reason} -> {elem(paths, index), reason} end),
+       files: files,
+       seconds: seconds,
+       files_per_second: if(seconds > 0, do: files / seconds, else: nil)
+     }}
+  end
+
+  defp group_key(nil), do: :all
+  defp group_key(day), do: Date.add(~D[1970-01-01], day)
+
   @doc """
   Gets the activity date from decoded FIT file records.
 
@@ -162,6 +975,7 @@ defmodule FitDecoder do
 
   Returns the duration of the activity in seconds based on the difference
   between the earliest and latest timestamps.
+  Paused time counts too; see `moving_time/2` for timer and moving time.
 
   ## Parameters
 
@@ -182,16 +996,9 @@ defmodule FitDecoder do
 
   """
   def get_activity_duration(records) when is_list(records) do
-    case get_longest_continuous_session(records) do
-      {:ok, {start_timestamp, end_timestamp}} when start_timestamp != end_timestamp ->
-        {:ok, end_timestamp - start_timestamp}
-
-      {:ok, {_start_timestamp, _end_timestamp}} ->
-        {:error, :insufficient_data}
-
-      error ->
-        error
-    end
+    records
+    |> find_sessions()
+    |> get_session_duration()
   end
 
   @doc """
@@ -232,28 +1039,7 @@ defmodule FitDecoder do
 
   """
   def get_activity_info(records) when is_list(records) do
-    with {:ok, date} <- get_activity_date(records),
-         {:ok, duration} <- get_activity_duration(records) do
-      # Get records from the longest continuous session for more accurate stats
-      session_records =
-        case get_longest_continuous_session_records(records) do
-          {:ok, session_records} -> session_records
-          _ -> records
-        end
-
-      total_distance = get_total_distance(session_records)
-
-      activity_info = %{
-        date: date,
-        duration_seconds: duration,
-        total_distance: total_distance,
-        record_count: length(session_records),
-        has_heart_rate: has_field?(session_records, :heart_rate),
-        has_altitude: has_field?(session_records, :altitude)
-      }
-
-      {:ok, activity_info}
-    end
+    build_activity_info(records, find_sessions(records))
   end
 
   @doc """
@@ -278,63 +1064,85 @@ defmodule FitDecoder do
 
   """
   def decode_and_analyze(file_path) when is_binary(file_path) do
-    case decode_fit_file_from_path(file_path) do
-      records when is_list(records) ->
-        case get_activity_info(records) do
-          {:ok, activity_info} -> {:ok, {activity_info, records}}
-          error -> error
-        end
-
-      error_atom when is_atom(error_atom) ->
-        error_atom
-
-      {:error, reason} ->
-        {:error, reason}
+    with {:ok, binary} <- File.read(file_path) do
+      # Sessions come from the decoder, so the records are never sorted here
+      case NIF.decode_sessions(binary, @session_gap_seconds, :all) do
+        {:ok, sessions, records} ->
+          case build_activity_info(records, sessions) do
+            {:ok, activity_info} -> {:ok, {activity_info, records}}
+            error -> error
+          end
+
+        error_atom when is_atom(error_atom) ->
+          error_atom
+      end
     end
   end
 
   # Private helper functions
 
-  defp get_longest_continuous_session(records) do
-    case find_sessions(records) do
-      [] ->
-        {:error, :no_records}
+  defp put_summary_date(%{start_time: nil} = summary), do: Map.put(summary, :date, nil)
 
-      sessions ->
-        longest_session =
-          sessions
-          |> Enum.max_by(fn {start_ts, end_ts, _count} -> end_ts - start_ts end)
+  defp put_summary_date(%{start_time: start_time} = summary) do
+    date = DateTime.from_unix!(start_time) |> DateTime.to_date()
+    Map.put(summary, :date, date)
+  end
 
-        {start_ts, end_ts, _count} = longest_session
-        {:ok, {start_ts, end_ts}}
-    end
+  defp session_to_map({start_time, end_time, record_count}) do
+    %{start_time: start_time, end_time: end_time, record_count: record_count}
   end
 
-  defp get_longest_continuous_session_records(records) do
-    case find_sessions(records) do
-      [] ->
-        {:error, :no_records}
+  defp build_activity_info(records, sessions) do
+    with {:ok, date} <- get_activity_date(records),
+         {:ok, duration} <- get_session_duration(sessions) do
+      # Get records from the longest continuous session for more accurate stats
+      session_records =
+        case get_longest_session(sessions) do
+          {:ok, {start_ts, end_ts, _count}} ->
+            Enum.filter(records, fn record ->
+              ts = Map.get(record, :timestamp)
+              is_integer(ts) and ts >= start_ts and ts <= end_ts
+            end)
+
+          _ ->
+            records
+        end
+
+      total_distance = get_total_distance(session_records)
+
+      activity_info = %{
+        date: date,
+        duration_seconds: duration,
+        total_distance: total_distance,
+        record_count: length(session_records),
+        has_heart_rate: has_field?(session_records, :heart_rate),
+        has_altitude: has_field?(session_records, :altitude)
+      }
 
-      sessions ->
-        # Find the session with the longest duration
-        longest_session =
-          sessions
-          |> Enum.max_by(fn {start_ts, end_ts, _count} -> end_ts - start_ts end)
+      {:ok, activity_info}
+    end
+  end
 
-        {start_ts, end_ts, _count} = longest_session
+  defp get_session_duration(sessions) do
+    case get_longest_session(sessions) do
+      {:ok, {start_ts, end_ts, _count}} when start_ts != end_ts ->
+        {:ok, end_ts - start_ts}
 
-        # Filter records to only include those in the longest session
-        session_records =
-          records
-          |> Enum.filter(fn record ->
-            ts = Map.get(record, :timestamp)
-            is_integer(ts) and ts >= start_ts and ts <= end_ts
-          end)
+      {:ok, _session} ->
+        {:error, :insufficient_data}
 
-        {:ok, session_records}
+      error ->
+        error
     end
   end
 
+  # The session with the longest duration; sessions are {start_ts, end_ts, count} in time order
+  defp get_longest_session([]), do: {:error, :no_records}
+
+  defp get_longest_session(sessions) do
+    {:ok, Enum.max_by(sessions, fn {start_ts, end_ts, _count} -> end_ts - start_ts end)}
+  end
+
   defp find_sessions(records) do
     timestamps =
       records
@@ -351,9 +1159,6 @@ defmodule FitDecoder do
 
       timestamps ->
         # Group timestamps into sessions based on gaps
-        # Consider a gap of more than 1 hour (3600 seconds) as a session break
-        gap_threshold = 3600
-
         {sessions, current_session} =
           timestamps
           |> Enum.reduce({[], {nil, nil, 0}}, fn ts, {sessions, {start_ts, prev_ts, count}} ->
@@ -363,7 +1168,7 @@ defmodule FitDecoder do
                 {sessions, {ts, ts, 1}}
 
               # Gap detected - finish current session and start new one
-              ts - prev_ts > gap_threshold ->
+              ts - prev_ts > @session_gap_seconds ->
                 completed_session = {start_ts, prev_ts, count}
                 {[completed_session | sessions], {ts, ts, 1}}
 
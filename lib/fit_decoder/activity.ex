@@ -0,0 +1,359 @@
+defmodule FitDecoder.Activity do
+  @moduledoc """
+  Queries a decoded activity that is held in native memory.
+
+  `FitDecoder.open_activity/1` decodes a FIT file once and returns an opaque
+  handle. The decoded records stay in the NIF, so asking for the date,
+  duration or a field's statistics never copies the records onto the
+  process heap. Record maps are only built for what `slice/3` or
+  `to_maps/1` asks for. The native memory is freed when the handle is
+  garbage collected.
+
+  ## Examples
+
+      {:ok, activity} = FitDecoder.open_activity_from_path("/path/to/activity.fit")
+      {:ok, date} = FitDecoder.Activity.date(activity)
+      {:ok, duration} = FitDecoder.Activity.duration(activity)
+      %{min: _, max: _, avg: _, count: _} = FitDecoder.Activity.field_stats(activity, :heart_rate)
+      power_curve = FitDecoder.Activity.mean_max(activity, :power)
+      %{training_stress_score: _} = FitDecoder.Activity.training_load(activity, ftp: 250)
+      hr_zones = FitDecoder.Activity.time_in_zone(activity, :heart_rate, [120, 140, 160, 180])
+      {:ok, grid} = FitDecoder.Activity.resample(activity, fields: [:power, :heart_rate])
+      polyline = FitDecoder.Activity.track(activity, tolerance: 5, format: :polyline)
+      %{gain: _, loss: _, climbs: _} = FitDecoder.Activity.elevation(activity)
+      first_minute = FitDecoder.Activity.slice(activity, 0, 60)
+  """
+
+  alias FitDecoder.NIF
+
+  @type t :: reference()
+
+  @doc """
+  Returns the number of records in the activity.
+  """
+  def record_count(activity) when is_reference(activity) do
+    NIF.activity_record_count(activity)
+  end
+
+  @doc """
+  Returns the date of the first record, like `FitDecoder.get_activity_date/1`.
+
+  ## Returns
+
+    * `{:ok, %Date{}}` - The date when the activity started
+    * `{:error, :no_records}` - If the activity has no records
+  """
+  def date(activity) when is_reference(activity) do
+    case NIF.activity_first_timestamp(activity) do
+      nil -> {:error, :no_records}
+      timestamp -> {:ok, DateTime.from_unix!(timestamp) |> DateTime.to_date()}
+    end
+  end
+
+  @doc """
+  Returns the duration of the longest continuous session in seconds, like
+  `FitDecoder.get_activity_duration/1`.
+
+  ## Returns
+
+    * `{:ok, duration_seconds}`
+    * `{:error, :no_records}` - If the activity has no records
+    * `{:error, :insufficient_data}` - If the longest session is a single instant
+  """
+  def duration(activity) when is_reference(activity) do
+    NIF.activity_duration(activity)
+  end
+
+  @doc """
+  Returns the activity's sessions, split at gaps of more than an hour, as
+  `%{start_time:, end_time:, record_count:}` maps in time order.
+  """
+  def sessions(activity) when is_reference(activity) do
+    for {start_time, end_time, record_count} <- NIF.activity_sessions(activity) do
+      %{start_time: start_time, end_time: end_time, record_count: record_count}
+    end
+  end
+
+  @doc """
+  Returns `%{min:, max:, avg:, count:}` for a record field over the records
+  that carry it, or `nil` if none do.
+
+  `field` is any record map key, such as `:heart_rate` or `:enhanced_speed`.
+  Raises `ArgumentError` for an unknown field.
+  """
+  def field_stats(activity, field) when is_reference(activity) and is_atom(field) do
+    NIF.activity_field_stats(activity, field)
+  end
+
+  @doc """
+  Returns the highest mean of a record field over each of `durations`, such
+  as a power-duration curve for `:power`.
+
+  The field is first laid out one value per second. Each record holds its
+  value until the next record carrying the field. Where that record is more
+  than 10 seconds later, or earlier in time, the series breaks, and no
+  window spans the break. Auto-paused or dropped-out stretches are
+  therefore never averaged in.
+
+  `durations` is a list of positive window lengths in seconds. With `:log`
+  (the default), roughly log-spaced durations from 1 second up to the
+  longest unbroken stretch are used, followed by that stretch itself.
+
+  Returns a list of `%{duration:, mean:, start_time:}` maps in the order of
+  `durations`. `start_time` is the Unix timestamp where the best window
+  begins. Durations longer than every unbroken stretch are left out.
+  Raises `ArgumentError` for an unknown field or a duration that isn't a
+  positive integer.
+  """
+  def mean_max(activity, field, durations \\ :log)
+      when is_reference(activity) and is_atom(field) do
+    for {duration, mean, start_time} <- NIF.activity_mean_max(activity, field, durations) do
+      %{duration: duration, mean: mean, start_time: start_time}
+    end
+  end
+
+  @doc """
+  Returns the seconds spent in each zone of a record field, such as
+  `:heart_rate` or `:power`.
+
+  `high_boundaries` is an ascending list of zone upper bounds, like the
+  ones in `device_time_in_zone/1`. Zone `i` holds the values up to and
+  including boundary `i` and above the one before it, and a last zone
+  holds the values above every boundary, so the result has one more
+  element than `high_boundaries`.
+
+  Time comes from the timestamps, not the number of samples. Each record
+  holds its value until the next record carrying the field, as in
+  `mean_max/3`. Where that record is more than 10 seconds later, or
+  earlier in time, the record counts one second, so paused stretches
+  don't count.
+
+  Raises `ArgumentError` for an unknown field or boundaries that aren't
+  ascending numbers.
+  """
+  def time_in_zone(activity, field, high_boundaries)
+      when is_reference(activity) and is_atom(field) and is_list(high_boundaries) do
+    NIF.activity_time_in_zone(activity, field, high_boundaries)
+  end
+
+  @doc """
+  Returns the zone times the device itself recorded, from the file's
+  `time_in_zone` messages, to compare with `time_in_zone/3`.
+
+  Each message is a map with `:timestamp`, `:reference_mesg` (the message
+  number it belongs to, 18 for a session and 19 for a lap) and
+  `:reference_index`, and a `%{high_boundaries:, seconds:}` map or nil for
+  each of `:heart_rate`, `:speed`, `:cadence` and `:power`. Invalid
+  entries are nil.
+  """
+  def device_time_in_zone(activity) when is_reference(activity) do
+    NIF.activity_device_time_in_zone(activity)
+  end
+
+  @doc """
+  Resamples record fields onto a regular time grid, returning each field as
+  a binary of 64-bit native-endian floats, one per grid point.
+
+  A grid point on a record takes the record's value. Between two records
+  carrying the field, the field's policy decides:
+
+    * `:linear` - Interpolate between the two values
+    * `:previous` - Hold the earlier value
+    * `:none` - Leave the point missing
+
+  Points between records more than `:max_gap` seconds apart, and points
+  before the field's first record or after its last, are missing. Missing
+  points are NaN, which `Nx.from_binary(column, :f64)` reads as is.
+
+  ## Options
+
+    * `:fields` - Record fields as a list, or a keyword list of field and
+      policy to mix policies (default: every field with a value)
+    * `:policy` - Policy for fields given without one (default `:linear`)
+    * `:interval` - Grid spacing in seconds (default 1)
+    * `:max_gap` - Longest gap in seconds to fill (default 10)
+    * `:start_time` / `:end_time` - Unix timestamps the grid spans (default:
+      the first and last record), to align several activities
+
+  ## Returns
+
+    * `{:ok, %{start_time:, interval:, count:, columns: %{field => binary}}}`,
+      where point `i` is at `start_time + i * interval`
+    * `{:error, :no_records}` - If the activity has no records to span
+    * `{:error, :too_many_points}` - If the grid has over 2^24 points
+
+  Raises `ArgumentError` for an unknown field or policy.
+  """
+  def resample(activity, opts \\ []) when is_reference(activity) and is_list(opts) do
+    policy = Keyword.get(opts, :policy, :linear)
+
+    fields =
+      case Keyword.get(opts, :fields, :all) do
+        :all -> {:all, policy}
+        fields ->
+          Enum.map(fields, fn
+            {_field, _policy} = field -> field
+            field -> {field, policy}
+          end)
+      end
+
+    interval = Keyword.get(opts, :interval, 1)
+    grid = {interval, Keyword.get(opts, :max_gap, 10), opts[:start_time], opts[:end_time]}
+
+    case NIF.activity_resample(activity, fields, grid) do
+      {:ok, start_time, count, columns} ->
+        columns = Map.new(columns)
+        {:ok, %{start_time: start_time, interval: interval, count: count, columns: columns}}
+
+      error ->
+        error
+    end
+  end
+
+  @doc """
+  Returns the GPS track of the activity in degrees, optionally simplified,
+  for drawing on a map.
+
+  Records without both `:position_lat` and `:position_long` are skipped.
+
+  ## Options
+
+    * `:tolerance` - How far in meters the simplified track may stray from
+      the recorded one (default 0, which keeps every point)
+    * `:algorithm` - `:douglas_peucker` (default) keeps the points further
+      than `:tolerance` from the line through the points kept around them.
+      `:visvalingam` drops the points forming the smallest triangles with
+      their neighbours until none is under `:tolerance` squared in square
+      meters, which keeps the shape of winding sections better.
+    * `:format` - What to return:
+      * `:points` (default) - A list of `{lat, lon}` tuples
+      * `:polyline` - A Google encoded polyline string, at 5 decimals
+      * `:float32` - A binary of 32-bit native-endian floats, latitude and
+        longitude for each point in turn
+
+  Raises `ArgumentError` for an unknown option value or a negative
+  tolerance.
+  """
+  def track(activity, opts \\ []) when is_reference(activity) and is_list(opts) do
+    NIF.activity_track(
+      activity,
+      Keyword.get(opts, :algorithm, :douglas_peucker),
+      Keyword.get(opts, :tolerance, 0),
+      Keyword.get(opts, :format, :points)
+    )
+  end
+
+  @doc """
+  Downsamples record fields for charting, like `FitDecoder.downsample/4`,
+  returning `%{timestamp: [...], field => [...]}`.
+  """
+  def downsample(activity, fields, points, opts \\ [])
+      when is_reference(activity) and is_list(fields) and is_integer(points) and points > 0 do
+    NIF.activity_downsample(activity, fields, points, Keyword.get(opts, :method, :lttb))
+  end
+
+  @doc """
+  Returns the elevation gain and loss of the activity in meters, with its
+  highest and lowest altitude and the climbs along the way.
+
+  Altitude is `:enhanced_altitude`, or `:altitude` for records without it.
+  Barometric noise makes a raw sum of rises grow with the sampling rate, so
+  the altitude is smoothed first, and a rise or fall then counts only once
+  the altitude turns back by `:threshold` from its furthest point. A climb
+  is a counted rise of at least `:min_climb`, from the low point before it
+  to the high point it reaches.
+
+  ## Options
+
+    * `:smoothing` - `{:median, samples}` (default `{:median, 5}`) for a
+      centred median over an odd number of samples, `{:exponential,
+      seconds}` for an exponential moving average with that time constant,
+      or `:none`
+    * `:threshold` - Meters the altitude must turn back by (default 3)
+    * `:min_climb` - Meters a rise must gain to be listed as a climb (default 10)
+
+  ## Returns
+
+  A map with:
+
+    * `:gain` / `:loss` - Total ascent and descent, or nil without altitude
+    * `:max` / `:min` - Highest and lowest smoothed altitude, or nil
+    * `:climbs` - `%{start_time:, end_time:, gain:, distance:, grade:}` maps
+      in time order, with `:grade` in percent. `:distance` and `:grade` are
+      nil without distances.
+    * `:device` - What the device itself recorded, to compare with:
+      `:sessions` holds `%{total_ascent:, total_descent:, max_altitude:,
+      min_altitude:}` for each session message, and `:climb_pro` holds the
+      `climb_pro` messages as `%{timestamp:, climb_pro_event:, climb_number:,
+      climb_category:, current_dist:}`, with enum values as integers. Absent
+      values are nil.
+
+  Raises `ArgumentError` for an unknown smoothing, an even median window or
+  a threshold that isn't positive.
+  """
+  def elevation(activity, opts \\ []) when is_reference(activity) and is_list(opts) do
+    NIF.activity_elevation(
+      activity,
+      Keyword.get(opts, :smoothing, {:median, 5}),
+      Keyword.get(opts, :threshold, 3),
+      Keyword.get(opts, :min_climb, 10)
+    )
+  end
+
+  @doc """
+  Returns training load metrics for the activity as a map of
+  `:normalized_power`, `:intensity_factor`, `:training_stress_score`,
+  `:variability_index`, `:trimp` and `:edwards_trimp`.
+
+  Power and heart rate are laid out one value per second as in
+  `mean_max/3`, so gaps of more than 10 seconds count neither as effort nor
+  as rest.
+
+    * `:normalized_power` - Fourth-power mean of 30-second rolling average
+      power, to the fourth root
+    * `:variability_index` - Normalized power over average power
+    * `:intensity_factor` - Normalized power over `:ftp`
+    * `:training_stress_score` - Hours at intensity factor squared, times 100
+    * `:trimp` - Banister's TRIMP, minutes weighted by exponential heart rate
+      reserve, needing `:max_hr` and `:resting_hr`
+    * `:edwards_trimp` - Minutes in each heart rate zone times the zone
+      number, needing `:hr_zones` or `:max_hr`
+
+  A metric is `nil` when the activity lacks the field or the options it needs.
+
+  ## Options
+
+    * `:ftp` - Functional threshold power in watts
+    * `:max_hr` / `:resting_hr` - Maximum and resting heart rate
+    * `:hr_zones` - Ascending lower bounds of Edwards zones 1 to 5
+      (default 50%, 60%, 70%, 80% and 90% of `:max_hr`)
+    * `:sex` - `:male` (default) or `:female`, for Banister's weighting
+
+  Raises `ArgumentError` for an unknown option or an out-of-range value.
+  """
+  def training_load(activity, opts \\ []) when is_reference(activity) and is_list(opts) do
+    NIF.activity_training_load(activity, opts)
+  end
+
+  @doc """
+  Returns `amount` record maps starting at index `start`, with the same
+  semantics as `Enum.slice/3` on the list from `FitDecoder.decode_fit_file/1`.
+  """
+  def slice(activity, start, amount)
+      when is_reference(activity) and is_integer(start) and is_integer(amount) and amount >= 0 do
+    start = if start < 0, do: record_count(activity) + start, else: start
+
+    if start < 0 do
+      []
+    else
+      NIF.activity_slice(activity, start, amount)
+    end
+  end
+
+  @doc """
+  Returns every record as a map, the same list `FitDecoder.decode_fit_file/1` returns.
+  """
+  def to_maps(activity) when is_reference(activity) do
+    NIF.activity_slice(activity, 0, record_count(activity))
+  end
+end
@@ -3,6 +3,44 @@ defmodule FitDecoderTest do
   alias FitDecoderTest.TestData
   doctest FitDecoder
 
+  # A 60 s ride, a 120 s one two hours later, then a 10 s one a day later
+  @split_samples [{1_000_000_000, 120}, {1_000_000_060, 130}] ++
+                   [{1_000_007_200, 140}, {1_000_007_230, 141}, {1_000_007_320, 142}] ++
+                   [{1_000_093_600, 150}, {1_000_093_610, 151}]
+
+  # A minute at 200 W, a gap, and a minute at 100 W, all at 150 bpm
+  @load_rows Enum.map(0..59, &{1_000_000_000 + &1, 150, 200}) ++
+               Enum.map(200..259, &{1_000_000_000 + &1, 150, 100})
+
+  # A session's time_in_zone with heart rate zone times of 60 s, invalid and 120.5 s
+  # (scale 1000) and high boundaries of 120 and 150 bpm
+  @time_in_zone_data <<0x40, 0, 0, 216::little-16, 5, 253, 4, 0x86, 0, 2, 0x84, 1, 2, 0x84>> <>
+                       <<2, 12, 0x86, 6, 2, 0x02>> <>
+                       <<0x00, 1_000_000_000::little-32, 18::little-16, 0::little-16>> <>
+                       <<60_000::little-32, 0xFFFFFFFF::little-32, 120_500::little-32, 120, 150>>
+
+  # file_id with a product_name string padded to 8 bytes, an hrv message with a
+  # 3-element time array (scale 1000, the middle one invalid) and one record
+  @messages_data <<0x40, 0, 0, 0::little-16, 4, 0, 1, 0x00, 1, 2, 0x84, 2, 2, 0x84, 8, 8, 0x07>> <>
+                   <<0x00, 4, 1::little-16, 3906::little-16, "Edge", 0, 0, 0, 0>> <>
+                   <<0x41, 0, 0, 78::little-16, 1, 0, 6, 0x84>> <>
+                   <<0x01, 500::little-16, 0xFFFF::little-16, 750::little-16>> <>
+                   <<0x42, 0, 0, 20::little-16, 2, 253, 4, 0x86, 3, 1, 0x02>> <>
+                   <<0x02, 1_000_000_000::little-32, 120>>
+
+  # A developer with one described uint16 field, "Power", and a record carrying it
+  # plus an undescribed developer field
+  @developer_data <<0x40, 0, 0, 207::little-16, 1, 3, 1, 0x02, 0x00, 0>> <>
+                    <<0x41, 0, 0, 206::little-16, 5, 0, 1, 0x02, 1, 1, 0x02, 2, 1, 0x02>> <>
+                    <<3, 6, 0x07, 8, 6, 0x07>> <>
+                    <<0x01, 0, 0, 0x84, "Power", 0, "Watts", 0>> <>
+                    <<0x62, 0, 0, 20::little-16, 2, 253, 4, 0x86, 3, 1, 0x02, 2, 0, 2, 0, 1, 1, 0>> <>
+                    <<0x02, 1_000_000_000::little-32, 120, 250::little-16, 7>>
+
+  # A session message to follow @messages_data, as devices write it at the end
+  @session_data <<0x43, 0, 0, 18::little-16, 3, 2, 4, 0x86, 9, 4, 0x86, 5, 1, 0x00>> <>
+                  <<0x03, 1_000_000_000::little-32, 981_991::little-32, 2>>
+
   describe "decode_fit_file/1 with basic inputs" do
     test "returns empty list for empty binary" do
       result = FitDecoder.decode_fit_file(<<>>)
@@ -33,6 +71,29 @@ defmodule FitDecoderTest do
     end
   end
 
+  describe "decode_fit_file/1 record fields" do
+    test "only includes fields the record definitions produce" do
+      records = FitDecoder.decode_fit_file(TestData.synthetic_fit_binary())
+      assert Enum.all?(records, &(Map.keys(&1) |> Enum.sort() == [:heart_rate, :timestamp]))
+    end
+
+    test "includes fields expanded from components" do
+      # Record definition with timestamp and speed (6, uint16, scale 1000), which
+      # expands into enhanced_speed; the second local message redefines it
+      # with heart_rate only
+      data =
+        <<0x40, 0, 0, 20::little-16, 2, 253, 4, 0x86, 6, 2, 0x84>> <>
+          <<0x00, 1_000_000_000::little-32, 2500::little-16>> <>
+          <<0x41, 0, 0, 20::little-16, 2, 253, 4, 0x86, 3, 1, 0x02>> <>
+          <<0x01, 1_000_000_001::little-32, 130>>
+
+      assert FitDecoder.decode_fit_file(TestData.wrap_fit_data(data)) == [
+               %{timestamp: 1_631_065_600, speed: 2.5, enhanced_speed: 2.5},
+               %{timestamp: 1_631_065_601, heart_rate: 130}
+             ]
+    end
+  end
+
   describe "decode_fit_file/1 with real FIT data" do
     test "decodes valid FIT file when available" do
       case TestData.read_test_fit_file() do
@@ -213,6 +274,826 @@ defmodule FitDecoderTest do
     end
   end
 
+  describe "verify_fit_file/1" do
+    test "accepts a valid synthetic FIT file" do
+      assert {:ok, 1} = FitDecoder.verify_fit_file(TestData.synthetic_fit_binary())
+    end
+
+    test "counts chained FIT files" do
+      fit_binary = TestData.synthetic_fit_binary()
+      assert {:ok, 2} = FitDecoder.verify_fit_file(fit_binary <> fit_binary)
+    end
+
+    test "reports a corrupted data byte" do
+      <<head::binary-size(20), byte, rest::binary>> = TestData.synthetic_fit_binary()
+      corrupted = head <> <<Bitwise.bxor(byte, 0xFF)>> <> rest
+      assert {:error, :file_crc_failed, 0} = FitDecoder.verify_fit_file(corrupted)
+    end
+
+    test "reports a corrupted header" do
+      <<size, version, rest::binary>> = TestData.synthetic_fit_binary()
+      corrupted = <<size, version + 1>> <> rest
+      assert {:error, :header_crc_failed, 0} = FitDecoder.verify_fit_file(corrupted)
+    end
+
+    test "reports truncation and the offset of the failing chained file" do
+      fit_binary = TestData.synthetic_fit_binary()
+      truncated = binary_part(fit_binary, 0, byte_size(fit_binary) - 3)
+      offset = byte_size(fit_binary)
+
+      assert {:error, :truncated, 0} = FitDecoder.verify_fit_file(truncated)
+      assert {:error, :truncated, ^offset} = FitDecoder.verify_fit_file(fit_binary <> truncated)
+    end
+
+    test "reports non-FIT data" do
+      assert {:error, :header_invalid, 0} =
+               FitDecoder.verify_fit_file(String.duplicate(<<1, 2, 3, 4>>, 10))
+    end
+
+    test "agrees with decode_fit_file/1 on the test file" do
+      case TestData.test_fit_file_path() do
+        nil ->
+          IO.puts("Skipping verify test - no test file available")
+
+        path ->
+          assert {:ok, count} = FitDecoder.verify_fit_file_from_path(path)
+          assert count >= 1
+          assert is_list(FitDecoder.decode_fit_file_from_path(path))
+      end
+    end
+  end
+
+  describe "summarize_fit_file/2" do
+    test "summarizes a synthetic FIT file without records" do
+      fit_binary = TestData.synthetic_fit_binary([{1_000_000_000, 120}, {1_000_000_060, 150}])
+
+      assert {:ok, summary} = FitDecoder.summarize_fit_file(fit_binary)
+      assert summary.record_count == 2
+      assert summary.start_time == 1_631_065_600
+      assert summary.end_time == 1_631_065_660
+      assert summary.duration_seconds == 60
+      assert summary.date == ~D[2021-09-08]
+      assert summary.total_distance == nil
+      assert summary.heart_rate == %{min: 120, max: 150, avg: 135.0}
+      assert summary.power == nil
+      assert summary.fields == [:timestamp, :heart_rate]
+    end
+
+    test "returns the records when asked" do
+      fit_binary = TestData.synthetic_fit_binary()
+
+      assert {:ok, summary, records} = FitDecoder.summarize_fit_file(fit_binary, records: true)
+      assert records == FitDecoder.decode_fit_file(fit_binary)
+      assert summary.record_count == length(records)
+    end
+
+    test "agrees with get_activity_info/1" do
+      fit_binary = TestData.synthetic_fit_binary()
+      {:ok, info} = FitDecoder.get_activity_info(FitDecoder.decode_fit_file(fit_binary))
+      {:ok, summary} = FitDecoder.summarize_fit_file(fit_binary)
+
+      assert summary.date == info.date
+      assert summary.duration_seconds == info.duration_seconds
+      assert summary.total_distance == info.total_distance
+      assert (:heart_rate in summary.fields) == info.has_heart_rate
+      assert (:altitude in summary.fields) == info.has_altitude
+    end
+
+    test "returns the same errors as decode_fit_file/1" do
+      assert FitDecoder.summarize_fit_file(TestData.invalid_fit_binary()) ==
+               :error_integrity_check_failed
+    end
+
+    test "adds the training load when given its settings" do
+      fit_binary = TestData.record_fit_binary([:heart_rate, :power], @load_rows)
+      opts = [ftp: 250, max_hr: 190, resting_hr: 50]
+
+      assert {:ok, summary} = FitDecoder.summarize_fit_file(fit_binary, opts)
+      load = summary.training_load
+      assert_in_delta load.normalized_power, 170.748, 0.001
+      assert_in_delta load.variability_index, 1.1383, 0.0001
+      assert_in_delta load.intensity_factor, 0.6830, 0.0001
+      assert_in_delta load.training_stress_score, 1.5549, 0.0001
+      assert_in_delta load.trimp, 3.6032, 0.0001
+      assert load.edwards_trimp == 6.0
+
+      assert {:ok, summary} = FitDecoder.summarize_fit_file(fit_binary)
+      refute Map.has_key?(summary, :training_load)
+    end
+
+    test "summarizes the test file" do
+      case TestData.test_fit_file_path() do
+        nil ->
+          IO.puts("Skipping summary test - no test file available")
+
+        path ->
+          assert {:ok, summary} = FitDecoder.summarize_fit_file_from_path(path)
+          records = FitDecoder.decode_fit_file_from_path(path)
+          assert summary.record_count == Enum.count(records, &Map.has_key?(&1, :timestamp))
+      end
+    end
+  end
+
+  describe "decode_sessions/2" do
+    test "splits records at gaps longer than an hour" do
+      fit_binary = TestData.synthetic_fit_binary(@split_samples)
+
+      assert {:ok, sessions} = FitDecoder.decode_sessions(fit_binary)
+
+      assert sessions == [
+               %{start_time: 1_631_065_600, end_time: 1_631_065_660, record_count: 2},
+               %{start_time: 1_631_072_800, end_time: 1_631_072_920, record_count: 3},
+               %{start_time: 1_631_159_200, end_time: 1_631_159_210, record_count: 2}
+             ]
+    end
+
+    test "honours a custom gap" do
+      fit_binary = TestData.synthetic_fit_binary(@split_samples)
+
+      assert {:ok, sessions} = FitDecoder.decode_sessions(fit_binary, gap_seconds: 60)
+      assert Enum.map(sessions, & &1.record_count) == [2, 2, 1, 2]
+
+      assert {:ok, [session]} = FitDecoder.decode_sessions(fit_binary, gap_seconds: 86_400)
+      assert session.record_count == 7
+    end
+
+    test "merges out-of-order timestamps like a sorted split would" do
+      samples = [{1_000_006_000, 1}, {1_000_000_000, 2}, {1_000_003_000, 3}, {1_000_000_100, 4}]
+
+      assert {:ok, [session]} =
+               FitDecoder.decode_sessions(TestData.synthetic_fit_binary(samples))
+
+      assert session == %{start_time: 1_631_065_600, end_time: 1_631_071_600, record_count: 4}
+    end
+
+    test "returns only the longest session's records" do
+      fit_binary = TestData.synthetic_fit_binary(@split_samples)
+
+      assert {:ok, _sessions, records} = FitDecoder.decode_sessions(fit_binary, records: :longest)
+      assert Enum.map(records, & &1.heart_rate) == [140, 141, 142]
+
+      assert {:ok, _sessions, all} = FitDecoder.decode_sessions(fit_binary, records: :all)
+      assert all == FitDecoder.decode_fit_file(fit_binary)
+    end
+
+    test "decode_and_analyze/1 matches get_activity_info/1" do
+      fit_binary = TestData.synthetic_fit_binary(@split_samples)
+      path = Path.join(System.tmp_dir!(), "fit_decoder_sessions_test.fit")
+      File.write!(path, fit_binary)
+
+      try do
+        assert {:ok, {info, records}} = FitDecoder.decode_and_analyze(path)
+        assert records == FitDecoder.decode_fit_file(fit_binary)
+        assert {:ok, info} == FitDecoder.get_activity_info(records)
+        assert info.duration_seconds == 120
+        assert info.record_count == 3
+      after
+        File.rm(path)
+      end
+    end
+  end
+
+  describe "moving_time/2" do
+    # A minute at 5 m/s, half a minute standing still, the timer paused from 91 to 150
+    # with a marker in between, and a minute at 3 m/s until the final stop-all
+    @moving_rows Enum.map(0..60, &{1_000_000_000 + &1, 5.0 * &1, 5.0}) ++
+                   Enum.map(61..90, &{1_000_000_000 + &1, 300.0, 0.0}) ++
+                   Enum.map(150..210, &{1_000_000_000 + &1, 300 + 3.0 * (&1 - 149), 3.0})
+
+    @timer_events [
+      {1_000_000_000, 0},
+      {1_000_000_091, 1},
+      {1_000_000_120, 3},
+      {1_000_000_150, 0},
+      {1_000_000_211, 4}
+    ]
+
+    test "pairs timer events and applies the speed threshold" do
+      fit_binary = TestData.record_fit_binary([:distance, :speed], @moving_rows, @timer_events)
+
+      assert FitDecoder.moving_time(fit_binary) ==
+               {:ok,
+                %{
+                  elapsed_time: 211,
+                  timer_time: 152,
+                  moving_time: 120,
+                  pauses: [%{start_time: 1_631_065_691, end_time: 1_631_065_750}]
+                }}
+
+      # Standing still counts from a threshold of 0, but the pause never does
+      assert {:ok, %{moving_time: 150}} = FitDecoder.moving_time(fit_binary, speed_threshold: 0)
+      assert {:ok, %{moving_time: 60}} = FitDecoder.moving_time(fit_binary, speed_threshold: 4)
+
+      assert_raise ArgumentError, fn ->
+        FitDecoder.moving_time(fit_binary, speed_threshold: -1)
+      end
+    end
+
+    test "runs the timer throughout without timer events" do
+      fit_binary = TestData.record_fit_binary([:distance, :speed], @moving_rows)
+
+      assert {:ok, %{elapsed_time: 210, timer_time: nil, moving_time: 120, pauses: []}} =
+               FitDecoder.moving_time(fit_binary)
+
+      assert {:ok, %{elapsed_time: 1, timer_time: nil, moving_time: nil}} =
+               FitDecoder.moving_time(TestData.synthetic_fit_binary())
+
+      assert FitDecoder.moving_time(TestData.invalid_fit_binary()) ==
+               :error_integrity_check_failed
+    end
+  end
+
+  describe "aggregate/3" do
+    setup do
+      dir = Path.join(System.tmp_dir!(), "fit_decoder_aggregate_test")
+      File.mkdir_p!(dir)
+      on_exit(fn -> File.rm_rf!(dir) end)
+
+      # The ride of the moving_time/2 tests, and the same ride a week later with power and
+      # no timer events
+      first = Path.join(dir, "first.fit")
+      fields = [:distance, :speed]
+      File.write!(first, TestData.record_fit_binary(fields, @moving_rows, @timer_events))
+
+      second = Path.join(dir, "second.fit")
+      rows = for {t, distance, speed} <- @moving_rows, do: {t + 604_800, distance, speed, 200}
+      File.write!(second, TestData.record_fit_binary(fields ++ [:power], rows))
+
+      %{paths: [first, second, Path.join(dir, "missing.fit")]}
+    end
+
+    test "merges per-file metrics by week", %{paths: [first, second, missing] = paths} do
+      metrics = [:count, :distance, :elapsed_time, :timer_time, :moving_time, :max_speed]
+      metrics = metrics ++ [:fastest, :best_power, :power_histogram]
+      opts = [durations: [5], distances: [100, 1000], max_concurrency: 2]
+
+      assert {:ok, result} = FitDecoder.aggregate(paths, metrics, opts)
+      assert result.failed == [{missing, :enoent}]
+      assert result.files == 3
+      assert is_float(result.files_per_second)
+
+      ride = %{
+        count: 1,
+        distance: 483.0,
+        elapsed_time: 211,
+        timer_time: 152,
+        moving_time: 120,
+        max_speed: 5.0,
+        fastest: %{100 => 20},
+        best_power: %{},
+        power_histogram: %{}
+      }
+
+      assert result.groups == %{
+               ~D[2021-09-06] => ride,
+               ~D[2021-09-13] => %{
+                 ride
+                 | elapsed_time: 210,
+                   timer_time: nil,
+                   best_power: %{5 => 200.0},
+                   power_histogram: %{200 => 152}
+               }
+             }
+
+      assert {:ok, %{groups: %{all: all}}} =
+               FitDecoder.aggregate([first, second], metrics, Keyword.put(opts, :group_by, :all))
+
+      assert %{count: 2, distance: 966.0, elapsed_time: 421, timer_time: 152} = all
+      assert %{moving_time: 240, best_power: %{5 => 200.0}} = all
+    end
+
+    test "groups by the local month", %{paths: [first | _]} do
+      assert {:ok, %{groups: groups}} =
+               FitDecoder.aggregate([first], [:count], group_by: :month, utc_offset: -7200)
+
+      # The ride starts at 01:46 UTC on 8 September 2021
+      assert groups == %{~D[2021-09-01] => %{count: 1}}
+      opts = [group_by: :day, utc_offset: -7200]
+      assert {:ok, %{groups: days}} = FitDecoder.aggregate([first], [:count], opts)
+      assert Map.keys(days) == [~D[2021-09-07]]
+    end
+
+    test "rejects unknown or repeated metrics and options", %{paths: paths} do
+      assert_raise ArgumentError, fn -> FitDecoder.aggregate(paths, [:calories]) end
+      assert_raise ArgumentError, fn -> FitDecoder.aggregate(paths, [:count, :count]) end
+      assert_raise ArgumentError, fn -> FitDecoder.aggregate(paths, [:count], group_by: :hour) end
+    end
+  end
+
+  describe "open_activity/1" do
+    alias FitDecoder.Activity
+
+    test "answers the helper questions without decoding to maps" do
+      fit_binary = TestData.synthetic_fit_binary(@split_samples)
+      records = FitDecoder.decode_fit_file(fit_binary)
+
+      assert {:ok, activity} = FitDecoder.open_activity(fit_binary)
+      assert Activity.record_count(activity) == length(records)
+      assert Activity.date(activity) == FitDecoder.get_activity_date(records)
+      assert Activity.duration(activity) == FitDecoder.get_activity_duration(records)
+      assert {:ok, Activity.sessions(activity)} == FitDecoder.decode_sessions(fit_binary)
+    end
+
+    test "computes field statistics" do
+      fit_binary = TestData.synthetic_fit_binary([{1_000_000_000, 120}, {1_000_000_001, 150}])
+      {:ok, activity} = FitDecoder.open_activity(fit_binary)
+
+      assert Activity.field_stats(activity, :heart_rate) == %{min: 120, max: 150, avg: 135.0, count: 2}
+      assert Activity.field_stats(activity, :power) == nil
+      assert_raise ArgumentError, fn -> Activity.field_stats(activity, :not_a_field) end
+    end
+
+    test "computes mean-max curves without spanning gaps" do
+      # 110 holds through the missing second; the gap before 200 breaks the series
+      samples =
+        [{1_000_000_000, 100}, {1_000_000_001, 120}, {1_000_000_002, 110}] ++
+          [{1_000_000_004, 130}, {1_000_000_030, 200}]
+
+      {:ok, activity} = FitDecoder.open_activity(TestData.synthetic_fit_binary(samples))
+
+      assert Activity.mean_max(activity, :heart_rate, [1, 2, 5, 6]) == [
+               %{duration: 1, mean: 200.0, start_time: 1_631_065_630},
+               %{duration: 2, mean: 120.0, start_time: 1_631_065_603},
+               %{duration: 5, mean: 114.0, start_time: 1_631_065_600}
+             ]
+
+      assert Enum.map(Activity.mean_max(activity, :heart_rate), & &1.duration) == [1, 2, 3, 5]
+      assert Activity.mean_max(activity, :power) == []
+      assert_raise ArgumentError, fn -> Activity.mean_max(activity, :heart_rate, [0]) end
+    end
+
+    test "computes the training load" do
+      fit_binary = TestData.record_fit_binary([:heart_rate, :power], @load_rows)
+      {:ok, activity} = FitDecoder.open_activity(fit_binary)
+      load = Activity.training_load(activity, max_hr: 190, hr_zones: [100, 150], sex: :female)
+
+      assert_in_delta load.normalized_power, 170.748, 0.001
+      assert load.intensity_factor == nil
+      assert load.training_stress_score == nil
+      assert load.trimp == nil
+      assert load.edwards_trimp == 4.0
+
+      for opts <- [[ftp: 0], [hr_zones: [150, 100]], [max_hr: 50, resting_hr: 60], [vo2max: 50]] do
+        assert_raise ArgumentError, fn -> Activity.training_load(activity, opts) end
+      end
+    end
+
+    test "computes time in zone from timestamp deltas" do
+      fit_binary = TestData.record_fit_binary([:heart_rate, :power], @load_rows)
+      {:ok, activity} = FitDecoder.open_activity(fit_binary)
+
+      assert Activity.time_in_zone(activity, :power, [100, 150]) == [60, 0, 60]
+      assert Activity.time_in_zone(activity, :heart_rate, []) == [120]
+      assert Activity.time_in_zone(activity, :cadence, [80]) == [0, 0]
+      assert Activity.device_time_in_zone(activity) == []
+      assert_raise ArgumentError, fn -> Activity.time_in_zone(activity, :power, [150, 100]) end
+
+      # 100 holds for 5 s through the missing records, 160 for 1 s before the gap
+      samples = [{1_000_000_000, 100}, {1_000_000_005, 130}, {1_000_000_006, 160}]
+      samples = samples ++ [{1_000_000_100, 110}]
+      {:ok, activity} = FitDecoder.open_activity(TestData.synthetic_fit_binary(samples))
+      assert Activity.time_in_zone(activity, :heart_rate, [120, 150]) == [6, 1, 1]
+    end
+
+    test "returns the device's time in zone messages" do
+      {:ok, activity} = FitDecoder.open_activity(TestData.wrap_fit_data(@time_in_zone_data))
+
+      assert Activity.device_time_in_zone(activity) == [
+               %{
+                 timestamp: 1_631_065_600,
+                 reference_mesg: 18,
+                 reference_index: 0,
+                 heart_rate: %{high_boundaries: [120, 150], seconds: [60.0, nil, 120.5]},
+                 speed: nil,
+                 cadence: nil,
+                 power: nil
+               }
+             ]
+    end
+
+    test "resamples onto a regular grid" do
+      # 100 and 130 are 5 s apart, 160 and 110 94 s apart
+      samples = [{1_000_000_000, 100}, {1_000_000_005, 130}, {1_000_000_006, 160}]
+      samples = samples ++ [{1_000_000_100, 110}]
+      {:ok, activity} = FitDecoder.open_activity(TestData.synthetic_fit_binary(samples))
+
+      assert {:ok, grid} = Activity.resample(activity)
+      assert %{start_time: 1_631_065_600, interval: 1, count: 101} = grid
+      assert Map.keys(grid.columns) == [:heart_rate]
+      heart_rate = TestData.floats(grid.columns.heart_rate)
+      assert Enum.take(heart_rate, 8) == [100.0, 106.0, 112.0, 118.0, 124.0, 130.0, 160.0, :nan]
+      assert List.last(heart_rate) == 110.0
+
+      window = [interval: 2, start_time: 1_631_065_599, end_time: 1_631_065_610]
+      {:ok, grid} = Activity.resample(activity, [policy: :previous] ++ window)
+      assert grid.count == 6
+      assert TestData.floats(grid.columns.heart_rate) == [:nan, 100.0, 100.0, 130.0, :nan, :nan]
+
+      fields = [heart_rate: :none, power: :linear]
+      {:ok, grid} = Activity.resample(activity, [fields: fields] ++ window)
+      assert TestData.floats(grid.columns.heart_rate) == [:nan, :nan, :nan, 130.0, :nan, :nan]
+      assert TestData.floats(grid.columns.power) == List.duplicate(:nan, 6)
+
+      {:ok, grid} = Activity.resample(activity, max_gap: 100, start_time: 1_631_065_606)
+      assert Enum.take(TestData.floats(grid.columns.heart_rate), 2) == [160.0, 159.46808510638297]
+
+      assert_raise ArgumentError, fn -> Activity.resample(activity, policy: :cubic) end
+      {:ok, empty} = FitDecoder.open_activity(<<>>)
+      assert Activity.resample(empty) == {:error, :no_records}
+      assert Activity.resample(activity, interval: 1, end_time: 1_700_000_000) ==
+               {:error, :too_many_points}
+    end
+
+    test "simplifies and encodes the GPS track" do
+      semicircles = fn degrees -> round(degrees * 2_147_483_648 / 180) end
+
+      # The example track of Google's polyline documentation
+      google_example = [{38.5, -120.2}, {40.7, -120.95}, {43.252, -126.453}]
+
+      rows =
+        for {{lat, lon}, i} <- Enum.with_index(google_example) do
+          {1_000_000_000 + i, semicircles.(lat), semicircles.(lon)}
+        end
+
+      fit_binary = TestData.record_fit_binary([:position_lat, :position_long], rows)
+      {:ok, activity} = FitDecoder.open_activity(fit_binary)
+      assert Activity.track(activity, format: :polyline) == "_p~iF~ps|U_ulLnnqC_mqNvxq`@"
+
+      # Points 11 m apart heading north, with one 31 m to the east
+      rows =
+        for i <- 0..10 do
+          lon = if i == 5, do: 7.0004, else: 7.0
+          {1_000_000_000 + i, semicircles.(45.0 + i * 0.0001), semicircles.(lon)}
+        end
+
+      fit_binary = TestData.record_fit_binary([:position_lat, :position_long], rows)
+      {:ok, activity} = FitDecoder.open_activity(fit_binary)
+      assert length(Activity.track(activity)) == 11
+
+      points = Activity.track(activity, tolerance: 10)
+      assert Enum.map(points, fn {lat, _lon} -> Float.round(lat, 4) end) ==
+               [45.0, 45.0004, 45.0005, 45.0006, 45.001]
+
+      for algorithm <- [:douglas_peucker, :visvalingam] do
+        assert [{lat, lon}, _] = Activity.track(activity, algorithm: algorithm, tolerance: 40)
+        assert_in_delta lat, 45.0, 1.0e-7
+        assert_in_delta lon, 7.0, 1.0e-7
+      end
+
+      packed = Activity.track(activity, tolerance: 40, format: :float32)
+      assert <<lat::float-native-32, _lon::float-native-32, _::binary-size(8)>> = packed
+      assert_in_delta lat, 45.0, 1.0e-5
+
+      assert_raise ArgumentError, fn -> Activity.track(activity, tolerance: -1) end
+      assert_raise ArgumentError, fn -> Activity.track(activity, format: :geojson) end
+    end
+
+    test "downsamples fields for charting" do
+      samples =
+        Enum.zip(1_000_000_000..1_000_000_009, [100, 100, 100, 180, 100, 100, 100, 60, 100, 100])
+
+      fit_binary = TestData.synthetic_fit_binary(samples)
+      {:ok, activity} = FitDecoder.open_activity(fit_binary)
+
+      # The spike and the dip each form the largest triangle in their bucket
+      assert Activity.downsample(activity, [:heart_rate], 4) == %{
+               timestamp: [1_631_065_600, 1_631_065_603, 1_631_065_607, 1_631_065_609],
+               heart_rate: [100, 180, 60, 100]
+             }
+
+      assert FitDecoder.downsample(fit_binary, [:heart_rate], 4) ==
+               {:ok, Activity.downsample(activity, [:heart_rate], 4)}
+
+      assert Activity.downsample(activity, [:heart_rate, :power], 4, method: :minmax) == %{
+               timestamp: [1_631_065_603, 1_631_065_607],
+               heart_rate: [180, 60],
+               power: [nil, nil]
+             }
+
+      assert Activity.downsample(activity, [:heart_rate, :power], 1, method: :minmax) == %{
+               timestamp: [1_631_065_607],
+               heart_rate: [60],
+               power: [nil]
+             }
+
+      assert length(Activity.downsample(activity, [:heart_rate], 20).timestamp) == 10
+      assert_raise ArgumentError, fn ->
+        Activity.downsample(activity, [:heart_rate], 4, method: :avg)
+      end
+
+      assert FitDecoder.downsample(TestData.invalid_fit_binary(), [:heart_rate], 4) ==
+               :error_integrity_check_failed
+    end
+
+    test "measures elevation gain, loss and climbs" do
+      # Noise of 1 m, a climb to 150 m, a descent to 120 m, a 2 m bump and a 10 m climb
+      altitudes =
+        [100, 101, 100, 101, 100] ++
+          Enum.map(1..25, &(100 + 2 * &1)) ++
+          Enum.map(1..15, &(150 - 2 * &1)) ++
+          [121, 122, 121, 120] ++ Enum.map(1..5, &(120 + 2 * &1))
+
+      rows =
+        for {altitude, t} <- Enum.with_index(altitudes) do
+          {1_000_000_000 + t, altitude, t * 10}
+        end
+
+      fit_binary = TestData.record_fit_binary([:altitude, :distance], rows)
+      {:ok, activity} = FitDecoder.open_activity(fit_binary)
+
+      raw = Activity.elevation(activity, smoothing: :none)
+      assert %{gain: 60.0, loss: 30.0, max: 150.0, min: 100.0} = raw
+      assert raw.device == %{sessions: [], climb_pro: []}
+
+      assert raw.climbs == [
+               %{
+                 start_time: 1_631_065_604,
+                 end_time: 1_631_065_629,
+                 gain: 50.0,
+                 distance: 250.0,
+                 grade: 20.0
+               },
+               %{
+                 start_time: 1_631_065_648,
+                 end_time: 1_631_065_653,
+                 gain: 10.0,
+                 distance: 50.0,
+                 grade: 20.0
+               }
+             ]
+
+      # The median flattens the turns, leaving the last climb under 10 m
+      smoothed = Activity.elevation(activity)
+      assert %{gain: 57.0, loss: 27.0, max: 148.0, climbs: [climb]} = smoothed
+      assert %{start_time: 1_631_065_602, end_time: 1_631_065_628, gain: 48.0} = climb
+
+      # With a 1 m threshold the bump counts too
+      low_threshold = Activity.elevation(activity, smoothing: :none, threshold: 1, min_climb: 2)
+      assert %{gain: 64.0, climbs: [_, %{gain: 2.0}, _]} = low_threshold
+      assert Activity.elevation(activity, smoothing: {:exponential, 4}).gain < 57.0
+
+      assert_raise ArgumentError, fn -> Activity.elevation(activity, smoothing: {:median, 4}) end
+      assert_raise ArgumentError, fn -> Activity.elevation(activity, threshold: 0) end
+
+      {:ok, no_altitude} = FitDecoder.open_activity(TestData.synthetic_fit_binary())
+      assert %{gain: nil, max: nil, climbs: []} = Activity.elevation(no_altitude)
+    end
+
+    test "slices and converts records like the decoded list" do
+      fit_binary = TestData.synthetic_fit_binary(@split_samples)
+      records = FitDecoder.decode_fit_file(fit_binary)
+      {:ok, activity} = FitDecoder.open_activity(fit_binary)
+
+      assert Activity.to_maps(activity) == records
+
+      for {start, amount} <- [{0, 2}, {2, 3}, {5, 10}, {7, 1}, {20, 1}, {-2, 5}, {-20, 1}] do
+        assert Activity.slice(activity, start, amount) == Enum.slice(records, start, amount)
+      end
+    end
+
+    test "returns decoder errors" do
+      assert FitDecoder.open_activity(TestData.invalid_fit_binary()) ==
+               :error_integrity_check_failed
+
+      assert {:ok, activity} = FitDecoder.open_activity(<<>>)
+      assert Activity.date(activity) == {:error, :no_records}
+      assert Activity.duration(activity) == {:error, :no_records}
+    end
+  end
+
+  describe "decode_fit_file_partial/2" do
+    test "returns every record of a clean file" do
+      fit_binary = TestData.synthetic_fit_binary(@split_samples)
+
+      assert FitDecoder.decode_fit_file_partial(fit_binary) ==
+               {:ok, FitDecoder.decode_fit_file(fit_binary)}
+    end
+
+    test "keeps the records before a truncation" do
+      samples = [{1_000_000_000, 120}, {1_000_000_001, 121}, {1_000_000_002, 122}]
+      fit_binary = TestData.synthetic_fit_binary(samples)
+      # 14-byte header, 12-byte definition, then 6-byte records: cut the third one short
+      truncated = binary_part(fit_binary, 0, 40)
+
+      assert FitDecoder.decode_fit_file(truncated) == :error_sdk_exception
+
+      assert {:partial, records, %{offset: 40, reason: :unexpected_end}} =
+               FitDecoder.decode_fit_file_partial(truncated)
+
+      assert records == Enum.take(FitDecoder.decode_fit_file(fit_binary), 2)
+    end
+
+    test "reports a corrupted file CRC and a missing definition" do
+      fit_binary = TestData.synthetic_fit_binary()
+      size = byte_size(fit_binary)
+      <<body::binary-size(size - 1), last>> = fit_binary
+
+      assert {:partial, [_, _], %{offset: 39, reason: :crc_mismatch}} =
+               FitDecoder.decode_fit_file_partial(<<body::binary, Bitwise.bxor(last, 0xFF)>>)
+
+      # The first record claims local message 1, which was never defined
+      <<head::binary-size(26), _header, rest::binary>> = fit_binary
+
+      assert FitDecoder.decode_fit_file_partial(<<head::binary, 0x01, rest::binary>>) ==
+               {:partial, [], %{offset: 26, reason: :missing_definition}}
+    end
+
+    test "salvages the records after corrupted bytes" do
+      definition = <<0x40, 0, 0, 20::little-16, 2, 253, 4, 0x86, 3, 1, 0x02>>
+      records = for i <- 0..4, do: <<0x00, 1_000_000_000 + i::little-32, 120 + i>>
+      # Five bytes of junk, starting with a header for an undefined local message, at byte 44
+      junk = <<0x07, 0x33, 0x99, 0x01, 0x02>>
+
+      {first, rest} = Enum.split(records, 3)
+      data = definition <> Enum.join(first) <> junk <> definition <> Enum.join(rest)
+      fit_binary = TestData.wrap_fit_data(data)
+
+      assert {:partial, before, %{offset: 44, reason: :missing_definition}} =
+               FitDecoder.decode_fit_file_partial(fit_binary)
+
+      assert length(before) == 3
+
+      assert {:partial, salvaged, %{offset: 44, reason: :missing_definition, skipped: [{44, 49}]}} =
+               FitDecoder.decode_fit_file_partial(fit_binary, salvage: true)
+
+      assert Enum.map(salvaged, & &1.heart_rate) == [120, 121, 122, 123, 124]
+    end
+
+    test "salvages records defined before the corrupted bytes" do
+      definition = <<0x40, 0, 0, 20::little-16, 2, 253, 4, 0x86, 3, 1, 0x02>>
+      records = for i <- 0..4, do: <<0x00, 1_000_000_000 + i::little-32, 120 + i>>
+      junk = <<0x07, 0x33, 0x99, 0x01, 0x02>>
+
+      # The records after the junk rely on the definition at the top of the file
+      {first, rest} = Enum.split(records, 3)
+      data = definition <> Enum.join(first) <> junk <> Enum.join(rest)
+      fit_binary = TestData.wrap_fit_data(data)
+
+      assert {:partial, salvaged, %{offset: 44, reason: :missing_definition, skipped: [{44, 49}]}} =
+               FitDecoder.decode_fit_file_partial(fit_binary, salvage: true)
+
+      assert Enum.map(salvaged, & &1.heart_rate) == [120, 121, 122, 123, 124]
+      assert Enum.map(salvaged, & &1.timestamp) == Enum.to_list(1_631_065_600..1_631_065_604)
+    end
+
+    test "salvaged compressed timestamps continue from the last full timestamp" do
+      definition = <<0x40, 0, 0, 20::little-16, 2, 253, 4, 0x86, 3, 1, 0x02>>
+      # Local message 1 -> record with only heart_rate, for compressed timestamp headers
+      compressed_definition = <<0x41, 0, 0, 20::little-16, 1, 3, 1, 0x02>>
+      records = for i <- 0..2, do: <<0x00, 1_000_000_000 + i::little-32, 120 + i>>
+      junk = <<0x07, 0x33, 0x99, 0x05, 0x06>>
+      # A record without a timestamp, which is dropped, then time offsets 4 and 5
+      tail = <<0x01, 123, 0xA4, 124, 0xA5, 125>>
+
+      fit_binary =
+        TestData.wrap_fit_data(
+          definition <> compressed_definition <> Enum.join(records) <> junk <> tail
+        )
+
+      assert {:partial, salvaged, %{offset: 53, reason: :missing_definition, skipped: [{53, 58}]}} =
+               FitDecoder.decode_fit_file_partial(fit_binary, salvage: true)
+
+      assert Enum.map(salvaged, &{&1.timestamp, &1.heart_rate}) == [
+               {1_631_065_600, 120},
+               {1_631_065_601, 121},
+               {1_631_065_602, 122},
+               {1_631_065_604, 124},
+               {1_631_065_605, 125}
+             ]
+    end
+
+    test "salvage ignores a data size of 0" do
+      definition = <<0x40, 0, 0, 20::little-16, 2, 253, 4, 0x86, 3, 1, 0x02>>
+      # A header whose data size was never written, and no file CRC
+      header = <<14, 0x20, 2171::little-16, 0::little-32, ".FIT", 0::little-16>>
+      fit_binary = header <> definition <> <<0x00, 1_000_000_000::little-32, 120>>
+
+      assert FitDecoder.decode_fit_file_partial(fit_binary) ==
+               {:partial, [], %{offset: 7, reason: :invalid_data_size}}
+
+      assert FitDecoder.decode_fit_file_partial(fit_binary, salvage: true) ==
+               {:ok, [%{timestamp: 1_631_065_600, heart_rate: 120}]}
+    end
+  end
+
+  describe "decode_messages/2" do
+    test "converts messages through the profile" do
+      fit_binary = TestData.wrap_fit_data(@messages_data)
+
+      assert FitDecoder.decode_messages(fit_binary, :all) ==
+               {:ok,
+                %{
+                  file_id: [%{type: 4, manufacturer: 1, garmin_product: 3906, product_name: "Edge"}],
+                  hrv: [%{time: [0.5, nil, 0.75]}],
+                  record: [%{timestamp: 1_631_065_600, heart_rate: 120}]
+                }}
+    end
+
+    test "returns only the requested types" do
+      fit_binary = TestData.wrap_fit_data(@messages_data)
+
+      assert FitDecoder.decode_messages(fit_binary, [:hrv, :lap]) ==
+               {:ok, %{hrv: [%{time: [0.5, nil, 0.75]}], lap: []}}
+
+      assert_raise ArgumentError, fn -> FitDecoder.decode_messages(fit_binary, [:not_a_message]) end
+    end
+
+    test "decodes records like decode_fit_file/1" do
+      fit_binary = TestData.synthetic_fit_binary(@split_samples)
+
+      assert {:ok, %{record: records}} = FitDecoder.decode_messages(fit_binary, [:record])
+      assert records == FitDecoder.decode_fit_file(fit_binary)
+    end
+
+    test "names developer fields from their descriptions" do
+      fit_binary = TestData.wrap_fit_data(@developer_data)
+
+      assert {:ok, %{record: [record], field_description: [description]}} =
+               FitDecoder.decode_messages(fit_binary, [:record, :field_description])
+
+      assert record == %{
+               timestamp: 1_631_065_600,
+               heart_rate: 120,
+               developer_fields: %{"Power" => %{value: 250, units: "Watts"}}
+             }
+
+      assert %{field_name: "Power", units: "Watts", fit_base_type_id: 0x84} = description
+      assert FitDecoder.decode_fit_file(fit_binary) == [%{timestamp: 1_631_065_600, heart_rate: 120}]
+    end
+
+    test "returns decoder errors" do
+      assert FitDecoder.decode_messages(TestData.invalid_fit_binary(), :all) ==
+               :error_integrity_check_failed
+
+      assert FitDecoder.decode_messages_from_path("/nonexistent/file.fit", [:session]) ==
+               {:error, :enoent}
+    end
+  end
+
+  describe "peek/1" do
+    test "returns the metadata messages like decode_messages/2" do
+      fit_binary = TestData.wrap_fit_data(@messages_data <> @session_data)
+
+      assert {:ok, metadata} = FitDecoder.peek(fit_binary)
+
+      assert metadata == %{
+               file_id: [%{type: 4, manufacturer: 1, garmin_product: 3906, product_name: "Edge"}],
+               device_info: [],
+               session: [%{start_time: 1_631_065_600, total_distance: 9819.91, sport: 2}],
+               lap: [],
+               activity: []
+             }
+
+      types = [:file_id, :device_info, :session, :lap, :activity]
+      assert FitDecoder.decode_messages(fit_binary, types) == {:ok, metadata}
+    end
+
+    test "skips the file CRC but not a truncated message" do
+      fit_binary = TestData.wrap_fit_data(@messages_data <> @session_data)
+      bad_crc = binary_part(fit_binary, 0, byte_size(fit_binary) - 1) <> <<0>>
+      assert {:ok, %{session: [_]}} = FitDecoder.peek(bad_crc)
+
+      truncated = TestData.wrap_fit_data(@messages_data <> binary_part(@session_data, 0, 18))
+      assert FitDecoder.peek(truncated) == :error_integrity_check_failed
+      assert FitDecoder.peek_from_path("/nonexistent/file.fit") == {:error, :enoent}
+    end
+  end
+
+  describe "census/1" do
+    test "counts messages by type without decoding them" do
+      # A message type the profile doesn't know, then @developer_data redefining locals 0-2
+      unknown = <<0x44, 0, 0, 0xFF00::little-16, 1, 0, 2, 0x84, 0x04, 1::little-16>>
+      data = @messages_data <> @session_data <> unknown <> @developer_data
+
+      assert {:ok, census} = FitDecoder.census(TestData.wrap_fit_data(data))
+      assert %{files: 1, definitions: 8, messages: 8} = census
+      assert census.bytes == byte_size(data)
+
+      assert census.types == %{
+               0xFF00 => %{messages: 1, bytes: 3, definitions: 1, developer_bytes: 0},
+               file_id: %{messages: 1, bytes: 14, definitions: 1, developer_bytes: 0},
+               hrv: %{messages: 1, bytes: 7, definitions: 1, developer_bytes: 0},
+               record: %{messages: 2, bytes: 15, definitions: 2, developer_bytes: 3},
+               session: %{messages: 1, bytes: 10, definitions: 1, developer_bytes: 0},
+               developer_data_id: %{messages: 1, bytes: 2, definitions: 1, developer_bytes: 0},
+               field_description: %{messages: 1, bytes: 16, definitions: 1, developer_bytes: 0}
+             }
+
+      assert census.developer_fields == %{{0, 0} => 1, {0, 1} => 1}
+    end
+
+    test "counts chained files and rejects truncated ones" do
+      fit_binary = TestData.synthetic_fit_binary(@split_samples)
+
+      assert {:ok, %{files: 2, messages: 14, types: %{record: %{messages: 14, definitions: 2}}}} =
+               FitDecoder.census(fit_binary <> fit_binary)
+
+      truncated = binary_part(fit_binary, 0, byte_size(fit_binary) - 4)
+      assert FitDecoder.census(truncated) == :error_integrity_check_failed
+      assert FitDecoder.census_from_path("/nonexistent/file.fit") == {:error, :enoent}
+    end
+  end
+
   describe "helper functions" do
     test "decode_fit_file_from_path/1 works with valid file" do
       case TestData.test_fit_file_path() do
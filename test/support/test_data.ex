@@ -3,6 +3,8 @@ defmodule FitDecoderTest.TestData do
   Test data and utilities for FIT decoder tests.
   """
 
+  import Bitwise
+
   @doc """
   Returns the path to a test FIT file if it exists, or nil if not available.
   This allows tests to be conditional on whether test data is available.
@@ -29,6 +31,133 @@ defmodule FitDecoderTest.TestData do
     <<1, 2, 3, 4>>
   end
 
+  @doc """
+  Builds a small, valid FIT activity binary in memory.
+
+  `samples` is a list of `{fit_timestamp, heart_rate}` tuples, each encoded as
+  a Record message with a timestamp and heart_rate field. The header carries a
+  CRC and the file ends with a valid file CRC, so the result can be decoded and
+  verified without an external test file.
+  """
+  def synthetic_fit_binary(samples \\ [{1_000_000_000, 120}, {1_000_000_001, 121}]) do
+    # Definition message for local message 0 -> global 20 (record):
+    # timestamp (253, 4 bytes, uint32) and heart_rate (3, 1 byte, uint8).
+    definition = <<0x40, 0, 0, 20::little-16, 2, 253, 4, 0x86, 3, 1, 0x02>>
+
+    records =
+      for {timestamp, heart_rate} <- samples, into: <<>> do
+        <<0x00, timestamp::little-32, heart_rate::8>>
+      end
+
+    wrap_fit_data(definition <> records)
+  end
+
+  # Record fields record_fit_binary/2 can encode: {field number, size, base type, scale, offset}
+  @record_encodings %{
+    position_lat: {0, 4, 0x85, 1, 0},
+    position_long: {1, 4, 0x85, 1, 0},
+    altitude: {2, 2, 0x84, 5, 500},
+    heart_rate: {3, 1, 0x02, 1, 0},
+    cadence: {4, 1, 0x02, 1, 0},
+    distance: {5, 4, 0x86, 100, 0},
+    speed: {6, 2, 0x84, 1000, 0},
+    power: {7, 2, 0x84, 1, 0}
+  }
+
+  @doc """
+  Builds a valid FIT file of Record messages carrying `fields` besides the
+  timestamp.
+
+  Each row is a tuple of a FIT timestamp followed by one value per field, in
+  the field's decoded units (meters, m/s, ...), or nil to leave it invalid.
+
+  `timer_events` are `{timestamp, event_type}` tuples for timer Event
+  messages (0 start, 1 stop, 3 marker, 4 stop all), merged in by timestamp
+  ahead of the records at the same timestamp.
+  """
+  def record_fit_binary(fields, rows, timer_events \\ []) do
+    encodings = Enum.map(fields, &Map.fetch!(@record_encodings, &1))
+    field_definitions = for {num, size, type, _, _} <- encodings, do: <<num, size, type>>
+    header = <<0x40, 0, 0, 20::little-16, length(fields) + 1, 253, 4, 0x86>>
+    definition = IO.iodata_to_binary([header | field_definitions])
+
+    # Local message 1 -> global 21 (event): timestamp, event (enum) and event_type (enum)
+    definition =
+      if timer_events == [],
+        do: definition,
+        else: definition <> <<0x41, 0, 0, 21::little-16, 3, 253, 4, 0x86, 0, 1, 0, 1, 1, 0>>
+
+    records =
+      for row <- rows do
+        [timestamp | values] = Tuple.to_list(row)
+        encoded = Enum.zip_with(values, encodings, &encode_value/2)
+        {timestamp, [<<0x00, timestamp::little-32>> | encoded]}
+      end
+
+    events =
+      for {timestamp, event_type} <- timer_events do
+        {timestamp, <<0x01, timestamp::little-32, 0, event_type>>}
+      end
+
+    # Enum.sort_by/2 is stable, so events stay ahead of records at the same timestamp
+    messages = (events ++ records) |> Enum.sort_by(&elem(&1, 0)) |> Enum.map(&elem(&1, 1))
+    wrap_fit_data(definition <> IO.iodata_to_binary(messages))
+  end
+
+  defp encode_value(nil, {_num, size, base_type, _scale, _offset}) do
+    invalid = if base_type == 0x85, do: (1 <<< (size * 8 - 1)) - 1, else: (1 <<< (size * 8)) - 1
+    <<invalid::little-size(size * 8)>>
+  end
+
+  defp encode_value(value, {_num, size, _base_type, scale, offset}) do
+    <<round((value + offset) * scale)::little-size(size * 8)>>
+  end
+
+  @doc """
+  Reads a binary of 64-bit native-endian floats into a list, with `:nan` for
+  NaN, which no float pattern matches.
+  """
+  def floats(binary) do
+    for <<value::binary-size(8) <- binary>> do
+      case value do
+        <<float::float-native-64>> -> float
+        _ -> :nan
+      end
+    end
+  end
+
+  @doc """
+  Wraps raw FIT message bytes with a 14-byte file header and trailing file CRC.
+  """
+  def wrap_fit_data(data) do
+    header = <<14, 0x20, 2171::little-16, byte_size(data)::little-32, ".FIT">>
+    header = header <> <<crc16(header)::little-16>>
+    file = header <> data
+    file <> <<crc16(file)::little-16>>
+  end
+
+  @crc_table {0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401, 0xA001, 0x6C00,
+              0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400}
+
+  @doc """
+  Computes the FIT CRC-16 of a binary.
+  """
+  def crc16(binary), do: crc16(binary, 0)
+
+  defp crc16(<<>>, crc), do: crc
+
+  defp crc16(<<byte, rest::binary>>, crc) do
+    crc = crc16_nibble(crc, byte &&& 0x0F)
+    crc = crc16_nibble(crc, byte >>> 4)
+    crc16(rest, crc)
+  end
+
+  defp crc16_nibble(crc, nibble) do
+    tmp = elem(@crc_table, crc &&& 0x0F)
+    crc = (crc >>> 4) &&& 0x0FFF
+    bxor(bxor(crc, tmp), elem(@crc_table, nibble))
+  end
+
   @doc """
   Validates that a record has the expected structure and data types.
   """